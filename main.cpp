@@ -55,7 +55,8 @@ Note that performing range-checking data validation without any
 accompanying type-checking data validation is inherently risky, since
 the ability to inspect an input value to see if is within an
 acceptable range of values or a member of an acceptable set of values
-is dependent on being able to get a value with the expected data type n the first place. If range-checking data validation is to be
+is dependent on being able to get a value with the expected data
+type n the first place. If range-checking data validation is to be
 performed, then ideally it should be preceded by type-checking data
 validation. As an example, if the user is asked to input a value of
 data type int that is within the range of 5 to 10, then their provided
@@ -166,7 +167,8 @@ especially helpful for type-checking data validation purposes:
                 from the input buffer, stopping earlier if a character
                 value matching delim is encountered.
 
-Using these three methods, repetition type-checking data validation can be achieved as shown in the following algorithm:
+Using these three methods, repetition type-checking data validation
+can be achieved as shown in the following algorithm:
 
         1. Use cin >> to attempt to get an input value whose data type
            matches the data type of the target variable.
@@ -222,9 +224,313 @@ Notice that this code performs data validation for int and float
 values, as well for values of an abstract data type named element,
 which is simply a nickname for one of the standard primitive C++ data
 types such as int, long int, float, double, char, bool, or string. In
-order to use the element data type correctly, be sure to uncomment the
-correct block of typedef statement and global constant declarations
-shown below.
+order to demonstrate a different data type, change the element typedef
+statement shown below. The names and ranges for each data type are
+given by the element_traits specializations next to it, and the
+read_validated() and read_validated_in_range() function templates
+perform repetition type-checking and range-checking data validation
+for any one of them, so a single program can validate all seven.
+
+When the program is started as
+
+        main --batch int
+
+(or with long, float, double, char, bool, string, or element in place
+of int), it does not prompt the user at all. Instead, it reads the
+whole of its standard input as a series of records, one per line,
+applies the same type-checking and range-checking rules to every
+record, writes each accepted value to standard output, and finishes by
+writing a count of the accepted and rejected records to standard
+error. If a file name follows the data type, as in
+
+        main --batch int records.txt
+
+then that file is mapped into memory and its records are validated
+straight from the mapped bytes, without being copied through cin.
+
+When standard input or standard output is not a terminal, for example
+when the inputs are piped in from another program, no one is reading
+the prompts as they appear. The program then lets its output build up
+in a large buffer and writes it out in a few big pieces, instead of
+once per prompt. Starting the program as
+
+        main --quiet
+
+drops the prompts and retry messages altogether, leaving only the
+accepted values.
+
+Retry messages are no help to anyone auditing the inputs afterwards,
+so the option --reject-log LOG, in either the interactive or the batch
+mode, also writes one line to the file LOG for every rejected value.
+Each line is a small JSON object giving the byte offset and line
+number of the value in the input, which check it failed ("type" or
+"range", just as the retry messages tell them apart), and its raw
+bytes. The validating code only copies each entry into a ring of slots
+in memory, without waiting on any lock, and a thread of its own writes
+the ring out to LOG, so logging does not slow the validation down,
+unless records are rejected faster than LOG can be written: then the
+validating threads wait for room in the ring, since an audit log that
+left entries out would be no use.
+
+A program that reads the accepted values back in would otherwise have
+to parse the text that was formatted for it. For ints, longs, floats,
+and doubles, the batch option --columnar OUT instead writes the values
+to the file OUT in binary form: one value for every non-blank record,
+packed one after another, followed by a bitmap with one bit per value
+telling whether it was accepted. The file can be mapped into memory,
+and its two buffers are laid out just as Apache Arrow lays out a
+primitive array, so they can be used without being copied or parsed.
+
+Records need not hold a single value. Starting the program as
+
+        main --batch record --fields int,float:0:100,element rows.csv
+
+validates each line of rows.csv as a record of three fields separated
+by commas (or by the character given with --delimiter, which may be
+tab): an int within the range the demonstrations use, a float from 0
+to 100, and an element within the range of ELEMENT_LOW to ELEMENT_HIGH.
+Each field is checked by the same fused validator as a single value,
+and the ends of the fields and of the record are found in the same
+scan of the line, so a record is read only once however many fields
+it has. A record is accepted only if it has exactly the right number
+of fields and every one of them is valid; a rejected record is logged
+with the number of the field that failed.
+
+The ranges need not be fixed when the program is compiled. The option
+--rules RULES, in either mode, loads a rules file in which each line
+gives a rule a name, a data type, and optionally a range, as in
+
+        int = int:17:52
+        float = float:28.6:73.2
+        price = double:0:1000
+
+A rule named int, float, or element changes the range used by that
+demonstration, as long as it is of the same data type (the data type
+of each demonstration is still fixed by the code). In batch mode, any
+rule can be named in place of a data type, after --batch or in the
+list given to --fields. Each rule is made only once, when the file is
+loaded, by looking up its data type in a table of functions that each
+make a rule for one data type; the rule that results calls a validator
+specialized for its data type, so the table is never consulted again
+while the records are being validated.
+
+Range checking is not always a matter of lying between two bounds: a
+value may have to be a member of some set of acceptable values
+instead. A rule in a rules file can list such a set after the word in,
+as in "primes = int:1:100 in 2 3 5 7 11", and a value must then be
+both within the range and one of the members. The set is looked up in
+constant time however large it is: whole numbers and characters that
+lie close together are kept as a bitset, with one bit for each value,
+and anything else, including strings, in a table indexed by a perfect
+hash of the members, which is found when the rules file is loaded, so
+that a value is compared with one member at most. Rules named int or
+element that give a set are used by the range-checking
+demonstrations of those data types as well.
+
+To measure how fast the readers are, start the program as
+
+        main --benchmark --records 1000000 --mix 70,10,10,10
+
+which feeds each of read_int(), read_float(), read_element(), and the
+three range-checking readers a million synthetic records from memory,
+70% of them valid, 10% of the wrong data type, 10% out of range, and
+10% longer than 80 characters (the lines that cin.ignore(80, '\n')
+used to leave part of behind). For each reader, it writes the records
+and bytes read per second, and the median and 99th percentile time
+each call takes to return a value, including the time spent rejecting
+the invalid records before that value.
+
+To check that all of these engines still validate just as the
+original readers did, start the program as
+
+        main --regress --records 200000 --baseline baseline.txt
+
+which keeps the original loops of read_int(), read_float(), and
+read_element(), reading with cin >> from a string instead of from the
+user, as oracles. It makes up records from pieces of numbers, words,
+and whitespace at random, and checks that parse_value(), the fused
+validators, the batch mode on one thread and on several, and the
+interactive readers each accept and reject exactly the records the
+oracles do, and read the same values from them. It then measures how
+fast the readers and the batch mode are, and fails if any of them has
+become more than 20% slower (or the percentage given by --tolerance
+PCT) than the throughput kept in the baseline file, which is written
+on the first run.
+
+To validate many slow producers at once, start the program as
+
+        main --serve int 5000 /tmp/sensor.fifo -
+
+which accepts connections on TCP port 5000, and reads the named pipe
+/tmp/sensor.fifo and standard input as well, validating every stream
+with the same repetition algorithm as read_validated_in_range(). Each
+stream is read by a coroutine of its own, whose call to
+async_read_validated_in_range() is co_awaited just as the readers
+above are called; when a stream has nothing more to read for the
+moment, its coroutine is suspended, and it is resumed by an event
+loop once epoll says that more has arrived, or once the time budget
+of its stream has run out, so a single thread serves thousands of
+streams. Every stream has its own buffer of pending
+input, the retry messages are sent back to the producer over its
+socket, and each accepted value is written to standard output after
+the number of its stream and a tab.
+
+While it runs, in any mode, the program counts the values it accepts,
+the values it rejects for their data type and for their range, the
+characters it discards to get back to the start of a record, and (when
+asked to) the time it spends validating. Each thread keeps counters of
+its own, so counting never makes one thread wait for another, and they
+are only added up when they are wanted. The option --metrics OUT
+writes them to the file OUT (or to standard error if OUT is -) as the
+program finishes, in the Prometheus text format, or as JSON with the
+option --metrics-format json as well.
+
+The combined type-checking and range-checking algorithm is carried out
+by read_validated_in_range(), which does not type-check an input and
+then range-check it as two separate steps. Instead, a fused validator
+(validate_value()) reads each input once and reports one of three
+outcomes: VALID, INVALID_TYPE, or INVALID_RANGE. The algorithm then
+continues exactly as described above, depending on which check failed.
+For whole numbers, the range is checked in the same pass that reads
+the digits, and a whole number with too many digits to fit in its
+data type always fails the type check, however it is being read.
+
+The ranges used by the demonstrations and the batch mode are written
+as validation rules: constexpr values of the validation_rule template,
+each giving a data type, a range whose ends may be closed or open, and
+an optional set of allowed values. A rule is passed to the code that
+checks it as a template argument, so its bounds are known to the
+compiler, which validate_by_rule() lets fold into the loop that reads
+the digits of a whole number.
+
+In batch mode, the records are type-checked a few thousand at a time
+into a column of values, and each column is then range-checked as a
+whole by the range_check() kernel, which for ints, floats, and doubles
+compares many values at once using AVX2 or SSE2 instructions and
+records the outcome for each value as one bit of a bitmap. Strings
+are not copied into the column at all: each one is a string_view that
+refers to its characters where they lie in the input, so validating a
+column of strings allocates no memory per record. The interactive
+readers likewise check a string in place, and copy it into the
+string they return only once it has been accepted.
+
+Columns of chars and bools, such as flags and one-letter codes, are
+not parsed record by record at all unless they have to be. Where the
+records hold nothing but a value and its newline, the flag kernels
+accept a whole run of them at once and copy it to the output as it
+is: accept_char_run() checks 16 or 32 characters at a time against
+the range of chars (for example 'a' to 'z') using AVX2 or SSE2
+instructions, or otherwise against a table of all 256 characters,
+and accept_bool_run() compares each record with "true" and "false"
+as one 64-bit word. Only a record that breaks the run, such as one
+out of range or with spaces around its value, is left to the parser.
+
+Adding the option --threads N after the data type, as in
+
+        main --batch int --threads 8 records.txt
+
+splits the input into chunks at line boundaries and validates them on
+N threads at once (or on one thread per processor if N is 0). The
+accepted values of each chunk are collected separately and written out
+in their original order, so the output is the same however many
+threads are used. Adding the option --steal as well splits the input
+into many small chunks instead of one per thread, and lets a thread
+that has finished its own chunks steal half of those another thread
+has not yet started, so that a few slow stretches of input do not
+leave the other threads idle.
+
+Reading the input, validating it, and writing out the accepted values
+are done as three stages that overlap, each on a thread of its own (the
+validating stage on the N threads), rather than one after the other
+for each block of input. The stages hand blocks on to each other
+through small queues that need no locks, as only one thread ever puts
+blocks into each queue and only one takes them out; once a few blocks
+are in flight, a stage that gets ahead waits for the stage after it,
+so the whole run goes as fast as its slowest stage, and no faster.
+
+On a machine with more than one socket, each with memory of its own
+(a NUMA node), a thread that reads memory on another node is slowed
+down by the traffic between the sockets. The option --pin pins each
+thread to one processor, spreading the threads evenly over the nodes
+that Linux reports, or over those given by --topology SPEC (such as
+0-3,8-11/4-7,12-15 for two nodes). Linux places memory on the node of
+the thread that first touches it, so each pinned thread fills its own
+buffers of accepted values on its own node, and keeps the same
+buffers from one block of input to the next.
+
+A FILE compressed with gzip is recognised by its first two bytes and
+decompressed as it is validated, with no temporary file; compressed
+standard input needs the option --gzip. A thread of its own inflates
+the input into a few large buffers that are used over and over, while
+the other threads validate the records of the buffer before, which are
+taken straight from where they were inflated. Only where a record is
+cut in two by the end of a buffer are its first characters copied, to
+join them to the rest of it at the start of the next buffer.
+
+Adding the option --cache CACHE keeps the outcome of type-checking
+each record in the file CACHE, keyed by a hash of the record's bytes
+and of the check made (its data type, its range, and its parser), so
+that a later run over mostly the same records looks their outcomes up
+instead of parsing them again. The range check is still made on every
+run, as it is done on whole columns at once and costs little. The
+file is mapped into memory and kept between runs; it is made again,
+empty, if it was written by a build whose parsers behave differently.
+Whether the cache saves time depends on how much parsing a record
+costs compared with looking it up: for short numbers, parsing is
+already about as fast as a lookup in a table too large for the
+processor's caches.
+
+The readers themselves no longer hand each input to cin >>. Instead,
+they take whole lines from an input source (standard input, read in
+large blocks) into a buffer of pending input, and a small parsing
+engine built on std::from_chars() (the parse_value() functions below)
+gets values straight out of that buffer. The engine accepts and
+rejects the same inputs as cin >> does, with one exception: a
+fractional number must make up a whole token, so that "1.2.3" or
+"4.5kg" is invalid, rather than being taken as 1.2 or 4.5 with the
+rest left for the next input. Fractional numbers are also parsed by
+the engine itself, which gets the correctly rounded value of most
+inputs with a single multiplication or division (leaving only those
+with many digits or a large exponent to std::from_chars()), so that
+a value next to a bound such as 5.5 or 42.8 is compared exactly as
+it was typed, whatever the library. Running the program with the
+option --strict goes further, in every mode: each line must then hold
+exactly one value, so "42abc" and "42 43" are invalid whole numbers,
+found out in the same scan that reads the 42, instead of leaving
+"abc" or "43" behind to fail (or succeed) as the next input. The
+buffer of pending input behaves just like cin's own input buffer, so
+the repetition algorithms above still apply step for step: a failed
+attempt leaves the invalid input waiting in the buffer, to be
+discarded before the user is asked again. One step is improved upon:
+where cin.ignore(80, '\n') would stop after 80 keystrokes and leave
+the rest of a longer line to be mistaken for the next input, the
+readers discard the whole line, however long it is. The ends of lines
+are found by a scanner that uses AVX2, SSE2, or NEON instructions to
+compare many characters at once. Because std::from_chars() is used,
+and validation rules are passed as template arguments (see below),
+this program must be compiled as C++20 or later, and it must be linked
+with zlib (-lz), which it uses to read compressed input (see above).
+The parsing engine and the batch validators are kept apart from this
+file, in validation.cpp, which also builds alone as a library: other
+programs can then call the batch validators on buffers of their own
+through validation.h, and get the accepted values back, rather than
+running this program once for each batch and reading its output.
+
+The loops of the readers above repeat for as long as the user keeps
+entering invalid inputs, which is the point of them; but when the
+input is not a user at all, and is cut short or never holds a valid
+value, nothing would ever stop them, and at the end of the input,
+where cin.good() can never again become true, they would spin as fast
+as the processor allows. So the readers here give up once the input
+ends, instead of asking again, and may also be given a budget: how many
+invalid inputs, how many characters, and how many milliseconds they
+may spend trying to get one value, and the whole input. A reader that
+gives up returns T() in place of a value and sets reader_status to the
+reason (a read_status such as READ_RETRY_LIMIT), which the
+demonstrations check before displaying what was entered. Checking the
+budget costs a counter or two per rejected input; only the time
+limits read the clock, once per retry, and they also make the reader
+stop waiting for input that never comes.
 
 
 ----------------
@@ -276,56 +582,30 @@ element?
 //////////////////////////////////////////////////////////////////////
 
 
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <coroutine>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <system_error>
 
-using namespace std;
-
-
-// the following blocks of typedef statements and global constant
-// declarations are used for repetition type-checking data
-// validation and repetition range-checking data validation for the
-// element data type
-//
-// uncomment one and only one of these blocks, depending on what
-// underlying primitive data type (int, long int, float, double, char,
-// bool, or string) for which element is a nickname
-
-typedef int element;
-const string ELEMENT_NAME = "whole number";
-const element ELEMENT_LOW = 17;
-const element ELEMENT_HIGH = 52;
-
-// typedef long int element;
-// const string ELEMENT_NAME = "big whole number";
-// const element ELEMENT_LOW = 17;
-// const element ELEMENT_HIGH = 52;
-
-// typedef float element;
-// const string ELEMENT_NAME = "fractional number";
-// const element ELEMENT_LOW = 28.6;
-// const element ELEMENT_HIGH = 73.2;
-
-// typedef double element;
-// const string ELEMENT_NAME = "big fractional number";
-// const element ELEMENT_LOW = 28.6;
-// const element ELEMENT_HIGH = 73.2;
-
-// typedef char element;
-// const string ELEMENT_NAME = "character";
-// const element ELEMENT_LOW = 'a';
-// const element ELEMENT_HIGH = 'z';
-
-// typedef bool element;
-// const string ELEMENT_NAME = "boolean";
-// const element ELEMENT_LOW = false;
-// const element ELEMENT_HIGH = true;
-
-// typedef string element;
-// const string ELEMENT_NAME = "string";
-// const element ELEMENT_LOW = "Alpha";
-// const element ELEMENT_HIGH = "Omega";
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <zlib.h>
 
+#include "validation_engine.h"
 
+using namespace std;
+using namespace validation;
 //////////////////////////////////////////////////////////////////////
 
 
@@ -339,6 +619,132 @@ float read_float();
 element read_element();
 
 
+// prototypes for the templated repetition type-checking and combined
+// repetition type-checking and range-checking data validation
+// functions that the three functions above are built on
+//
+// kind describes the expected input to the user, such as "a whole
+// number"; by default it is taken from element_traits<T>, as are the
+// bounds of the range
+//
+// if allowed is given, a value must also be one of its members to be
+// accepted, which counts as part of its range check
+
+template <typename T>
+T read_validated(const string &kind = string("a ")
+                                      + element_traits<T>::NAME);
+
+template <typename T>
+T read_validated_in_range(T low = T(element_traits<T>::LOW),
+                          T high = T(element_traits<T>::HIGH),
+                          const string &kind = string("a ")
+                                               + element_traits<T>::NAME,
+                          const allowed_set<T> *allowed = nullptr);
+
+
+// the budget that limits how long the readers keep asking for a value
+//
+// a reader that is never given a valid value would otherwise ask again
+// forever, and at the end of the input, where nothing more can ever
+// arrive, it would do so as fast as the processor allows; instead, a
+// reader gives up once the input ends, or once it has used up the
+// budget for the value it is after (the record) or for the input as a
+// whole (the stream), and sets reader_status to say why, returning
+// T() in place of a value
+//
+// each limit of 0 means that there is no such limit; the retries are
+// the invalid inputs rejected, the bytes are the characters read,
+// newlines included, and the times are measured from when the reader
+// started on the value, or from when the first reader started
+
+
+struct read_budget {
+    unsigned long record_retries = 0;
+    uint64_t record_bytes = 0;
+    chrono::milliseconds record_time{0};
+    unsigned long stream_retries = 0;
+    uint64_t stream_bytes = 0;
+    chrono::milliseconds stream_time{0};
+};
+
+extern read_budget budget;
+
+extern read_status reader_status;
+
+// it returns a description of status, such as "too many invalid
+// inputs", for messages to the user
+
+const char *describe_status(read_status status);
+
+// parse_count() reads a count, such as a limit of the budget, given on
+// the command line: if text is made of digits alone, and the number
+// they make is no more than most, count is set to it and true is
+// returned; otherwise false is returned, and count is not changed
+//
+// the time limits are kept to a year, so that adding one to the time
+// a reader starts can never overflow the clock
+
+bool parse_count(const char *text, uint64_t most, uint64_t &count);
+
+const uint64_t MAX_BUDGET_MILLISECONDS = 1000ull * 60 * 60 * 24 * 365;
+
+
+// the input source used by the interactive readers
+extern input_source *reader_source;
+
+
+// whether the readers are talking to a user at a terminal, and the
+// stream that the prompts and retry messages meant for that user are
+// written to
+//
+// when standard input or output is not a terminal, output is only
+// written once a large buffer of it has built up, and the prompts can
+// be dropped altogether, instead of being written to cout
+
+extern bool interactive;
+
+extern ostream prompts;
+
+void configure_output(bool quiet);
+
+// the log that rejected records are written to, or a null pointer if
+// they are not being logged
+extern rejection_log *rejections;
+
+// prototypes for the functions that manage the characters of the
+// current record that the readers have not yet used, which play the
+// part of cin's own input buffer
+
+bool fill_pending_input();
+
+void discard_pending_input();
+
+void reset_pending_input();
+
+// prototypes for the functions that keep track of the budget of the
+// readers: within_limit() tells whether used is within limit, where a
+// limit of 0 means no limit; start_record_budget() starts the budget
+// of a value afresh; and charge_retry() counts a rejected input
+// against it, each returning false once a limit has been reached
+
+bool within_limit(uint64_t used, uint64_t limit);
+
+bool start_record_budget();
+
+bool charge_retry();
+
+void log_pending_rejection(validation_outcome reason, const char *first,
+                           const char *last);
+
+template <typename T>
+bool read_value(T &userval);
+
+template <typename T>
+validation_outcome read_value_in_range(T &userval, T low, T high,
+                                       const allowed_set<T> *allowed
+                                       = nullptr);
+
+
 //////////////////////////////////////////////////////////////////////
 
 
@@ -379,160 +785,1420 @@ void demo_element_type_and_range_checking();
 //////////////////////////////////////////////////////////////////////
 
 
-int main() {
+// prototypes for the functions that benchmark the interactive readers
+// by feeding them synthetic input from memory, and measure how many
+// records and bytes they get through per second, and how long each
+// call takes; a call returns one accepted value, after rejecting any
+// invalid records before it
+
+// the kinds of synthetic records
+enum synthetic_kind {
+    SYNTHETIC_VALID,            // a value within the range
+    SYNTHETIC_WRONG_TYPE,       // a word that is not a number
+    SYNTHETIC_OUT_OF_RANGE,     // a value outside the range
+    SYNTHETIC_OVERLONG,         // a line of more than 80 characters
+    SYNTHETIC_KINDS
+};
+
+// the settings of the benchmark mode, given on the command line
+struct benchmark_options {
+    size_t records = 1000000;   // the records fed to each reader
+    // the percentage of the records of each synthetic_kind
+    array<unsigned int, SYNTHETIC_KINDS> mix = { 70, 10, 10, 10 };
+    unsigned long seed = 1;     // the seed of the random numbers
+};
+
+template <typename T>
+void append_synthetic(string &out, synthetic_kind kind, T low, T high,
+                      mt19937_64 &random);
+
+template <typename T>
+string synthetic_input(const benchmark_options &options, T low, T high);
+
+template <typename T, typename Read>
+void benchmark_reader(const string &name, const benchmark_options &options,
+                      T low, T high, Read read);
+
+void run_benchmarks(const benchmark_options &options);
+
+
+//////////////////////////////////////////////////////////////////////
+
+
+// prototypes for the regression suite, which checks that the engines
+// of this program make exactly the decisions of the original readers,
+// and that they are still as fast as they were when a baseline was
+// kept
+//
+// the original read_int(), read_float(), and read_element() are kept
+// here as reference oracles, extracting with >> from an istringstream
+// just as they did from cin; the only change made to them is the one
+// that the engines make on purpose, that a fractional number must
+// make up the whole of its token, and in strict mode, the rule that
+// the value must make up the whole of its record
+//
+// the same fuzzed records are given to each engine and to its oracle:
+// the parse_value() functions, the fused validators, and the
+// validators that apply a rule while parsing, for every data type and
+// in strict mode too; the batch mode on one thread (with its
+// whole-column and SIMD kernels) and on several threads stealing
+// chunks, in strict mode, with columnar output, through the outcome
+// cache, from gzip-compressed input, over an input of several blocks,
+// for records of several fields, and for rules with sets of allowed
+// values; and the interactive readers, whose whole sequence of values
+// is compared with the one the original loop would have returned
+
+// the settings of the regression mode, given on the command line
+struct regress_options {
+    size_t records = 200000;    // the records of each check
+    unsigned long seed = 1;     // the seed of the random numbers
+    const char *baseline = nullptr;     // the file of throughputs to
+                                        // compare with, if any
+    double tolerance = 20;      // how many percent below its baseline
+                                // a throughput may fall
+};
+
+// it appends one fuzzed record of fewer than 80 characters, with its
+// newline: about half of the records hold a single value, with
+// whitespace around it, most of them valid for some data type or at
+// or just past one of the bounds, as most real input does, and the
+// rest are made of pieces of numbers, words, and whitespace
+
+void append_fuzzed_record(string &out, mt19937_64 &random);
+
+// the oracles: oracle_accepts() tells whether the original readers
+// would have accepted the record from first up to last as a T, storing
+// the value they would have read, and whether they would have found
+// nothing but whitespace after it, as strict mode requires, if strict
+// is true; oracle_read() reads the next value from in just as the loop
+// of the original readers did, returning false where that loop would
+// have waited forever at the end of the input
+
+template <typename T>
+bool oracle_accepts(const char *first, const char *last, T &value,
+                    bool strict = false);
+
+template <typename T>
+bool oracle_read(istream &in, T &value);
+
+// an oracle for the records of one check of the batch mode, which
+// tells whether the record from first up to last should be accepted,
+// appending the value that should be written for it to out if so
+typedef function<bool(const char *, const char *, string &)>
+    record_oracle;
+
+// value_oracle() returns the oracle for values of T within the range
+// of low to high, which must also be one of members unless members is
+// empty, and rule_oracle() the one for the values that Rule accepts;
+// fields_oracle() returns the oracle for records whose fields,
+// separated by delimiter, are each accepted by their own oracle
+
+template <typename T>
+record_oracle value_oracle(T low, T high, bool strict,
+                           vector<T> members = {});
+
+template <auto Rule>
+record_oracle rule_oracle(bool strict);
+
+record_oracle fields_oracle(vector<record_oracle> fields, char delimiter);
+
+// it returns count records of as many fields as there are oracles in
+// fields, separated by delimiter, made of the fuzzed records in
+// records: each field is, three times in four, a record that the
+// oracle for it accepts, and otherwise any record, so that a good
+// share of the records are accepted as a whole
+
+string field_records(const string &records,
+                     const vector<record_oracle> &fields, char delimiter,
+                     size_t count, mt19937_64 &random);
+
+// how one check of the batch mode runs it
+struct batch_check {
+    unsigned int threads = 1;   // the number of validating threads
+    bool steal = false;         // whether idle threads steal chunks
+    bool strict = false;        // whether records must be one token
+    bool columnar = false;      // whether the values are collected in
+                                // columnar form instead of as text
+    bool cached = false;        // whether it runs twice through a new
+                                // outcome cache, to fill it and then
+                                // to find the records in it
+    bool gzip = false;          // whether the input is read compressed
+    size_t copies = 1;          // the number of times the records are
+                                // repeated to make up the input
+    const char *fields = nullptr;   // the schema, if type is record
+};
+
+// it writes data, gzip-compressed, to a temporary file that has
+// already been removed, and returns a descriptor that reads it from
+// the start, or -1 if it cannot
+
+int gzip_temporary(const string &data);
+
+// the checks, each of which writes a line of results to standard
+// output, with a few of the mismatches it found, and returns whether
+// there were none
+
+template <auto Rule>
+bool check_parsers(const string &name, const string &records,
+                   bool strict);
+
+bool check_string_parsers(const string &name, const string &records,
+                          bool strict);
+
+template <typename T>
+bool check_batch(const string &type, const string &records,
+                 const batch_check &how, const record_oracle &expect);
+
+template <typename T, typename Read>
+bool check_reader(const string &name, const string &records, Read read);
+
+template <typename Measure>
+uint64_t best_throughput(size_t records, Measure measure);
+
+bool check_throughput(const regress_options &options);
+
+bool run_regression(const regress_options &options);
+
+
+//////////////////////////////////////////////////////////////////////
+
+
+// prototypes for the coroutine-based readers, which validate the
+// records of many sockets and pipes at once on a single thread
+//
+// each stream is read by a coroutine of its own, which is suspended
+// whenever it has used up what its stream has sent so far, and is
+// resumed by the event loop once epoll says that more has arrived, so
+// thousands of slow producers need no thread each; the readers keep
+// the same repetition semantics as read_validated() and
+// read_validated_in_range(), with each stream having a buffer of
+// pending input of its own, and the retry messages going back to the
+// producer when the stream is a socket
+
+// a coroutine that produces a T, which does not start until it is
+// awaited, and resumes the coroutine that awaited it when it is done
+template <typename T>
+class task {
+public:
+    struct promise_type {
+        optional<T> value;
+        coroutine_handle<> continuation;
+
+        task get_return_object() {
+            return task(coroutine_handle<promise_type>::from_promise(*this));
+        }
+        suspend_always initial_suspend() noexcept { return {}; }
+        auto final_suspend() noexcept {
+            struct resume_continuation {
+                bool await_ready() noexcept { return false; }
+                coroutine_handle<> await_suspend(
+                    coroutine_handle<promise_type> done) noexcept {
+                    return done.promise().continuation;
+                }
+                void await_resume() noexcept {}
+            };
+            return resume_continuation{};
+        }
+        void return_value(T result) { value = move(result); }
+        void unhandled_exception() { terminate(); }
+    };
+
+    task(task &&other) : handle(exchange(other.handle, nullptr)) {}
+    ~task() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    bool await_ready() const { return false; }
+    coroutine_handle<> await_suspend(coroutine_handle<> caller) {
+        handle.promise().continuation = caller;
+        return handle;
+    }
+    T await_resume() { return move(*handle.promise().value); }
+
+private:
+    explicit task(coroutine_handle<promise_type> coroutine)
+        : handle(coroutine) {}
+
+    coroutine_handle<promise_type> handle;
+};
+
+// a coroutine that starts at once and that nothing awaits, which
+// frees itself when it is done
+struct detached {
+    struct promise_type {
+        detached get_return_object() { return {}; }
+        suspend_never initial_suspend() noexcept { return {}; }
+        suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { terminate(); }
+    };
+};
+
+// the event loop, which resumes each suspended coroutine once the file
+// descriptor it is waiting on can be read from, or once its deadline
+// has passed
+class event_loop {
+public:
+    using deadline = chrono::steady_clock::time_point;
+
+    event_loop();
+    ~event_loop();
+
+    // what a coroutine awaits to be suspended until fd can be read
+    // from, or until by at the latest; a file descriptor that epoll
+    // cannot watch, such as that of a regular file, can always be read
+    // from, so the coroutine is then not suspended at all. Awaiting it
+    // gives false if the deadline passed first, and true otherwise
+    struct readable {
+        event_loop &loop;
+        int fd;
+        deadline by;
+        coroutine_handle<> waiting = nullptr;
+        bool timed_out = false;
+        multimap<deadline, readable *>::iterator timer = {};
+
+        bool await_ready() const { return false; }
+        bool await_suspend(coroutine_handle<> waiting);
+        bool await_resume() const { return ! timed_out; }
+    };
+
+    readable wait_readable(int fd, deadline by = deadline::max()) {
+        return readable{ *this, fd, by };
+    }
+
+    // what a coroutine awaits to be suspended until by, whatever its
+    // file descriptors do; awaiting it gives false
+    readable wait_until(deadline by) {
+        return readable{ *this, -1, by };
+    }
+
+    // POST: the suspended coroutines have been resumed as their file
+    //       descriptors became readable, or their deadlines passed,
+    //       until none was left waiting
+    void run();
+
+    // the descriptor of the epoll instance, or -1 if it could not be
+    // made
+    int descriptor() const { return epoll_fd; }
+
+private:
+    int epoll_fd;
+    size_t waiting;     // the coroutines suspended in this loop
+    multimap<deadline, readable *> timers;  // those with a deadline,
+                                            // soonest first
+};
+
+// one socket or pipe being validated, with its own buffer of pending
+// input, which plays the part of cin's input buffer for that stream
+class async_stream {
+public:
+    // PRE:  fd is open, and set to non-blocking
+    //
+    // POST: the stream reads from fd, which it closes when it is
+    //       destroyed; replies are written back to fd if it is a
+    //       socket
+    async_stream(event_loop &loop, int fd, bool replies);
+    ~async_stream();
+
+    async_stream(const async_stream &) = delete;
+    async_stream &operator=(const async_stream &) = delete;
+
+    // POST: like start_record_budget(), the time allowed for reading
+    //       one value has been started afresh
+    void start_value();
+
+    // POST: like fill_pending_input(), the pending input has been made
+    //       to start with something other than whitespace, taking
+    //       further records from the stream, and waiting for them to
+    //       arrive, if needed, and true has been returned; or the
+    //       stream has ended, or used up its budget, and false has
+    //       been returned
+    task<bool> fill();
+
+    // POST: like discard_pending_input(), the rest of the current
+    //       record has been discarded
+    void discard();
+
+    // POST: if the stream takes replies, message has been written back
+    //       to it, or as much of it as the socket would take without
+    //       blocking
+    void reply(const string &message);
+
+    // PRE:  first and last delimit the rejected characters, which lie
+    //       within the pending input
+    //
+    // POST: like log_pending_rejection(), the rejected characters have
+    //       been logged, if rejections are being logged, with their
+    //       offset and line number in the stream
+    void log_rejection(validation_outcome reason, const char *first,
+                       const char *last);
+
+    // POST: an invalid input has been counted against the budget, as
+    //       one more of the retries of the value being read, which are
+    //       counted in record_retries; true has been returned if the
+    //       reader may ask again, and false if a retry limit has been
+    //       reached
+    //
+    // every limit of the budget applies to each stream on its own
+    bool charge_retry(unsigned long &record_retries);
+
+    // POST: once fill() has returned false, the reason has been
+    //       returned: READ_END_OF_INPUT, or the limit that was reached
+    read_status end_reason() const { return reason; }
+
+    // the pending input, which the readers use up from the front
+    const char *pending_first() const { return buffer.data() + first; }
+    const char *pending_last() const { return buffer.data() + last; }
+    void use_up_to(const char *end) { first = end - buffer.data(); }
+
+private:
+    event_loop &loop;
+    int fd;
+    bool replies;
+    string buffer;          // what has arrived and not yet been used
+    size_t first = 0;       // the pending input, within buffer
+    size_t last = 0;
+    size_t record = 0;      // the start of the current record
+    bool in_record = false;
+    bool ended = false;     // nothing more will arrive
+    uint64_t buffer_offset = 0;     // the offset of buffer in the stream
+    uint64_t line = 0;      // the line number of the current record
+    uint64_t received = 0;  // the characters that have arrived
+    unsigned long retries = 0;      // the invalid inputs rejected
+    read_status reason = READ_OK;   // why the stream ended
+    event_loop::deadline opened;    // when the stream was opened
+    event_loop::deadline value_deadline = event_loop::deadline::max();
+};
+
+template <typename T>
+task<optional<T>> async_read_validated(async_stream &stream,
+                                       const string &kind);
+
+template <typename T>
+task<optional<T>> async_read_validated_in_range(async_stream &stream,
+                                                T low, T high,
+                                                const string &kind);
+
+template <typename T>
+detached serve_stream(event_loop &loop, int fd, bool replies,
+                      unsigned long id, T low, T high, string kind,
+                      unsigned long &given_up);
+
+// how long a listener is left alone after a connection could not be
+// accepted for want of a file descriptor or memory, before accepting
+// is tried again
+const chrono::milliseconds ACCEPT_RETRY_DELAY(100);
+
+template <typename T>
+detached accept_streams(event_loop &loop, int listener,
+                        unsigned long &next_id, T low, T high, string kind,
+                        unsigned long &given_up);
+
+template <typename T>
+bool serve_as(const vector<string> &addresses, T low, T high,
+              const string &kind);
+
+bool serve(const string &type, const vector<string> &addresses);
+
+
+//////////////////////////////////////////////////////////////////////
+
+
+int main(int argc, char *argv[]) {
+
+    rejection_log reject_log;   // where rejected records are logged,
+                                // if anywhere
+    const char *reject_path = nullptr;
+    bool quiet = false;
+    bool batch = (argc >= 3) && (string(argv[1]) == "--batch");
+    bool benchmark = (argc >= 2) && (string(argv[1]) == "--benchmark");
+    bool regress = (argc >= 2) && (string(argv[1]) == "--regress");
+    bool serving = (argc >= 4) && (string(argv[1]) == "--serve");
+    vector<string> addresses;   // what serve mode reads from
+    batch_options options;
+    benchmark_options benchmark_settings;
+    regress_options regress_settings;
+    const char *path = nullptr;
+    column_writer columns;      // where the accepted values are
+                                // written in columnar form, if anywhere
+    const char *columnar_path = nullptr;
+    const char *rules_path = nullptr;
+    const char *fields_spec = nullptr;
+    const char *metrics_path = nullptr;
+    bool metrics_json = false;
+    validation_cache cache;     // the outcomes of earlier runs, if kept
+    const char *cache_path = nullptr;
+    bool gzip_input = false;    // whether standard input is compressed
+    bool pin_threads = false;   // whether to pin the batch threads
+    numa_topology topology;     // the nodes to pin them to, if given
+
+    // collect the options, which in batch and serve modes follow the
+    // data type
+    for (int i = (batch || serving) ? 3 : ((benchmark || regress) ? 2 : 1);
+         i < argc; ++i) {
+        string option = argv[i];
+
+        if ((option == "--reject-log") && (i + 1 < argc)) {
+            reject_path = argv[++i];
+        } else if ((option == "--rules") && (i + 1 < argc)) {
+            rules_path = argv[++i];
+        } else if ((option == "--metrics") && (i + 1 < argc)) {
+            metrics_path = argv[++i];
+            timing_parses = true;
+        } else if ((option == "--metrics-format") && (i + 1 < argc)) {
+            string format = argv[++i];
+            if ((format != "json") && (format != "prometheus")) {
+                cerr << "Invalid metrics format " << format
+                     << ", should be json or prometheus" << endl;
+                return 1;
+            }
+            metrics_json = (format == "json");
+        } else if (option == "--strict") {
+            strict_tokens = true;
+        } else if (((option == "--record-retries")
+                    || (option == "--record-bytes")
+                    || (option == "--record-time")
+                    || (option == "--stream-retries")
+                    || (option == "--stream-bytes")
+                    || (option == "--stream-time"))
+                   && (i + 1 < argc)) {
+            bool timed = option.ends_with("-time");
+            bool retries = option.ends_with("-retries");
+            uint64_t most = timed ? MAX_BUDGET_MILLISECONDS
+                                  : (retries ? ULONG_MAX : UINT64_MAX);
+            uint64_t limit;
+            if (! parse_count(argv[++i], most, limit)) {
+                cerr << "Invalid " << option << " " << argv[i]
+                     << ", should be 0 (no limit) to " << most
+                     << (timed ? " milliseconds" : "") << endl;
+                return 1;
+            }
+            if (option == "--record-retries") {
+                budget.record_retries = limit;
+            } else if (option == "--record-bytes") {
+                budget.record_bytes = limit;
+            } else if (option == "--record-time") {
+                budget.record_time = chrono::milliseconds(limit);
+            } else if (option == "--stream-retries") {
+                budget.stream_retries = limit;
+            } else if (option == "--stream-bytes") {
+                budget.stream_bytes = limit;
+            } else {
+                budget.stream_time = chrono::milliseconds(limit);
+            }
+        } else if (serving && ((option[0] != '-') || (option == "-"))) {
+            addresses.push_back(option);
+        } else if (serving) {
+            cerr << "Unknown serve option " << option << endl;
+            return 1;
+        } else if (! batch && ! benchmark && ! regress
+                   && (option == "--quiet")) {
+            quiet = true;
+        } else if (regress && ((option == "--records")
+                               || (option == "--seed"))
+                   && (i + 1 < argc)) {
+            uint64_t count;
+            if (! parse_count(argv[++i], ULONG_MAX, count)
+                || ((option == "--records") && (count == 0))) {
+                cerr << "Invalid " << option << " " << argv[i]
+                     << ", should be " << ((option == "--seed") ? 0 : 1)
+                     << " to " << ULONG_MAX << endl;
+                return 1;
+            }
+            if (option == "--records") {
+                regress_settings.records = count;
+            } else {
+                regress_settings.seed = count;
+            }
+        } else if (regress && (option == "--baseline") && (i + 1 < argc)) {
+            regress_settings.baseline = argv[++i];
+        } else if (regress && (option == "--tolerance") && (i + 1 < argc)) {
+            const char *text = argv[++i];
+            char *end;
+            errno = 0;
+            double tolerance = strtod(text, &end);
+            if ((*text < '0') || (*text > '9') || (*end != '\0')
+                || (errno != 0) || ! (tolerance <= 100)) {
+                cerr << "Invalid tolerance " << text
+                     << ", should be a percentage from 0 to 100" << endl;
+                return 1;
+            }
+            regress_settings.tolerance = tolerance;
+        } else if (benchmark && ((option == "--records")
+                                 || (option == "--seed"))
+                   && (i + 1 < argc)) {
+            uint64_t count;
+            if (! parse_count(argv[++i], ULONG_MAX, count)
+                || ((option == "--records") && (count == 0))) {
+                cerr << "Invalid " << option << " " << argv[i]
+                     << ", should be " << ((option == "--seed") ? 0 : 1)
+                     << " to " << ULONG_MAX << endl;
+                return 1;
+            }
+            if (option == "--records") {
+                benchmark_settings.records = count;
+            } else {
+                benchmark_settings.seed = count;
+            }
+        } else if (benchmark && (option == "--mix") && (i + 1 < argc)) {
+            array<unsigned int, SYNTHETIC_KINDS> &mix = benchmark_settings.mix;
+            unsigned int total = 0;
+            int parts = sscanf(argv[++i], "%u,%u,%u,%u", &mix[0], &mix[1],
+                               &mix[2], &mix[3]);
+            for (unsigned int share : mix) {
+                total += share;
+            }
+            if ((parts != SYNTHETIC_KINDS) || (total == 0)) {
+                cerr << "Invalid mix " << argv[i] << ", should be"
+                     << " VALID,WRONG_TYPE,OUT_OF_RANGE,OVERLONG" << endl;
+                return 1;
+            }
+        } else if (batch && (option == "--threads") && (i + 1 < argc)) {
+            if (! parse_thread_count(argv[++i], options.threads)) {
+                cerr << "Invalid thread count " << argv[i] << ", should be"
+                     << " 0 (one per processor) to " << MAX_THREADS << endl;
+                return 1;
+            }
+        } else if (batch && (option == "--steal")) {
+            options.steal = true;
+        } else if (batch && (option == "--pin")) {
+            pin_threads = true;
+        } else if (batch && (option == "--topology") && (i + 1 < argc)) {
+            if (! parse_topology(argv[++i], topology)) {
+                cerr << "Invalid topology " << argv[i] << ", should be"
+                     << " a list of processors such as 0-3,8-11 for each"
+                     << " node, separated by /" << endl;
+                return 1;
+            }
+            pin_threads = true;
+        } else if (batch && (option == "--columnar") && (i + 1 < argc)) {
+            columnar_path = argv[++i];
+        } else if (batch && (option == "--gzip")) {
+            gzip_input = true;
+        } else if (batch && (option == "--cache") && (i + 1 < argc)) {
+            cache_path = argv[++i];
+        } else if (batch && (option == "--fields") && (i + 1 < argc)) {
+            fields_spec = argv[++i];
+        } else if (batch && (option == "--delimiter") && (i + 1 < argc)) {
+            string delimiter = argv[++i];
+            if (delimiter == "tab") {
+                delimiter = '\t';
+            }
+            if ((delimiter.size() != 1) || (delimiter[0] == '\n')) {
+                cerr << "Invalid delimiter " << argv[i]
+                     << ", should be one character or tab" << endl;
+                return 1;
+            }
+            options.delimiter = delimiter[0];
+        } else if (batch && (option[0] != '-') && (path == nullptr)) {
+            path = argv[i];
+        } else if (batch) {
+            cerr << "Unknown batch option " << option << endl;
+            return 1;
+        } else {
+            cerr << "Usage: " << argv[0]
+                 << " [--quiet] [--strict] [--reject-log LOG] [--rules RULES]"
+                 << " [--metrics OUT [--metrics-format F]]" << endl
+                 << "       " << argv[0]
+                 << " --benchmark [--records N] [--mix V,T,R,L]"
+                 << " [--seed S] [--rules RULES] [--strict]" << endl
+                 << "       " << argv[0]
+                 << " --regress [--records N] [--seed S]"
+                 << " [--baseline FILE] [--tolerance PCT]" << endl
+                 << "       " << argv[0]
+                 << " --batch TYPE [--threads N] [--steal] [--pin]"
+                 << " [--topology SPEC]"
+                 << " [--reject-log LOG] [--columnar OUT]" << endl
+                 << "           [--rules RULES] [--strict] [--cache CACHE]"
+                 << " [--gzip]"
+                 << " [--fields SPEC [--delimiter C]] [FILE]" << endl
+                 << "       " << argv[0]
+                 << " --serve TYPE [--strict] [--reject-log LOG]"
+                 << " [--rules RULES]"
+                 << " ADDRESS..." << endl
+                 << "budget options, for the interactive and serve modes:"
+                 << endl
+                 << "       [--record-retries N] [--record-bytes N]"
+                 << " [--record-time MS]" << endl
+                 << "       [--stream-retries N] [--stream-bytes N]"
+                 << " [--stream-time MS]" << endl;
+            return 1;
+        }
+    }
+
+    // load the rules file, if there is one, before anything that may
+    // name the rules in it
+    if (rules_path != nullptr) {
+        string error;
+        if (! load_rules(rules_path, error)) {
+            cerr << "Cannot load rules from " << error << endl;
+            return 1;
+        }
+    }
+    if ((fields_spec != nullptr)
+        && ! parse_schema(fields_spec, options.fields)) {
+        cerr << "Invalid fields " << fields_spec
+             << ", should be a comma-separated list of "
+             << "rule names, TYPE, or TYPE:LOW:HIGH" << endl;
+        return 1;
+    }
+
+    // log the rejected records as newline-delimited JSON, if asked to
+    if (reject_path != nullptr) {
+        if (! reject_log.open(reject_path)) {
+            cerr << "Cannot write " << reject_path << ": "
+                 << strerror(errno) << endl;
+            return 1;
+        }
+        rejections = &reject_log;
+    }
+
+    // the batch mode takes these settings with the rest of its options,
+    // and the interactive and serve modes from the globals set above
+    options.strict = strict_tokens;
+    options.rejections = rejections;
+
+    // if the program was started as "main --regress [OPTIONS]", check
+    // the engines against the original readers instead, which only
+    // know the built-in rules
+    if (regress) {
+        if ((rules_path != nullptr) || strict_tokens) {
+            cerr << "The regression suite compares the engines with the"
+                 << " original readers, so it cannot be given --rules or"
+                 << " --strict" << endl;
+            return 1;
+        }
+        bool passed = run_regression(regress_settings);
+        return (export_counters(metrics_path, metrics_json) && passed) ? 0
+                                                                       : 1;
+    }
+
+    // if the program was started as "main --benchmark [OPTIONS]",
+    // measure how fast the readers are instead of demonstrating them
+    if (benchmark) {
+        run_benchmarks(benchmark_settings);
+        return export_counters(metrics_path, metrics_json) ? 0 : 1;
+    }
+
+    // if the program was started as "main --serve TYPE [OPTIONS]
+    // ADDRESS...", validate many sockets and pipes at once, each one
+    // read by a coroutine of its own on this one thread
+    if (serving) {
+        if (addresses.empty()) {
+            cerr << "Serve mode needs a port, a pipe, or - to read from"
+                 << endl;
+            return 1;
+        }
+        if (! serve(argv[2], addresses)) {
+            return 1;
+        }
+        return export_counters(metrics_path, metrics_json) ? 0 : 1;
+    }
+
+    // if the program was started as "main --batch TYPE [OPTIONS]
+    // [FILE]", validate the whole of FILE, or of standard input if no
+    // FILE is given, without any interactive prompts
+    if (batch) {
+
+        stdin_source standard_input;
+        mapped_file_source file;
+        gzip_source compressed;
+        input_source *source = &standard_input;
+
+        // pin the validating threads to the processors of the machine,
+        // or of the topology given, spread evenly over its nodes; each
+        // must be one this program is allowed to run on
+        if (pin_threads) {
+            cpu_set_t allowed;
+            if (topology.nodes.empty()) {
+                read_system_topology(topology);
+            }
+            options.cpus = place_threads(topology, options.threads);
+            if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+                CPU_ZERO(&allowed);
+            }
+            for (unsigned int cpu : options.cpus) {
+                if (! CPU_ISSET(cpu, &allowed)) {
+                    cerr << "Cannot pin a thread to processor " << cpu
+                         << ", which this program may not run on" << endl;
+                    return 1;
+                }
+            }
+        }
+
+        // a compressed FILE is recognised by its magic number, and is
+        // decompressed as it is validated; compressed standard input
+        // has to be asked for with --gzip
+        if (path != nullptr) {
+            int fd = open(path, O_RDONLY | O_CLOEXEC);
+            unsigned char magic[4];
+            ssize_t count = (fd < 0) ? -1 : pread(fd, magic, sizeof(magic), 0);
+            if (count < 0) {
+                cerr << "Cannot read " << path << ": "
+                     << strerror(errno) << endl;
+                if (fd >= 0) {
+                    close(fd);
+                }
+                return 1;
+            }
+
+            compression_kind kind = compression_of(magic, count);
+            if (kind == COMPRESSION_ZSTD) {
+                cerr << "Cannot read " << path << ": zstd compression "
+                     << "is not supported, only gzip" << endl;
+                close(fd);
+                return 1;
+            }
+            if (kind == COMPRESSION_GZIP) {
+                compressed.open(fd);
+                source = &compressed;
+            } else {
+                close(fd);
+                if (! file.open(path)) {
+                    cerr << "Cannot read " << path << ": "
+                         << strerror(errno) << endl;
+                    return 1;
+                }
+                source = &file;
+            }
+        } else if (gzip_input) {
+            compressed.open(STDIN_FILENO);
+            source = &compressed;
+        }
+
+        // look the records up in the outcome cache, if asked to, which
+        // is made with room for every record of FILE if it is new
+        if (cache_path != nullptr) {
+            if (! cache.open(cache_path, (path != nullptr) ? file.records()
+                                                           : 0)) {
+                cerr << "Cannot use cache " << cache_path << ": "
+                     << strerror(errno) << endl;
+                return 1;
+            }
+            options.cache = &cache;
+        }
+
+        // write the values in columnar form instead of as text, if
+        // asked to
+        if (columnar_path != nullptr) {
+            const loaded_rule *loaded = find_loaded_rule(argv[2]);
+            column_type type = column_type_named(
+                (loaded != nullptr) ? loaded->field.type : argv[2]);
+            if (type == COLUMN_NONE) {
+                cerr << "Columnar output needs a batch type of int, "
+                     << "long, float, or double" << endl;
+                return 1;
+            }
+            if (! columns.open(columnar_path, type)) {
+                cerr << "Cannot write " << columnar_path << ": "
+                     << strerror(errno) << endl;
+                return 1;
+            }
+            options.columns = &columns;
+        }
+
+        bool known;
+        try {
+            known = batch_validate(argv[2], *source, options);
+        } catch (const system_error &error) {
+            cerr << "Cannot start " << options.threads << " threads: "
+                 << error.what() << endl;
+            return 1;
+        }
+        if (! known) {
+            cerr << "Unknown batch type " << argv[2]
+                 << ", should be int, long, float, double, char, "
+                 << "bool, string, element, or record (with --fields)"
+                 << endl;
+            return 1;
+        }
+        if ((source == &compressed) && compressed.failed()) {
+            cerr << "Cannot decompress "
+                 << ((path != nullptr) ? path : "standard input")
+                 << ": the data is corrupt or cut short" << endl;
+            return 1;
+        }
+        if ((source == &compressed) && compressed.ignored_trailing()) {
+            cerr << "Decompressed "
+                 << ((path != nullptr) ? path : "standard input")
+                 << ": the bytes after the last gzip member were ignored"
+                 << endl;
+        }
+        if ((options.columns != nullptr) && ! columns.close()) {
+            cerr << "Cannot write " << columnar_path << ": "
+                 << strerror(errno) << endl;
+            return 1;
+        }
+        if (options.cache != nullptr) {
+            cerr << "Cache hits " << cache.hits() << ", misses "
+                 << cache.misses() << endl;
+        }
+        return export_counters(metrics_path, metrics_json) ? 0 : 1;
+    }
+
+    // buffer the output if no one is watching it, and drop the prompts
+    // if asked to
+    configure_output(quiet);
 
     // tell the user how to use this program
     instruct();
 
     // demonstrate repetition type-checking data validation for
-    // ints, floats, and elements
-    demo_int_type_checking();
-    demo_float_type_checking();
-    demo_element_type_checking();
+    // ints, floats, and elements, and then combined repetition
+    // type-checking and repetition range-checking data validation for
+    // ints, floats, and elements, stopping as soon as a reader gives up
+    void (*const demos[])() = {
+        demo_int_type_checking,
+        demo_float_type_checking,
+        demo_element_type_checking,
+        demo_int_type_and_range_checking,
+        demo_float_type_and_range_checking,
+        demo_element_type_and_range_checking
+    };
+    for (void (*demo)() : demos) {
+        if (reader_status == READ_OK) {
+            demo();
+        }
+    }
+
+    // write out whatever output is still buffered, and the counters if
+    // asked to
+    cout.flush();
+    bool exported = export_counters(metrics_path, metrics_json);
+    if (reader_status != READ_OK) {
+        cerr << "Gave up waiting for a valid value: "
+             << describe_status(reader_status) << endl;
+        return 1;
+    }
+    return exported ? 0 : 1;
+}
+
+
+stdin_source standard_input;
+input_source *reader_source = &standard_input;
+
+bool interactive = true;
+
+ostream prompts(cout.rdbuf());
+
+void configure_output(bool quiet) {
+
+    // PRE:  nothing has been written to cout yet
+    //
+    // POST: interactive tells whether standard input and output are
+    //       both terminals; if not, cout has been given its own large
+    //       buffer, independent of C stdio; prompts writes to cout
+    //       unless quiet, in which case it discards everything
+
+    interactive = isatty(STDIN_FILENO) && isatty(STDOUT_FILENO);
+    if (! interactive) {
+        ios::sync_with_stdio(false);
+    }
 
-    // demonstrate combined repetition type-checking and
-    // repetition range-checking data validation for ints, floats,
-    // and elements
-    demo_int_type_and_range_checking();
-    demo_float_type_and_range_checking();
-    demo_element_type_and_range_checking();
+    // a stream with no buffer at all drops whatever it is given
+    prompts.rdbuf(quiet ? nullptr : cout.rdbuf());
 }
 
 
 //////////////////////////////////////////////////////////////////////
 
-int read_int() {
 
-    // PRE:  the user must enter a series of zero or more
-    //       non-valid int values, followed by a valid int value
-    //
-    // POST: all entered non-valid int values will be successfully
-    //       discarded, and the first valid int value entered will
-    //       be returned
+rejection_log *rejections = nullptr;
+//////////////////////////////////////////////////////////////////////
 
-    int userval;    // used to collect the user's input value
 
-    // attempt to get an input value whose data type is an int
-    cin >> userval;
+// the characters of the current record that have not yet been used by
+// one of the readers
+const char *pending_first = nullptr;
+const char *pending_last = nullptr;
 
-    // repeat the following as long as this attempt failed,
-    // presumably because the data type of the user's input was
-    // not an int
-    while (! cin.good()) {
+// where the current record starts, both in memory and in the input as a
+// whole, and its line number, so that rejected values can be logged
+// with their positions
+const char *pending_record = nullptr;
+uint64_t pending_record_offset = 0;
+uint64_t pending_line = 0;
+uint64_t next_record_offset = 0;
 
-        // re-enable the just-disabled cin object
-        cin.clear();
+// the budget, and how much of it the readers have used
+read_budget budget;
+read_status reader_status = READ_OK;
 
-        // from the input buffer, discard up to 80 keystrokes
-        // or until the enter key is seen, whichever comes
-        // first
-        cin.ignore(80, '\n');
+bool stream_started = false;
+chrono::steady_clock::time_point stream_start;
+uint64_t stream_bytes_used = 0;
+unsigned long stream_retries_used = 0;
+uint64_t record_bytes_used = 0;
+unsigned long record_retries_used = 0;
+chrono::steady_clock::time_point record_deadline =
+    chrono::steady_clock::time_point::max();
 
-        // tell the user what happened, and to try again
-        cout << "Invalid data type, should be a whole "
-             << "number, try again: ";
+const char *describe_status(read_status status) {
 
-        // attempt to get an input value whose data type is an
-        // int
-        cin >> userval;
+    // PRE:  none
+    //
+    // POST: see the prototype
+
+    switch (status) {
+    case READ_OK:
+        return "a valid value was read";
+    case READ_END_OF_INPUT:
+        return "the input ended";
+    case READ_RETRY_LIMIT:
+        return "too many invalid inputs";
+    case READ_BYTE_LIMIT:
+        return "too much input";
+    case READ_TIME_LIMIT:
+        return "the time ran out";
     }
+    return "an unknown problem";
+}
 
-    // return the valid int value given by the user
-    return userval;
+bool parse_count(const char *text, uint64_t most, uint64_t &count) {
+
+    // PRE:  none
+    //
+    // POST: see the prototype
+
+    char *end;
+    errno = 0;
+    unsigned long long number = strtoull(text, &end, 10);
+
+    // strtoull() itself would accept leading whitespace and a sign, and
+    // turn "-5" into a huge number rather than refuse it
+    if ((*text < '0') || (*text > '9') || (*end != '\0') || (errno != 0)
+        || (number > most)) {
+        return false;
+    }
+    count = number;
+    return true;
 }
 
-float read_float() {
+bool within_limit(uint64_t used, uint64_t limit) {
 
-    // PRE:  the user must enter a series of zero or more
-    //       non-valid float values, followed by a valid float
-    //       value
+    // PRE:  none
     //
-    // POST: all entered non-valid float values will be
-    //       successfully discarded, and the first valid float
-    //       value entered will be returned
+    // POST: true has been returned if used does not exceed limit, or if
+    //       limit is 0, meaning no limit
 
-    float userval;  // used to collect the user's input value
+    return (limit == 0) || (used <= limit);
+}
 
-    // attempt to get an input value whose data type is a float
-    cin >> userval;
+bool start_record_budget() {
 
-    // repeat the following as long as this attempt failed,
-    // presumably because the data type of the user's input was
-    // not a float
-    while (! cin.good()) {
+    // PRE:  none
+    //
+    // POST: the budget for getting one value has been started afresh,
+    //       and the limits of reader_source set to match, and true has
+    //       been returned, unless the budget of the stream is already
+    //       used up, in which case reader_status says so and false has
+    //       been returned
+
+    reader_status = READ_OK;
+    record_bytes_used = 0;
+    record_retries_used = 0;
+    record_deadline = chrono::steady_clock::time_point::max();
+
+    // the clock is only read if there is a time limit
+    if ((budget.record_time.count() != 0)
+        || (budget.stream_time.count() != 0)) {
+        auto now = chrono::steady_clock::now();
+        if (! stream_started) {
+            stream_started = true;
+            stream_start = now;
+        }
+        if (budget.stream_time.count() != 0) {
+            record_deadline = stream_start + budget.stream_time;
+        }
+        if (budget.record_time.count() != 0) {
+            record_deadline = min(record_deadline, now + budget.record_time);
+        }
+        if (now >= record_deadline) {
+            reader_status = READ_TIME_LIMIT;
+            return false;
+        }
+    }
+    if ((budget.stream_bytes != 0)
+        && (stream_bytes_used >= budget.stream_bytes)) {
+        reader_status = READ_BYTE_LIMIT;
+        return false;
+    }
 
-        // re-enable the just-disabled cin object
-        cin.clear();
+    // the source may read at most what is left of both byte budgets
+    // into one record
+    uint64_t max_bytes = budget.record_bytes;
+    if (budget.stream_bytes != 0) {
+        uint64_t left = budget.stream_bytes - stream_bytes_used;
+        max_bytes = (max_bytes == 0) ? left : min(max_bytes, left);
+    }
+    reader_source->set_limits(max_bytes, record_deadline);
+    return true;
+}
 
-        // from the input buffer, discard up to 80 keystrokes
-        // or until the enter key is seen, whichever comes // first
-        cin.ignore(80, '\n');
+bool charge_retry() {
 
-        // tell the user what happened, and to try again
-        cout << "Invalid data type, should be a fractional "
-             << "number, try again: ";
+    // PRE:  an invalid input has just been rejected
+    //
+    // POST: the retry has been counted against the budget, and true
+    //       has been returned if the reader may ask again; otherwise
+    //       reader_status says which limit was reached and false has
+    //       been returned
+
+    ++record_retries_used;
+    ++stream_retries_used;
+    if (! within_limit(record_retries_used, budget.record_retries)
+        || ! within_limit(stream_retries_used, budget.stream_retries)) {
+        reader_status = READ_RETRY_LIMIT;
+        return false;
+    }
+    if ((record_deadline != chrono::steady_clock::time_point::max())
+        && (chrono::steady_clock::now() >= record_deadline)) {
+        reader_status = READ_TIME_LIMIT;
+        return false;
+    }
+    return true;
+}
+
+bool fill_pending_input() {
 
-        // attempt to get an input value whose data type is a
-        // float
-        cin >> userval;
+    // PRE:  none
+    //
+    // POST: if the pending input holds a non-whitespace character,
+    //       reading whole records from reader_source as needed, true
+    //       has been returned; at the end of the input, false has
+    //       been returned
+
+    while (skip_whitespace(pending_first, pending_last) == pending_last) {
+
+        // make sure the user has seen the latest prompt before
+        // waiting for them to type, as cin would have done; when no
+        // one is watching, the output is left to build up instead
+        if (interactive) {
+            cout.flush();
+        }
+
+        // everything pending is whitespace, so replace it with the
+        // next line the user enters
+        if (! reader_source->next_record(pending_first, pending_last)) {
+            pending_first = nullptr;
+            pending_last = nullptr;
+            reader_status = reader_source->end_reason();
+            return false;
+        }
+
+        // keep track of where the record is, counting its newline too
+        pending_record = pending_first;
+        pending_record_offset = next_record_offset;
+        next_record_offset += (pending_last - pending_first) + 1;
+        ++pending_line;
+
+        // count the record against the byte budgets
+        uint64_t bytes = (pending_last - pending_first) + 1;
+        record_bytes_used += bytes;
+        stream_bytes_used += bytes;
+        if (! within_limit(record_bytes_used, budget.record_bytes)
+            || ! within_limit(stream_bytes_used, budget.stream_bytes)) {
+            pending_first = nullptr;
+            pending_last = nullptr;
+            reader_status = READ_BYTE_LIMIT;
+            return false;
+        }
     }
+    return true;
+}
 
-    // return the valid float value given by the user
-    return userval;
+void discard_pending_input() {
+
+    // PRE:  none
+    //
+    // POST: the rest of the current record has been discarded, so
+    //       that the next attempt to get an input value starts at the
+    //       beginning of the next line, however long this one was
+    //
+    // this takes the place of cin.ignore(80, '\n'), which fails to
+    // reach the end of a line of more than 80 keystrokes
+
+    if (pending_first != nullptr) {
+        add_count(thread_counters().bytes_skipped,
+                  pending_last - pending_first);
+    }
+    pending_first = pending_last;
 }
 
-element read_element() {
+void reset_pending_input() {
 
-    // PRE:  the user must enter a series of zero or more
-    //       non-valid element values, followed by a valid element
-    //       value
+    // PRE:  none
     //
-    // POST: all entered non-valid element values will be
-    //       successfully discarded, and the first valid element
-    //       value entered will be returned
+    // POST: there is no pending input, and the next record will be
+    //       counted as the first of reader_source
+
+    pending_first = nullptr;
+    pending_last = nullptr;
+    pending_record = nullptr;
+    pending_record_offset = 0;
+    pending_line = 0;
+    next_record_offset = 0;
+    stream_started = false;
+    stream_bytes_used = 0;
+    stream_retries_used = 0;
+}
 
-    element userval;        // used to collect the user's input
-    // value
+void log_pending_rejection(validation_outcome reason, const char *first,
+                           const char *last) {
 
-    // attempt to get an input value whose data type is an element
+    // PRE:  first and last delimit the rejected characters, which lie
+    //       within the current record
     //
-    // the boolalpha manipulator is used in case elements are
-    // bools, to allow for inputs using the keystroke sequences of
-    // "true" and "false" instead of "1" and "0"
-    cin >> boolalpha >> userval;
+    // POST: if rejections are being logged, the rejected characters
+    //       have been logged, without any leading whitespace, along
+    //       with their offset and line number in the input
+
+    if (rejections == nullptr) {
+        return;
+    }
+    first = skip_whitespace(first, last);
+    rejections->record(pending_record_offset + (first - pending_record),
+                       pending_line, reason, first, last);
+}
+
+template <typename T>
+bool read_value(T &userval) {
+
+    // PRE:  none
+    //
+    // POST: if a value whose data type is a T was the next input,
+    //       it has been stored in userval, the characters used have
+    //       been removed from the pending input, and true has been
+    //       returned; otherwise false has been returned and the
+    //       pending input is unchanged
+
+    if (! fill_pending_input()) {
+        return false;
+    }
+
+    parse_timer timer;
+    const char *end = parse_value(pending_first, pending_last, userval);
+
+    if (end == nullptr) {
+        return false;
+    }
+    pending_first = end;
+    return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+
+template <typename T>
+validation_outcome read_value_in_range(T &userval, T low, T high,
+                                       const allowed_set<T> *allowed) {
+
+    // PRE:  none
+    //
+    // POST: if the next input was a T value, it has been stored in
+    //       userval, the characters used have been removed from the
+    //       pending input, and VALID or INVALID_RANGE has been
+    //       returned, depending on whether it is within the range of
+    //       low to high (and, if allowed is given, one of its
+    //       members), with a value out of range having been logged if
+    //       rejections are being logged; otherwise INVALID_TYPE has
+    //       been returned and the pending input is unchanged
+
+    if (! fill_pending_input()) {
+        return INVALID_TYPE;
+    }
+
+    parse_timer timer;
+    const char *end = nullptr;
+    validation_outcome outcome = validate_value(pending_first, pending_last,
+                                                low, high, userval, end);
+    if constexpr (has_allowed_sets<T>) {
+        if ((outcome == VALID) && (allowed != nullptr)
+            && ! allowed->contains(userval)) {
+            outcome = INVALID_RANGE;
+        }
+    }
+    if (outcome == INVALID_RANGE) {
+        log_pending_rejection(INVALID_RANGE, pending_first, end);
+    }
+    if (outcome != INVALID_TYPE) {
+        pending_first = end;
+    }
+    return outcome;
+}
+
+template <typename T>
+T read_validated(const string &kind) {
 
-    // repeat the following as long as this attempt failed,
-    // presumably because the data type of the user's input was
-    // not an element
-    while (! cin.good()) {
+    // PRE:  the user must enter a series of zero or more
+    //       non-valid T values, followed by a valid T value
+    //
+    // POST: all entered non-valid T values will be successfully
+    //       discarded, and the first valid T value entered will
+    //       be returned
 
-        // re-enable the just-disabled cin object
-        cin.clear();
+    T userval;      // used to collect the user's input value
 
-        // from the input buffer, discard up to 80 keystrokes
-        // or until the enter key is seen, whichever comes
-        // first
-        cin.ignore(80, '\n');
+    // repeat the following as long as the attempt to get an input
+    // value whose data type is a T failed, presumably because the
+    // data type of the user's input was not a T
+    //
+    // if T is bool, the inputs use the keystroke sequences of "true"
+    // and "false" instead of "1" and "0", just as they would with
+    // cin's boolalpha manipulator
+    //
+    // the reader gives up, returning T(), at the end of the input or
+    // once its budget is used up, with reader_status saying why
+    if (! start_record_budget()) {
+        return T();
+    }
+    while (! read_value(userval)) {
+        if (reader_status != READ_OK) {
+            return T();
+        }
+
+        // log the rejected input, if asked to, and then, from the
+        // input buffer, discard everything up to and including the
+        // enter key
+        if (pending_first != nullptr) {
+            log_pending_rejection(INVALID_TYPE, pending_first, pending_last);
+        }
+        add_count(thread_counters().type_rejections, 1);
+        discard_pending_input();
+        if (! charge_retry()) {
+            return T();
+        }
 
         // tell the user what happened, and to try again
-        cout << "Invalid data type, should be an element ("
-             << ELEMENT_NAME
-                << "), try again: ";
+        prompts << "Invalid data type, should be " << kind
+                << ", try again: ";
+    }
+
+    // return the valid T value given by the user
+    add_count(thread_counters().accepted, 1);
+    return userval;
+}
 
-        // attempt to get an input value whose data type is
-        // an element
-        //
-        // the boolalpha manipulator is used in case elements
-        // are bools, to allow for inputs using the keystroke
-        // sequences of "true" and "false" instead of "1" and
-        // "0"
-        cin >> boolalpha >> userval;
+template <typename T>
+T read_validated_in_range(T low, T high, const string &kind,
+                          const allowed_set<T> *allowed) {
+
+    // PRE:  the user must enter a series of zero or more values
+    //       that either are not T values, or are T values but are
+    //       not within the range of low to high, followed by a value
+    //       that is both a T value and within the range of low to
+    //       high
+    //
+    // POST: all entered values that are either are not T values, or
+    //       are T values but are not within the range of low to
+    //       high, will be successfully discarded, and the first
+    //       value that is both a T value and within the range of low
+    //       to high will be returned
+    //
+    // if allowed is given, a value within the range must also be one
+    // of its members, or it is treated as out of range
+
+    T userval;      // used to collect the user's input value
+    validation_outcome outcome;
+
+    // repeat the following as long as the attempt to get an input
+    // value failed, checking both its data type and its range in a
+    // single pass over what the user typed, unless the input ends or
+    // the budget is used up first, just as for read_validated()
+    if (! start_record_budget()) {
+        return T();
+    }
+    while ((outcome = read_value_in_range(userval, low, high, allowed))
+           != VALID) {
+        if (reader_status != READ_OK) {
+            return T();
+        }
+
+        if (outcome == INVALID_TYPE) {
+
+            // log the rejected input, if asked to, and then, from the
+            // input buffer, discard everything up to and including
+            // the enter key
+            if (pending_first != nullptr) {
+                log_pending_rejection(INVALID_TYPE, pending_first,
+                                      pending_last);
+            }
+            add_count(thread_counters().type_rejections, 1);
+            discard_pending_input();
+            if (! charge_retry()) {
+                return T();
+            }
+
+            // tell the user what happened, and to try again
+            prompts << "Invalid data type, should be " << kind
+                    << ", try again: ";
+        } else {
+            add_count(thread_counters().range_rejections, 1);
+            if (! charge_retry()) {
+                return T();
+            }
+
+            // tell the user what happened, and to try again
+            if (allowed != nullptr) {
+                prompts << "Invalid value, should be one of the "
+                        << allowed->size() << " allowed values";
+            } else {
+                prompts << "Invalid range, should be";
+            }
+            prompts << " between "
+                    << boolalpha
+                    << low
+                    << " and "
+                    << high
+                    << ", try again: ";
+        }
     }
 
-    // return the valid element value given by the user
+    // return the valid T value given by the user
+    add_count(thread_counters().accepted, 1);
     return userval;
 }
 
+int read_int() {
+
+    // PRE:  the user must enter a series of zero or more
+    //       non-valid int values, followed by a valid int value
+    //
+    // POST: all entered non-valid int values will be successfully
+    //       discarded, and the first valid int value entered will
+    //       be returned
+
+    return read_validated<int>("a whole number");
+}
+
+float read_float() {
+
+    // PRE:  the user must enter a series of zero or more
+    //       non-valid float values, followed by a valid float
+    //       value
+    //
+    // POST: all entered non-valid float values will be
+    //       successfully discarded, and the first valid float
+    //       value entered will be returned
+
+    return read_validated<float>("a fractional number");
+}
+
+element read_element() {
+
+    // PRE:  the user must enter a series of zero or more
+    //       non-valid element values, followed by a valid element
+    //       value
+    //
+    // POST: all entered non-valid element values will be
+    //       successfully discarded, and the first valid element
+    //       value entered will be returned
+
+    return read_validated<element>("an element (" + ELEMENT_NAME + ")");
+}
+
 
 //////////////////////////////////////////////////////////////////////
 
@@ -549,21 +2215,21 @@ void instruct() {
     // tell the user how to use the repetition type-checking data
     // validation and repetition range-checking data validation
     // demonstration
-    cout << endl
-         << "Demonstration of repetition type-checking"
-         << endl
-         << "data validation and repetition range checking"
-         << endl
-         << "data validation."
-         << endl
-         << endl
-         << "For the prompts that follow, try typing inputs"
-         << endl
-         << "outside of the given range, or even using a"
-         << endl
-         << "wrong data type."
-         << endl
-         << endl;
+    prompts << '\n'
+            << "Demonstration of repetition type-checking"
+            << '\n'
+            << "data validation and repetition range checking"
+            << '\n'
+            << "data validation."
+            << '\n'
+            << '\n'
+            << "For the prompts that follow, try typing inputs"
+            << '\n'
+            << "outside of the given range, or even using a"
+            << '\n'
+            << "wrong data type."
+            << '\n'
+            << '\n';
 }
 
 
@@ -581,16 +2247,20 @@ void demo_int_type_checking() {
     int userval;    // used to collect the user's input value
 
     // prompt the user to input an int value
-    cout << "Enter a whole number: ";
+    prompts << "Enter a whole number: ";
 
     // get the user's input value in a type-safe fashion
     userval = read_int();
 
+    // stop if the reader gave up without getting a value
+    if (reader_status != READ_OK) {
+        return;
+    }
+
     // display the user's input value
     cout << "You entered "
          << userval
-         << endl
-         << endl;
+         << "\n\n";
 }
 
 void demo_float_type_checking() {
@@ -606,16 +2276,20 @@ void demo_float_type_checking() {
     float userval;  // used to collect the user's input value
 
     // prompt the user to input a float value
-    cout << "Enter a fractional number: ";
+    prompts << "Enter a fractional number: ";
 
     // get the user's input value in a type-safe fashion
     userval = read_float();
 
+    // stop if the reader gave up without getting a value
+    if (reader_status != READ_OK) {
+        return;
+    }
+
     // display the user's input value
     cout << "You entered "
          << userval
-         << endl
-         << endl;
+         << "\n\n";
 }
 
 void demo_element_type_checking() {
@@ -632,11 +2306,16 @@ void demo_element_type_checking() {
     // value
 
     // prompt the user to input an element value
-    cout << "Enter an element (" << ELEMENT_NAME << "): ";
+    prompts << "Enter an element (" << ELEMENT_NAME << "): ";
 
     // get the user's input value in a type-safe fashion
     userval = read_element();
 
+    // stop if the reader gave up without getting a value
+    if (reader_status != READ_OK) {
+        return;
+    }
+
     // display the user's input value
     //
     // the boolalpha manipulator is used in case elements are
@@ -645,8 +2324,7 @@ void demo_element_type_checking() {
     cout << "You entered "
          << boolalpha
          << userval
-         << endl
-         << endl;
+         << "\n\n";
 }
 
 
@@ -657,126 +2335,136 @@ void demo_int_type_and_range_checking() {
 
     // PRE:  the user must enter a series of zero or more values
     //       that either are not ints, or are ints but are not
-    //       within the range of 6 to 37, followed by a value that
-    //       is both an int and within the range of 6 to 37
+    //       within the range of int_demo_low to int_demo_high (6 to
+    //       37, unless a rules file says otherwise), followed by a
+    //       value that is both an int and within that range
     //
     // POST: all entered values that are either are not ints, or
-    //       are ints but are not within the range of 6 to 37,
-    //       will be successfully discarded, and the first value
-    //       that is both an int and within the range of 6 to 37
+    //       are ints but are not within the range of int_demo_low to
+    //       int_demo_high, will be successfully discarded, and the
+    //       first value that is both an int and within that range
     //       will be returned
 
     int userval;    // used to collect the user's input value
 
-    // prompt the user to input an int value between 6 and 37
-    cout << "Enter a whole number between 6 and 37: ";
-
-    // get the user's input value in a type-safe fashion
-    userval = read_int();
-
-    // repeat the following as long as this int input value
-    // is not between 6 and 37
-    while ((userval < 6) || (userval > 37)) {
-
-        // tell the user what happened, and to try again
-        cout << "Invalid range, should be between 6 and 37, "
-             << "try again: ";
-
-        // get the user's input value in a type-safe fashion
-        userval = read_int();
+    // prompt the user to input an int value between int_demo_low and
+    // int_demo_high, which must also be one of the allowed values if a
+    // rules file gives any
+    if (int_demo_set.empty()) {
+        prompts << "Enter a whole number between ";
+    } else {
+        prompts << "Enter one of the " << int_demo_set.size()
+                << " allowed whole numbers between ";
+    }
+    prompts << int_demo_low
+            << " and "
+            << int_demo_high << ": ";
+
+    // get the user's input value in a type-safe fashion, repeating
+    // until it is between int_demo_low and int_demo_high
+    userval = read_validated_in_range<int>(int_demo_low, int_demo_high,
+                                           "a whole number",
+                                           int_demo_set.empty()
+                                               ? nullptr : &int_demo_set);
+
+    // stop if the reader gave up without getting a value
+    if (reader_status != READ_OK) {
+        return;
     }
 
     // display the user's input value
     cout << "You entered "
          << userval
-         << endl
-         << endl;
+         << "\n\n";
 }
 
 void demo_float_type_and_range_checking() {
 
     // PRE:  the user must enter a series of zero or more values
     //       that either are not floats, or are floats but are not
-    //       within the range of 5.5 to 42.8, followed by a value
-    //       that is both an float and within the range of 5.5 to
-    //       42.8
+    //       within the range of float_demo_low to float_demo_high
+    //       (5.5 to 42.8, unless a rules file says otherwise),
+    //       followed by a value that is both an float and within
+    //       that range
     //
     // POST: all entered values that are either are not floats, or
-    //       are floats but are not within the range of 5.5 to
-    //       42.8, will be successfully discarded, and the first
-    //       value that is both a float and within the range of
-    //       5.5 to 42.8 will be returned
+    //       are floats but are not within the range of
+    //       float_demo_low to float_demo_high, will be successfully
+    //       discarded, and the first value that is both a float and
+    //       within that range will be returned
 
     float userval;  // used to collect the user's input value
 
-    // prompt the user to input a float value between 5.5 and 42.8
-    cout << "Enter a factional number between 5.5 and 42.8: ";
-
-    // get the user's input value in a type-safe fashion
-    userval = read_float();
-
-    // repeat the following as long as this float input value
-    // is not between 5.5 and 42.8
-    while ((userval < 5.5) || (userval > 42.8)) {
-
-        // tell the user what happened, and to try again
-        cout << "Invalid range, should be between 5.5 and "
-             << "42.8, try again: ";
-
-        // get the user's input value in a type-safe fashion
-        userval = read_float();
+    // prompt the user to input a float value between float_demo_low
+    // and float_demo_high
+    prompts << "Enter a factional number between "
+            << float_demo_low
+            << " and "
+            << float_demo_high << ": ";
+
+    // get the user's input value in a type-safe fashion, repeating
+    // until it is between float_demo_low and float_demo_high
+    userval = read_validated_in_range<float>(float_demo_low,
+                                             float_demo_high,
+                                             "a fractional number");
+
+    // stop if the reader gave up without getting a value
+    if (reader_status != READ_OK) {
+        return;
     }
 
     // display the user's input value
     cout << "You entered "
          << userval
-         << endl
-         << endl;
+         << "\n\n";
 }
 
 void demo_element_type_and_range_checking() {
 
     // PRE:  the user must enter a series of zero or more values
     //       that either are not elements, or are elements but are
-    //       not within the range of ELEMENT_LOW to ELEMENT_HIGH,
-    //       followed by a value that is both an element and
-    //       within the range of ELEMENT_LOW to ELEMENT_HIGH
+    //       not within the range of element_demo_low to
+    //       element_demo_high (ELEMENT_LOW to ELEMENT_HIGH, unless a
+    //       rules file says otherwise), followed by a value that is
+    //       both an element and within that range
     //
     // POST: all entered values that are either are not elements,
     //       or are elements but are not within the range of
-    //       ELEMENT_LOW to ELEMENT_HIGH, will be successfully
-    //       discarded, and the first value that is both an
-    //       element and within the range of ELEMENT_LOW to
-    //       ELEMENT_HIGH will be returned
+    //       element_demo_low to element_demo_high, will be
+    //       successfully discarded, and the first value that is both
+    //       an element and within that range will be returned
 
     element userval;        // used to collect the user's input
     // value
 
     // prompt the user to input an element value between
-    // ELEMENT_LOW and ELEMENT_HIGH
-    cout << "Enter an element ("
-         << ELEMENT_NAME
-         << ") between "
-         << ELEMENT_LOW
-         << " and "
-         << ELEMENT_HIGH << ": ";
-
-    // get the user's input value in a type-safe fashion
-    userval = read_element();
-
-    // repeat the following as long as this element input value
-    // is not between ELEMENT_LOW and ELEMENT_HIGH
-    while ((userval < ELEMENT_LOW) || (userval > ELEMENT_HIGH)) {
-
-        // tell the user what happened, and to try again
-        cout << "Invalid range, should be between "
-             << ELEMENT_LOW
-             << " and "
-             << ELEMENT_HIGH
-             << ", try again: ";
-
-        // get the user's input value in a type-safe fashion
-        userval = read_element();
+    // element_demo_low and element_demo_high, which must also be one of
+    // the allowed values if a rules file gives any
+    if (element_demo_set.empty()) {
+        prompts << "Enter an element (";
+    } else {
+        prompts << "Enter one of the " << element_demo_set.size()
+                << " allowed elements (";
+    }
+    prompts << ELEMENT_NAME
+            << ") between "
+            << element_demo_low
+            << " and "
+            << element_demo_high << ": ";
+
+    // get the user's input value in a type-safe fashion, repeating
+    // until it is between element_demo_low and element_demo_high
+    userval = read_validated_in_range<element>(element_demo_low,
+                                               element_demo_high,
+                                               "an element ("
+                                               + ELEMENT_NAME + ")",
+                                               element_demo_set.empty()
+                                                   ? nullptr
+                                                   : &element_demo_set);
+
+    // stop if the reader gave up without getting a value
+    if (reader_status != READ_OK) {
+        return;
     }
 
     // display the user's input value
@@ -787,7 +2475,1899 @@ void demo_element_type_and_range_checking() {
     cout << "You entered "
          << boolalpha
          << userval
-         << endl
+         << "\n\n";
+}
+
+
+//////////////////////////////////////////////////////////////////////
+
+
+template <typename T>
+void append_synthetic(string &out, synthetic_kind kind, T low, T high,
+                      mt19937_64 &random) {
+
+    // PRE:  low is not greater than high
+    //
+    // POST: one synthetic record of the given kind has been appended
+    //       to out, with its newline; where a kind cannot be made for
+    //       T (a bool cannot be out of range, and any word is a
+    //       string), the nearest thing is appended instead
+
+    if (kind == SYNTHETIC_WRONG_TYPE) {
+        out += "abc\n";
+        return;
+    }
+    if (kind == SYNTHETIC_OVERLONG) {
+
+        // one long word, which cin.ignore(80, '\n') would only have
+        // discarded part of
+        out.append(100, 'x');
+        out += '\n';
+        return;
+    }
+
+    bool inside = (kind == SYNTHETIC_VALID);
+    T value = low;
+
+    if constexpr (is_same_v<T, bool>) {
+        value = bool(random() & 1);
+    } else if constexpr (is_same_v<T, char>) {
+        if (inside) {
+            value = char(low + random() % (high - low + 1));
+        } else {
+            value = (high < '~') ? char(high + 1) : char(low - 1);
+        }
+    } else if constexpr (is_integral_v<T>) {
+        if (inside) {
+            value = T(low + T(random() % (uint64_t(high - low) + 1)));
+        } else {
+            value = (high < numeric_limits<T>::max()) ? T(high + 1)
+                                                      : T(low - 1);
+        }
+    } else if constexpr (is_floating_point_v<T>) {
+        double fraction = double(random() >> 11) / double(uint64_t(1) << 53);
+        value = inside ? T(low + (high - low) * fraction)
+                       : T(high + 1 + 100 * fraction);
+        value = inside ? min(max(value, low), high) : value;
+    } else {
+
+        // a string, which sorts after any string that does not start
+        // with a tilde if it is to be out of range
+        value = inside ? low : T("~");
+    }
+
+    append_value(out, value);
+    out += '\n';
+}
+
+template <typename T>
+string synthetic_input(const benchmark_options &options, T low, T high) {
+
+    // PRE:  low is not greater than high
+    //
+    // POST: options.records synthetic records, of the kinds chosen at
+    //       random in the proportions of options.mix, have been
+    //       returned, followed by one more valid record, so that
+    //       every reader finishes on a value it accepts
+
+    mt19937_64 random(options.seed);
+    unsigned int total = 0;
+    for (unsigned int share : options.mix) {
+        total += share;
+    }
+
+    string input;
+    for (size_t i = 0; i < options.records; ++i) {
+        unsigned int pick = random() % total;
+        int kind = 0;
+        while (pick >= options.mix[kind]) {
+            pick -= options.mix[kind];
+            ++kind;
+        }
+        append_synthetic(input, synthetic_kind(kind), low, high, random);
+    }
+    append_synthetic(input, SYNTHETIC_VALID, low, high, random);
+    return input;
+}
+
+template <typename T, typename Read>
+void benchmark_reader(const string &name, const benchmark_options &options,
+                      T low, T high, Read read) {
+
+    // PRE:  read() reads one value just as the reader being
+    //       benchmarked does, and accepts every valid record that
+    //       synthetic_input() makes from low and high
+    //
+    // POST: the synthetic input has been fed through read(), and its
+    //       throughput and latencies have been written to standard
+    //       output
+
+    string input = synthetic_input(options, low, high);
+    memory_source source(input.data(), input.data() + input.size());
+    vector<uint64_t> latencies;
+    volatile bool sink = false;     // keeps the value from being
+                                    // optimized away
+
+    reader_source = &source;
+    reset_pending_input();
+
+    // call the reader until every record has been used, timing each
+    // call on its own
+    auto start = chrono::steady_clock::now();
+    while (fill_pending_input()) {
+        auto before = chrono::steady_clock::now();
+        sink = sink ^ bool(read() == T());
+        auto after = chrono::steady_clock::now();
+        latencies.push_back(
+            chrono::duration_cast<chrono::nanoseconds>(after - before)
+                .count());
+    }
+    double seconds =
+        chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    // the median and 99th percentile latencies
+    size_t middle = latencies.size() / 2;
+    size_t tail = latencies.size() * 99 / 100;
+    nth_element(latencies.begin(), latencies.begin() + middle,
+                latencies.end());
+    uint64_t p50 = latencies[middle];
+    nth_element(latencies.begin(), latencies.begin() + tail,
+                latencies.end());
+    uint64_t p99 = latencies[tail];
+
+    cout << name << ": "
+         << uint64_t((options.records + 1) / seconds) << " records/s, "
+         << uint64_t(input.size() / seconds / 1e6) << " MB/s, "
+         << latencies.size() << " values, p50 " << p50 << " ns, p99 "
+         << p99 << " ns per value" << endl;
+}
+
+void run_benchmarks(const benchmark_options &options) {
+
+    // PRE:  none
+    //
+    // POST: each of the readers has been benchmarked, and the results
+    //       written to standard output, one line per reader
+    //
+    // the prompts and retry messages are dropped, so that what is
+    // measured is the reading and validating itself
+
+    input_source *original = reader_source;
+
+    configure_output(true);
+    interactive = false;
+
+    benchmark_reader("read_int", options, closed_low<INT_DEMO_RULE>(),
+                     closed_high<INT_DEMO_RULE>(),
+                     [] { return read_int(); });
+    benchmark_reader("read_float", options, closed_low<FLOAT_DEMO_RULE>(),
+                     closed_high<FLOAT_DEMO_RULE>(),
+                     [] { return read_float(); });
+    benchmark_reader("read_element", options, ELEMENT_LOW, ELEMENT_HIGH,
+                     [] { return read_element(); });
+    benchmark_reader("read_validated_in_range<int>", options,
+                     int_demo_low, int_demo_high, [] {
+                         return read_validated_in_range<int>(
+                             int_demo_low, int_demo_high, "a whole number");
+                     });
+    benchmark_reader("read_validated_in_range<float>", options,
+                     float_demo_low, float_demo_high, [] {
+                         return read_validated_in_range<float>(
+                             float_demo_low, float_demo_high,
+                             "a fractional number");
+                     });
+    benchmark_reader("read_validated_in_range<element>", options,
+                     element_demo_low, element_demo_high, [] {
+                         return read_validated_in_range<element>(
+                             element_demo_low, element_demo_high,
+                             "an element");
+                     });
+
+    reader_source = original;
+    reset_pending_input();
+}
+
+
+//////////////////////////////////////////////////////////////////////
+
+
+void append_fuzzed_record(string &out, mt19937_64 &random) {
+
+    // PRE:  none
+    //
+    // POST: see the prototype
+    //
+    // the pieces are chosen to reach the edges of the engines: signs,
+    // decimal points, and exponents in odd places, values at and just
+    // past the bounds of the ranges and of the data types, numbers too
+    // large or too small for a float, words, and every kind of
+    // whitespace
+
+    static const char *const PIECES[] = {
+        "0", "5", "6", "7", "12", "37", "38", "-", "+", ".", "e", "E",
+        "e-", "e+", "5.5", "42.8", "0.1", "x", "a", "~", "true", "false",
+        "2147483647", "2147483648", "-2147483648", "-2147483649",
+        "9223372036854775807", "9223372036854775808", "1e39", "1e-50",
+        "3.4028235e38", "1e309", "4e-324", "00000", "12345678901234567890",
+        " ", " ", "\t", "\v", "\f", "\r"
+    };
+    const size_t PIECE_COUNT = sizeof(PIECES) / sizeof(PIECES[0]);
+
+    // the single values, each of them valid for some data type, at or
+    // just past a bound of one of the ranges, or a member of one of the
+    // sets of allowed values that the suite checks, and the whitespace
+    // put around them
+    static const char *const VALUES[] = {
+        "5", "6", "7", "12", "16", "17", "20", "30", "36", "37", "38",
+        "52", "53", "-1", "0", "5.4", "5.5", "5.6", "28.5", "28.6", "42.8",
+        "42.9", "73.2", "73.3", "3.5e1", "2147483647", "-2147483648",
+        "9223372036854775807", "-9223372036854775808", "3.4028235e38",
+        "1.7976931348623157e308", "true", "false", "a", "e", "x", "z",
+        "`", "{", "A", "~", "Alpha", "Alph", "Beta", "Delta", "Gamma",
+        "Omega", "Omegaa", "Zeta"
+    };
+    const size_t VALUE_COUNT = sizeof(VALUES) / sizeof(VALUES[0]);
+    static const char *const SPACES[] = {
+        "", "", "", " ", "  ", "\t", "\r", " \v "
+    };
+    const size_t SPACE_COUNT = sizeof(SPACES) / sizeof(SPACES[0]);
+
+    size_t start = out.size();
+    if (random() % 2 == 0) {
+
+        // a single value, half of the time a number drawn from around
+        // the ranges of the demonstrations, and now and then followed
+        // by a second token, which only strict mode rejects
+        out += SPACES[random() % SPACE_COUNT];
+        if (random() % 2 == 0) {
+            out += VALUES[random() % VALUE_COUNT];
+        } else if (random() % 2 == 0) {
+            out += to_string(random() % 60);
+        } else {
+            out += to_string(random() % 80);
+            out += '.';
+            out += char('0' + random() % 10);
+        }
+        out += SPACES[random() % SPACE_COUNT];
+        if (random() % 8 == 0) {
+            out += ' ';
+            out += PIECES[random() % PIECE_COUNT];
+        }
+    } else {
+        size_t pieces = 1 + random() % 4;
+        for (size_t i = 0; i < pieces; ++i) {
+            if (random() % 4 == 0) {
+
+                // a run of random digits
+                size_t digits = 1 + random() % 12;
+                for (size_t j = 0; j < digits; ++j) {
+                    out += char('0' + random() % 10);
+                }
+            } else {
+                out += PIECES[random() % PIECE_COUNT];
+            }
+        }
+    }
+
+    // a whole record longer than cin.ignore(80, '\n') discards is never
+    // made, since the original readers would have read the rest of it
+    // as the next input, where the engines discard it
+    if (out.size() - start >= 80) {
+        out.resize(start + 79);
+    }
+    out += '\n';
+}
+
+template <typename T>
+bool oracle_accepts(const char *first, const char *last, T &value,
+                    bool strict) {
+
+    // PRE:  first and last delimit one record, without its newline
+    //
+    // POST: see the prototype
+
+    istringstream in(string(first, last));
+    bool accepted = oracle_read(in, value) || (! in.fail() && in.eof());
+    return accepted && (! strict || in.eof() || (in >> ws).eof());
+}
+
+template <typename T>
+bool oracle_read(istream &in, T &value) {
+
+    // PRE:  none
+    //
+    // POST: see the prototype
+    //
+    // this is the loop of the original readers, with in in place of
+    // cin, and the boolalpha manipulator that read_element() used
+
+    while (true) {
+
+        // attempt to get an input value whose data type is a T, which
+        // if it is a fractional number must be followed by whitespace
+        in >> boolalpha >> value;
+        if (is_floating_point_v<T> && in.good()) {
+            int next = in.peek();
+            if ((next != EOF) && ! isspace(next)) {
+                in.setstate(ios::failbit);
+            }
+        }
+        if (in.good()) {
+            return true;
+        }
+
+        // the original readers would ask again forever here
+        if (in.eof()) {
+            return false;
+        }
+
+        // re-enable the stream, and discard up to 80 characters or
+        // until the end of the line, whichever comes first
+        in.clear();
+        in.ignore(80, '\n');
+    }
+}
+
+template <typename T>
+record_oracle value_oracle(T low, T high, bool strict, vector<T> members) {
+
+    // PRE:  low is not greater than high
+    //
+    // POST: see the prototype
+
+    return [=](const char *first, const char *last, string &out) {
+        T value = T();
+        if (! oracle_accepts(first, last, value, strict)
+            || (value < low) || (high < value)
+            || (! members.empty()
+                && (find(members.begin(), members.end(), value)
+                    == members.end()))) {
+            return false;
+        }
+        append_value(out, value);
+        return true;
+    };
+}
+
+template <auto Rule>
+record_oracle rule_oracle(bool strict) {
+
+    // PRE:  Rule has no set of allowed values
+    //
+    // POST: see the prototype
+
+    return value_oracle(closed_low<Rule>(), closed_high<Rule>(), strict);
+}
+
+record_oracle fields_oracle(vector<record_oracle> fields, char delimiter) {
+
+    // PRE:  fields holds at least one oracle
+    //
+    // POST: see the prototype
+
+    return [=](const char *first, const char *last, string &out) {
+        for (size_t i = 0; i < fields.size(); ++i) {
+            const char *end = find(first, last, delimiter);
+
+            // a record must have exactly as many fields as the schema
+            if ((end == last) != (i + 1 == fields.size())) {
+                return false;
+            }
+            if (i != 0) {
+                out += delimiter;
+            }
+            if (! fields[i](first, end, out)) {
+                return false;
+            }
+            first = (end == last) ? last : end + 1;
+        }
+        return true;
+    };
+}
+
+string field_records(const string &records,
+                     const vector<record_oracle> &fields, char delimiter,
+                     size_t count, mt19937_64 &random) {
+
+    // PRE:  records holds at least one fuzzed record, none of which
+    //       holds delimiter
+    //
+    // POST: see the prototype
+
+    vector<pair<const char *, const char *>> lines;
+    const char *last = records.data() + records.size();
+    for (const char *first = records.data(); first != last;) {
+        const char *end_of_record = find_delimiter(first, last, '\n');
+        lines.emplace_back(first, end_of_record);
+        first = (end_of_record == last) ? last : end_of_record + 1;
+    }
+
+    string out;
+    string scratch;
+    size_t next = 0;
+    for (size_t i = 0; i < count; ++i) {
+        for (size_t j = 0; j < fields.size(); ++j) {
+
+            // look ahead for a record the field accepts, a few at most
+            bool accepted = (random() % 4 != 0);
+            size_t tries = 0;
+            while (accepted && (tries++ < 64)
+                   && ! fields[j](lines[next].first, lines[next].second,
+                                  scratch)) {
+                next = (next + 1) % lines.size();
+            }
+            scratch.clear();
+            if (j != 0) {
+                out += delimiter;
+            }
+            out.append(lines[next].first, lines[next].second);
+            next = (next + 1) % lines.size();
+        }
+        out += '\n';
+    }
+    return out;
+}
+
+int gzip_temporary(const string &data) {
+
+    // PRE:  data is smaller than 4 GB
+    //
+    // POST: see the prototype
+
+    char path[] = "/tmp/validation-regress-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return -1;
+    }
+    unlink(path);
+
+    z_stream stream = {};
+    if (deflateInit2(&stream, 1, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        close(fd);
+        return -1;
+    }
+    stream.next_in = (Bytef *) data.data();
+    stream.avail_in = uInt(data.size());
+
+    char block[1 << 16];
+    bool written = true;
+    int status;
+    do {
+        stream.next_out = (Bytef *) block;
+        stream.avail_out = sizeof(block);
+        status = deflate(&stream, Z_FINISH);
+        size_t size = sizeof(block) - stream.avail_out;
+        written = written && (write(fd, block, size) == ssize_t(size));
+    } while (status == Z_OK);
+    deflateEnd(&stream);
+
+    if ((status != Z_STREAM_END) || ! written
+        || (lseek(fd, 0, SEEK_SET) != 0)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+template <auto Rule>
+bool check_parsers(const string &name, const string &records,
+                   bool strict) {
+
+    // PRE:  records holds zero or more fuzzed records
+    //
+    // POST: every record has been given to parse_value(), to
+    //       validate_value(), and to validate_by_rule<Rule>(), in
+    //       strict mode if strict is true, and their decisions and
+    //       values have been compared with those of the oracle; see the
+    //       prototype
+
+    using T = typename decltype(Rule)::value_type;
+    const T low = closed_low<Rule>();
+    const T high = closed_high<Rule>();
+    const char *last = records.data() + records.size();
+    long count = 0;
+    long mismatches = 0;
+
+    strict_tokens = strict;
+    for (const char *first = records.data(); first != last;) {
+        const char *end_of_record = find_delimiter(first, last, '\n');
+        T expected = T();
+        bool accepted = oracle_accepts(first, end_of_record, expected,
+                                       strict);
+        validation_outcome outcome =
+            ! accepted ? INVALID_TYPE
+                       : (((expected < low) || (high < expected))
+                              ? INVALID_RANGE : VALID);
+
+        // validate_by_rule() range-checks whole numbers only, so any
+        // other value the oracle accepts it should find valid
+        validation_outcome ruled_expected = outcome;
+        if constexpr (! is_same_v<T, int> && ! is_same_v<T, long int>) {
+            ruled_expected = accepted ? VALID : INVALID_TYPE;
+        }
+
+        // the from_chars() engine, then the fused validator, and then
+        // the validator that applies the rule while parsing, exactly
+        T parsed = T();
+        T fused = T();
+        T ruled = T();
+        const char *end;
+        bool parsed_ok =
+            parse_value(first, end_of_record, parsed) != nullptr;
+        validation_outcome fused_outcome =
+            validate_value(first, end_of_record, low, high, fused, end);
+        validation_outcome ruled_outcome =
+            validate_by_rule<Rule>(first, end_of_record, ruled, end);
+
+        bool same = (parsed_ok == accepted)
+                    && (! accepted || (parsed == expected))
+                    && (fused_outcome == outcome)
+                    && ((outcome != VALID) || (fused == expected))
+                    && (ruled_outcome == ruled_expected)
+                    && ((ruled_outcome != VALID) || (ruled == expected));
+        if (! same && (++mismatches <= 3)) {
+            const char *const OUTCOMES[] = { "valid", "type", "range" };
+            string quoted;
+            append_json_string(quoted, first, end_of_record);
+            cout << "    " << quoted << ": oracle "
+                 << (accepted ? "accepts " : "rejects ");
+            if (accepted) {
+                cout << expected;
+            }
+            cout << ", parse_value " << (parsed_ok ? "accepts" : "rejects")
+                 << ", validate_value " << OUTCOMES[fused_outcome]
+                 << ", validate_by_rule " << OUTCOMES[ruled_outcome]
+                 << endl;
+        }
+        ++count;
+        first = (end_of_record == last) ? last : end_of_record + 1;
+    }
+    strict_tokens = false;
+
+    cout << name << ": " << count << " records, " << mismatches
+         << " mismatches" << endl;
+    return mismatches == 0;
+}
+
+bool check_string_parsers(const string &name, const string &records,
+                          bool strict) {
+
+    // PRE:  records holds zero or more fuzzed records
+    //
+    // POST: every record has been given to parse_value() for a string
+    //       and for a string_view, and to validate_value() for a
+    //       string_view within the range of the string element_traits,
+    //       which is how the batch mode checks strings, in strict mode
+    //       if strict is true, and their decisions and values have been
+    //       compared with those of the oracle; see the prototype
+
+    const string_view low = element_traits<string>::LOW;
+    const string_view high = element_traits<string>::HIGH;
+    const char *last = records.data() + records.size();
+    long count = 0;
+    long mismatches = 0;
+
+    strict_tokens = strict;
+    for (const char *first = records.data(); first != last;) {
+        const char *end_of_record = find_delimiter(first, last, '\n');
+        string expected;
+        bool accepted = oracle_accepts(first, end_of_record, expected,
+                                       strict);
+        validation_outcome outcome =
+            ! accepted ? INVALID_TYPE
+                       : (((expected < low) || (high < expected))
+                              ? INVALID_RANGE : VALID);
+
+        // the copying parser, then the one that refers to the record in
+        // place, and then the fused validator
+        string parsed;
+        string_view viewed;
+        string_view fused;
+        const char *end;
+        bool parsed_ok =
+            parse_value(first, end_of_record, parsed) != nullptr;
+        bool viewed_ok =
+            parse_value(first, end_of_record, viewed) != nullptr;
+        validation_outcome fused_outcome =
+            validate_value(first, end_of_record, low, high, fused, end);
+
+        bool same = (parsed_ok == accepted) && (viewed_ok == accepted)
+                    && (! accepted
+                        || ((parsed == expected) && (viewed == expected)))
+                    && (fused_outcome == outcome)
+                    && ((outcome != VALID) || (fused == expected));
+        if (! same && (++mismatches <= 3)) {
+            const char *const OUTCOMES[] = { "valid", "type", "range" };
+            string quoted;
+            append_json_string(quoted, first, end_of_record);
+            cout << "    " << quoted << ": oracle "
+                 << (accepted ? "accepts " : "rejects ") << expected
+                 << ", parse_value " << (parsed_ok ? "accepts" : "rejects")
+                 << " a string and "
+                 << (viewed_ok ? "accepts" : "rejects")
+                 << " a string_view, validate_value "
+                 << OUTCOMES[fused_outcome] << endl;
+        }
+        ++count;
+        first = (end_of_record == last) ? last : end_of_record + 1;
+    }
+    strict_tokens = false;
+
+    cout << name << ": " << count << " records, " << mismatches
+         << " mismatches" << endl;
+    return mismatches == 0;
+}
+
+template <typename T>
+bool check_batch(const string &type, const string &records,
+                 const batch_check &how, const record_oracle &expect) {
+
+    // PRE:  records holds zero or more fuzzed records, type names a
+    //       batch type, or is record if how.fields is given, and
+    //       expect is the oracle for them; T is the data type of the
+    //       values, which is only used if how.columnar is true
+    //
+    // POST: records, repeated how.copies times, has been validated by
+    //       the batch mode as type, run as how says, and its accepted
+    //       values and counts have been compared with those that the
+    //       oracle gives, skipping blank records as the batch mode
+    //       does; see the prototype
+
+    const char *last = records.data() + records.size();
+    string once;
+    long once_accepted = 0;
+    long once_rejected = 0;
+
+    for (const char *first = records.data(); first != last;) {
+        const char *end_of_record = find_delimiter(first, last, '\n');
+        size_t mark = once.size();
+        if (skip_whitespace(first, end_of_record) == end_of_record) {
+            // a blank record, which is neither accepted nor rejected
+        } else if (expect(first, end_of_record, once)) {
+            once += '\n';
+            ++once_accepted;
+        } else {
+            once.resize(mark);
+            ++once_rejected;
+        }
+        first = (end_of_record == last) ? last : end_of_record + 1;
+    }
+
+    // the input, and what should come of it, repeated as many times as
+    // asked for
+    string input;
+    string expected;
+    input.reserve(records.size() * how.copies);
+    expected.reserve(once.size() * how.copies);
+    for (size_t i = 0; i < how.copies; ++i) {
+        input += records;
+        expected += once;
+    }
+    long expected_accepted = once_accepted * long(how.copies);
+    long expected_rejected = once_rejected * long(how.copies);
+
+    // collect what the batch mode accepts, as a library caller would;
+    // columnar values come back in the chunks themselves, since they go
+    // to deliver rather than to the column writer, which is never
+    // opened
+    batch_options options;
+    column_writer columns;
+    validation_cache cache;
+    options.threads = how.threads;
+    options.steal = how.steal;
+    options.strict = how.strict;
+    if (how.columnar) {
+        options.columns = &columns;
+    }
+    if ((how.fields != nullptr)
+        && ! parse_schema(how.fields, options.fields)) {
+        cout << "    the schema " << how.fields << " is not valid" << endl;
+        return false;
+    }
+    if (how.cached) {
+
+        // the file only has to last as long as its mapping
+        char path[] = "/tmp/validation-regress-XXXXXX";
+        int fd = mkstemp(path);
+        bool opened = (fd >= 0)
+                      && cache.open(path, expected_accepted
+                                              + expected_rejected);
+        if (fd >= 0) {
+            close(fd);
+            unlink(path);
+        }
+        if (! opened) {
+            cout << "    cannot make a cache: " << strerror(errno) << endl;
+            return false;
+        }
+        options.cache = &cache;
+    }
+
+    string accepted;
+    long accepted_count = 0;
+    long rejected_count = 0;
+    uint64_t slots = 0;
+    options.deliver = [&](const chunk_result &chunk) {
+        if constexpr (is_arithmetic_v<T>) {
+            if (how.columnar) {
+
+                // every non-blank record has a value in the column, and
+                // those accepted have their bits set in the bitmap
+                for (uint64_t i = 0; i < chunk.slots; ++i) {
+                    if ((chunk.validity[i / 64] >> (i % 64)) & 1) {
+                        T value;
+                        memcpy(&value, chunk.column.data() + i * sizeof(T),
+                               sizeof(T));
+                        append_value(accepted, value);
+                        accepted += '\n';
+                    }
+                }
+            }
+        }
+        if (! how.columnar) {
+            accepted.append(chunk.accepted);
+        }
+        accepted_count += chunk.accepted_count;
+        rejected_count += chunk.rejected_count;
+        slots += chunk.slots;
+    };
+
+    // the second run of a cached check should find every record in the
+    // cache that the first filled, but for the few that may have been
+    // crowded out of it
+    bool same = true;
+    uint64_t misses = 0;
+    for (int run = 0; run < (how.cached ? 2 : 1); ++run) {
+        accepted.clear();
+        accepted_count = 0;
+        rejected_count = 0;
+        slots = 0;
+        misses = cache.misses();
+
+        if (how.gzip) {
+            int fd = gzip_temporary(input);
+            if (fd < 0) {
+                cout << "    cannot compress the input: " << strerror(errno)
+                     << endl;
+                return false;
+            }
+            gzip_source source;
+            source.open(fd);
+            batch_validate(type, source, options);
+            same = same && ! source.failed();
+        } else {
+            memory_source source(input.data(), input.data() + input.size());
+            batch_validate(type, source, options);
+        }
+
+        same = same && (accepted == expected)
+               && (accepted_count == expected_accepted)
+               && (rejected_count == expected_rejected)
+               && (! how.columnar
+                   || (long(slots) == expected_accepted + expected_rejected));
+    }
+    misses = cache.misses() - misses;
+    if (how.cached && (misses > uint64_t(expected_accepted
+                                         + expected_rejected) / 100)) {
+        cout << "    the second run missed the cache " << misses
+             << " times" << endl;
+        same = false;
+    }
+
+    // the first accepted value that differs, if any
+    if (! same) {
+        size_t at = mismatch(accepted.begin(),
+                             accepted.begin() + min(accepted.size(),
+                                                    expected.size()),
+                             expected.begin()).first - accepted.begin();
+        at = accepted.rfind('\n', at);
+        at = (at == string::npos) ? 0 : at + 1;
+        cout << "    accepted " << accepted_count << " and rejected "
+             << rejected_count << " where the oracle accepts "
+             << expected_accepted << " and rejects " << expected_rejected
+             << ", first differing at \""
+             << accepted.substr(at, accepted.find('\n', at) - at)
+             << "\" (expected \""
+             << expected.substr(at, expected.find('\n', at) - at) << "\")"
+             << endl;
+    }
+
+    cout << "batch " << type;
+    if (how.fields != nullptr) {
+        cout << " " << how.fields;
+    }
+    cout << " on " << how.threads
+         << (how.threads == 1 ? " thread" : " threads")
+         << (how.steal ? ", stealing" : "")
+         << (how.strict ? ", strict" : "")
+         << (how.columnar ? ", columnar" : "")
+         << (how.cached ? ", cached" : "")
+         << (how.gzip ? ", gzip" : "");
+    if (how.copies > 1) {
+        cout << ", " << (input.size() >> 20) << " MB";
+    }
+    cout << ": " << expected_accepted << " accepted, " << expected_rejected
+         << " rejected, " << (same ? 0 : 1) << " mismatches" << endl;
+    return same;
+}
+
+template <typename T, typename Read>
+bool check_reader(const string &name, const string &records, Read read) {
+
+    // PRE:  records holds zero or more fuzzed records, and read()
+    //       reads one T as the reader being checked does
+    //
+    // POST: the whole sequence of values that read() returns from
+    //       records, until it gives up at the end of the input, has
+    //       been compared with the sequence that the loop of the
+    //       original readers returns; see the prototype
+
+    vector<T> expected;
+    vector<T> returned;
+    istringstream in(records);
+    for (T value; oracle_read(in, value);) {
+        expected.push_back(value);
+    }
+
+    memory_source source(records.data(), records.data() + records.size());
+    input_source *original = reader_source;
+    reader_source = &source;
+    reset_pending_input();
+    while (true) {
+        T value = read();
+        if (reader_status != READ_OK) {
+            break;
+        }
+        returned.push_back(value);
+    }
+    reader_status = READ_OK;
+    reader_source = original;
+    reset_pending_input();
+
+    bool same = (returned == expected);
+    if (! same) {
+        size_t at = mismatch(returned.begin(),
+                             returned.begin() + min(returned.size(),
+                                                    expected.size()),
+                             expected.begin()).first - returned.begin();
+        cout << "    returned " << returned.size() << " values where the"
+             << " oracle returns " << expected.size()
+             << ", first differing at value " << at << endl;
+    }
+
+    cout << name << ": " << expected.size() << " values, "
+         << (same ? 0 : 1) << " mismatches" << endl;
+    return same;
+}
+
+template <typename Measure>
+uint64_t best_throughput(size_t records, Measure measure) {
+
+    // PRE:  measure() processes records records
+    //
+    // POST: the best number of records per second of three calls of
+    //       measure() has been returned, so that a single slow run,
+    //       interrupted by something else on the machine, is not taken
+    //       for a regression
+
+    double best = 0;
+    for (int run = 0; run < 3; ++run) {
+        auto start = chrono::steady_clock::now();
+        measure();
+        double seconds = chrono::duration<double>(
+            chrono::steady_clock::now() - start).count();
+        best = max(best, records / max(seconds, 1e-9));
+    }
+    return uint64_t(best);
+}
+
+bool check_throughput(const regress_options &options) {
+
+    // PRE:  none
+    //
+    // POST: the throughput of the readers and of the batch mode on one
+    //       thread has been measured on synthetic input, and written
+    //       to standard output; if options.baseline names a file that
+    //       exists, each has been compared with the throughput kept
+    //       there, and whether none of them fell more than
+    //       options.tolerance percent below it has been returned;
+    //       otherwise the throughputs have been kept in the file, if it
+    //       is named, and true has been returned
+
+    benchmark_options synthetic;
+    synthetic.records = options.records;
+    synthetic.seed = options.seed;
+    vector<pair<string, uint64_t>> measured;
+    volatile bool sink = false;     // keeps the values from being
+                                    // optimized away
+
+    // the readers, each reading every value of its input
+    auto reader = [&](const string &name, const string &input,
+                      auto read) {
+        measured.emplace_back(name, best_throughput(options.records + 1, [&] {
+            memory_source source(input.data(), input.data() + input.size());
+            reader_source = &source;
+            reset_pending_input();
+            while (fill_pending_input()) {
+                sink = sink ^ bool(read() == decltype(read())());
+            }
+            reader_status = READ_OK;
+        }));
+    };
+
+    // the batch mode, validating the whole input on this thread
+    auto batch = [&](const string &type, const string &input) {
+        batch_options single;
+        single.deliver = [&](const chunk_result &chunk) {
+            sink = sink ^ bool(chunk.accepted_count & 1);
+        };
+        measured.emplace_back("batch_" + type,
+                              best_throughput(options.records + 1, [&] {
+            memory_source source(input.data(), input.data() + input.size());
+            batch_validate(type, source, single);
+        }));
+    };
+
+    input_source *original = reader_source;
+    string ints = synthetic_input(synthetic, closed_low<INT_DEMO_RULE>(),
+                                  closed_high<INT_DEMO_RULE>());
+    string floats = synthetic_input(synthetic,
+                                    closed_low<FLOAT_DEMO_RULE>(),
+                                    closed_high<FLOAT_DEMO_RULE>());
+    string elements = synthetic_input(synthetic, ELEMENT_LOW, ELEMENT_HIGH);
+    string chars = synthetic_input(synthetic,
+                                   closed_low<TRAITS_RULE<char>>(),
+                                   closed_high<TRAITS_RULE<char>>());
+    string bools = synthetic_input(synthetic, false, true);
+
+    reader("read_int", ints, [] { return read_int(); });
+    reader("read_float", floats, [] { return read_float(); });
+    reader("read_element", elements, [] { return read_element(); });
+    batch("int", ints);
+    batch("float", floats);
+    batch("char", chars);
+    batch("bool", bools);
+    reader_source = original;
+    reset_pending_input();
+
+    // the baseline, if one has been kept
+    vector<pair<string, uint64_t>> baseline;
+    ifstream kept;
+    if (options.baseline != nullptr) {
+        kept.open(options.baseline);
+        string name;
+        uint64_t rate;
+        while (kept >> name >> rate) {
+            baseline.emplace_back(name, rate);
+        }
+    }
+
+    bool passed = true;
+    for (const pair<string, uint64_t> &result : measured) {
+        cout << "throughput " << result.first << ": " << result.second
+             << " records/s";
+        for (const pair<string, uint64_t> &base : baseline) {
+            if (base.first != result.first) {
+                continue;
+            }
+            double change = 100.0 * (double(result.second) - base.second)
+                            / max<uint64_t>(base.second, 1);
+            bool regressed = (change < -options.tolerance);
+            cout << ", baseline " << base.second << " ("
+                 << (change >= 0 ? "+" : "") << int(change) << "%)"
+                 << (regressed ? ", REGRESSED" : "");
+            passed = passed && ! regressed;
+        }
+        cout << endl;
+    }
+
+    // keep the throughputs as the baseline, if there was none yet
+    if ((options.baseline != nullptr) && ! kept.is_open()) {
+        ofstream out(options.baseline);
+        for (const pair<string, uint64_t> &result : measured) {
+            out << result.first << ' ' << result.second << '\n';
+        }
+        if (! out) {
+            cerr << "Cannot write " << options.baseline << ": "
+                 << strerror(errno) << endl;
+            return false;
+        }
+        cout << "Baseline written to " << options.baseline << endl;
+    }
+    return passed;
+}
+
+bool run_regression(const regress_options &options) {
+
+    // PRE:  no rules have been loaded, and tokens are not strict, so
+    //       that the engines apply the rules the oracles know
+    //
+    // POST: every check has been run, its results written to standard
+    //       output, and whether all of them passed has been returned
+
+    mt19937_64 random(options.seed);
+    string records;
+    for (size_t i = 0; i < options.records; ++i) {
+        append_fuzzed_record(records, random);
+    }
+    unsigned int threads = max(4u, thread::hardware_concurrency());
+    bool passed = true;
+
+    configure_output(true);
+    interactive = false;
+
+    for (bool strict : { false, true }) {
+        string mode = strict ? " strict" : "";
+        passed &= check_parsers<INT_DEMO_RULE>("parsers int" + mode,
+                                               records, strict);
+        passed &= check_parsers<FLOAT_DEMO_RULE>("parsers float" + mode,
+                                                 records, strict);
+        passed &= check_parsers<TRAITS_RULE<element>>(
+            "parsers element" + mode, records, strict);
+        passed &= check_parsers<TRAITS_RULE<long int>>(
+            "parsers long" + mode, records, strict);
+        passed &= check_parsers<TRAITS_RULE<double>>(
+            "parsers double" + mode, records, strict);
+        passed &= check_parsers<TRAITS_RULE<char>>("parsers char" + mode,
+                                                   records, strict);
+        passed &= check_parsers<TRAITS_RULE<bool>>("parsers bool" + mode,
+                                                   records, strict);
+        passed &= check_string_parsers("parsers string" + mode, records,
+                                       strict);
+    }
+
+    const string LOW_STRING(element_traits<string>::LOW);
+    const string HIGH_STRING(element_traits<string>::HIGH);
+
+    // every data type, on one thread and on several stealing chunks,
+    // with and without strict mode
+    for (bool strict : { false, true }) {
+        for (unsigned int count : { 1u, threads }) {
+            batch_check how;
+            how.threads = count;
+            how.steal = (count > 1);
+            how.strict = strict;
+            passed &= check_batch<int>("int", records, how,
+                                       rule_oracle<INT_DEMO_RULE>(strict));
+            passed &= check_batch<float>(
+                "float", records, how, rule_oracle<FLOAT_DEMO_RULE>(strict));
+            passed &= check_batch<element>(
+                "element", records, how,
+                rule_oracle<TRAITS_RULE<element>>(strict));
+            passed &= check_batch<long int>(
+                "long", records, how,
+                rule_oracle<TRAITS_RULE<long int>>(strict));
+            passed &= check_batch<double>(
+                "double", records, how,
+                rule_oracle<TRAITS_RULE<double>>(strict));
+            passed &= check_batch<char>(
+                "char", records, how, rule_oracle<TRAITS_RULE<char>>(strict));
+            passed &= check_batch<bool>(
+                "bool", records, how, rule_oracle<TRAITS_RULE<bool>>(strict));
+            passed &= check_batch<string_view>(
+                "string", records, how,
+                value_oracle(LOW_STRING, HIGH_STRING, strict));
+        }
+    }
+
+    // columnar output, for the data types it supports
+    for (unsigned int count : { 1u, threads }) {
+        batch_check how;
+        how.threads = count;
+        how.steal = (count > 1);
+        how.columnar = true;
+        passed &= check_batch<int>("int", records, how,
+                                   rule_oracle<INT_DEMO_RULE>(false));
+        passed &= check_batch<long int>(
+            "long", records, how, rule_oracle<TRAITS_RULE<long int>>(false));
+        passed &= check_batch<float>("float", records, how,
+                                     rule_oracle<FLOAT_DEMO_RULE>(false));
+        passed &= check_batch<double>(
+            "double", records, how, rule_oracle<TRAITS_RULE<double>>(false));
+    }
+
+    // the outcome cache, which is filled by the first of two runs and
+    // used by the second
+    {
+        batch_check how;
+        how.threads = threads;
+        how.steal = true;
+        how.cached = true;
+        passed &= check_batch<int>("int", records, how,
+                                   rule_oracle<INT_DEMO_RULE>(false));
+        passed &= check_batch<float>("float", records, how,
+                                     rule_oracle<FLOAT_DEMO_RULE>(false));
+        passed &= check_batch<double>(
+            "double", records, how, rule_oracle<TRAITS_RULE<double>>(false));
+        passed &= check_batch<string_view>(
+            "string", records, how,
+            value_oracle(LOW_STRING, HIGH_STRING, false));
+        how.strict = true;
+        passed &= check_batch<int>("int", records, how,
+                                   rule_oracle<INT_DEMO_RULE>(true));
+    }
+
+    // gzip-compressed input, and an input of enough copies of the
+    // records to fill more than two of the 16 MB blocks that the batch
+    // mode reads at a time, compressed or not, so that blocks end in
+    // the middle of records and of compressed buffers
+    size_t copies = (40 << 20) / max<size_t>(records.size(), 1) + 1;
+    for (size_t repeat : { size_t(1), copies }) {
+        for (bool gzip : { false, true }) {
+            if ((repeat == 1) && ! gzip) {
+                continue;
+            }
+            batch_check how;
+            how.threads = threads;
+            how.steal = true;
+            how.gzip = gzip;
+            how.copies = repeat;
+            passed &= check_batch<int>("int", records, how,
+                                       rule_oracle<INT_DEMO_RULE>(false));
+            passed &= check_batch<char>(
+                "char", records, how, rule_oracle<TRAITS_RULE<char>>(false));
+            passed &= check_batch<string_view>(
+                "string", records, how,
+                value_oracle(LOW_STRING, HIGH_STRING, false));
+        }
+    }
+
+    // records of several fields, with and without sets of allowed
+    // values, made mostly of fields that are accepted on their own
+    const char *const SCHEMA = "int:6:37,float:5.5:42.8,string:Alpha:Omega";
+    const char *const SET_SCHEMA = "int:6:37 in 6 7 12 20 36 37,"
+                                   "char:a:z in a e x z,"
+                                   "string:Alpha:Omega in Alpha Beta Omega";
+    const vector<int> INT_MEMBERS = { 6, 7, 12, 20, 36, 37 };
+    const vector<char> CHAR_MEMBERS = { 'a', 'e', 'x', 'z' };
+    const vector<string> STRING_MEMBERS = { "Alpha", "Beta", "Omega" };
+    for (bool in_set : { false, true }) {
+        vector<record_oracle> fields;
+        if (! in_set) {
+            fields = { value_oracle(6, 37, false),
+                       value_oracle(5.5f, 42.8f, false),
+                       value_oracle(LOW_STRING, HIGH_STRING, false) };
+        } else {
+            fields = { value_oracle(6, 37, false, INT_MEMBERS),
+                       value_oracle('a', 'z', false, CHAR_MEMBERS),
+                       value_oracle(LOW_STRING, HIGH_STRING, false,
+                                    STRING_MEMBERS) };
+        }
+        string rows = field_records(records, fields, ',',
+                                    options.records / 2, random);
+        for (bool strict : { false, true }) {
+            vector<record_oracle> checked;
+            if (! in_set) {
+                checked = { value_oracle(6, 37, strict),
+                            value_oracle(5.5f, 42.8f, strict),
+                            value_oracle(LOW_STRING, HIGH_STRING, strict) };
+            } else {
+                checked = { value_oracle(6, 37, strict, INT_MEMBERS),
+                            value_oracle('a', 'z', strict, CHAR_MEMBERS),
+                            value_oracle(LOW_STRING, HIGH_STRING, strict,
+                                         STRING_MEMBERS) };
+            }
+            for (unsigned int count : { 1u, threads }) {
+                batch_check how;
+                how.threads = count;
+                how.steal = (count > 1);
+                how.strict = strict;
+                how.fields = in_set ? SET_SCHEMA : SCHEMA;
+                passed &= check_batch<string>("record", rows, how,
+                                              fields_oracle(checked, ','));
+            }
+        }
+    }
+
+    // whole records checked against sets of allowed values, by rules
+    // loaded from a file as --rules loads them
+    char rules_path[] = "/tmp/validation-regress-XXXXXX";
+    int rules_fd = mkstemp(rules_path);
+    string rules = "regress_ints = int:6:37 in 6 7 12 20 36 37\n"
+                   "regress_longs = long in 17 30 52\n"
+                   "regress_codes = char:a:z in a e x z\n"
+                   "regress_words = string:Alpha:Omega in Alpha Beta Omega\n";
+    string error;
+    bool loaded = (rules_fd >= 0)
+                  && (write(rules_fd, rules.data(), rules.size())
+                      == ssize_t(rules.size()))
+                  && load_rules(rules_path, error);
+    if (rules_fd >= 0) {
+        close(rules_fd);
+        unlink(rules_path);
+    }
+    if (! loaded) {
+        cout << "sets: cannot load the rules: " << error << endl;
+        passed = false;
+    }
+    for (unsigned int count : { 1u, threads }) {
+        if (! loaded) {
+            break;
+        }
+        batch_check how;
+        how.threads = count;
+        how.steal = (count > 1);
+        passed &= check_batch<int>("regress_ints", records, how,
+                                   value_oracle(6, 37, false, INT_MEMBERS));
+        passed &= check_batch<long int>(
+            "regress_longs", records, how,
+            value_oracle(17L, 52L, false, vector<long int>{ 17, 30, 52 }));
+        passed &= check_batch<char>(
+            "regress_codes", records, how,
+            value_oracle('a', 'z', false, CHAR_MEMBERS));
+        passed &= check_batch<string_view>(
+            "regress_words", records, how,
+            value_oracle(LOW_STRING, HIGH_STRING, false, STRING_MEMBERS));
+    }
+
+    passed &= check_reader<int>("read_int", records,
+                                [] { return read_int(); });
+    passed &= check_reader<float>("read_float", records,
+                                  [] { return read_float(); });
+    passed &= check_reader<element>("read_element", records,
+                                    [] { return read_element(); });
+
+    passed &= check_throughput(options);
+
+    cout << (passed ? "Regression suite passed" : "Regression suite FAILED")
          << endl;
+    return passed;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+
+
+event_loop::event_loop() : epoll_fd(epoll_create1(EPOLL_CLOEXEC)), waiting(0) {
+
+    // PRE:  none
+    //
+    // POST: the loop has no coroutines waiting in it, and descriptor()
+    //       is -1 if epoll could not be used, with errno saying why
+
+}
+
+event_loop::~event_loop() {
+
+    // PRE:  none
+    //
+    // POST: the epoll instance has been closed
+
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+    }
+}
+
+bool event_loop::readable::await_suspend(coroutine_handle<> waiting) {
+
+    // PRE:  fd is open, or is -1 to wait for the deadline alone
+    //
+    // POST: if epoll is watching fd, for one event only, so that the
+    //       waiting coroutine is resumed once, or fd is -1 and the
+    //       deadline is yet to come, true has been returned; otherwise
+    //       false has been returned, so the coroutine goes straight on
+    //       to read fd, unless the deadline has already passed
+
+    if ((by != deadline::max()) && (chrono::steady_clock::now() >= by)) {
+        timed_out = true;
+        return false;
+    }
+
+    epoll_event event = {};
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.ptr = this;
+
+    // a file descriptor is added the first time it is waited on, and
+    // re-armed after that
+    if ((fd >= 0) &&
+        (epoll_ctl(loop.epoll_fd, EPOLL_CTL_MOD, fd, &event) != 0) &&
+        ((errno != ENOENT) ||
+         (epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0))) {
+        return false;
+    }
+    this->waiting = waiting;
+    if (by != deadline::max()) {
+        timer = loop.timers.emplace(by, this);
+    }
+    ++loop.waiting;
+    return true;
+}
+
+void event_loop::run() {
+
+    // PRE:  none
+    //
+    // POST: see the prototype
+
+    epoll_event events[64];
+
+    while (waiting > 0) {
+
+        // wait no longer than until the soonest deadline, rounded up to
+        // a whole millisecond so as not to wake up just before it
+        int timeout = -1;
+        if (! timers.empty()) {
+            auto left = timers.begin()->first - chrono::steady_clock::now();
+            timeout = max<int64_t>(0, chrono::ceil<chrono::milliseconds>(
+                                          left).count());
+            timeout = min(timeout, INT_MAX);
+        }
+        int ready = epoll_wait(epoll_fd, events, 64, timeout);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        // the streams that became readable are resumed first, so that
+        // none of them is also timed out below
+        for (int i = 0; i < ready; ++i) {
+            readable *awaiter = static_cast<readable *>(events[i].data.ptr);
+            if (awaiter->by != deadline::max()) {
+                timers.erase(awaiter->timer);
+            }
+            --waiting;
+            awaiter->waiting.resume();
+        }
+
+        // then those whose deadlines have passed, after epoll has been
+        // told to stop watching their file descriptors
+        auto now = chrono::steady_clock::now();
+        while (! timers.empty() && (timers.begin()->first <= now)) {
+            readable *awaiter = timers.begin()->second;
+            timers.erase(timers.begin());
+            if (awaiter->fd >= 0) {
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, awaiter->fd, nullptr);
+            }
+            awaiter->timed_out = true;
+            --waiting;
+            awaiter->waiting.resume();
+        }
+
+        // let the values accepted by this round be seen before waiting
+        // for the next
+        cout.flush();
+    }
+}
+
+async_stream::async_stream(event_loop &loop, int fd, bool replies)
+    : loop(loop), fd(fd), replies(replies),
+      opened(chrono::steady_clock::now()) {
+
+    // PRE:  see the prototype
+    //
+    // POST: see the prototype
+
+}
+
+async_stream::~async_stream() {
+
+    // PRE:  none
+    //
+    // POST: fd has been closed, which also stops epoll from watching it
+
+    close(fd);
+}
+
+void async_stream::start_value() {
+
+    // PRE:  none
+    //
+    // POST: see the prototype
+
+    value_deadline = event_loop::deadline::max();
+    if (budget.stream_time.count() != 0) {
+        value_deadline = opened + budget.stream_time;
+    }
+    if (budget.record_time.count() != 0) {
+        value_deadline = min(value_deadline, chrono::steady_clock::now()
+                                             + budget.record_time);
+    }
+}
+
+task<bool> async_stream::fill() {
+
+    // PRE:  none
+    //
+    // POST: see the prototype
+
+    while (true) {
+        if (in_record) {
+            const char *data = buffer.data();
+            if (skip_whitespace(data + first, data + last) != data + last) {
+                co_return true;
+            }
+
+            // everything pending is whitespace, so move past the end of
+            // the record
+            in_record = false;
+            first = min(last + 1, buffer.size());
+        }
+
+        // take the next record if all of it has arrived, or if the
+        // stream has ended without a newline after it
+        const char *data = buffer.data();
+        const char *newline =
+            find_delimiter(data + first, data + buffer.size(), '\n');
+        if ((newline != data + buffer.size()) ||
+            (ended && (first < buffer.size()))) {
+            record = first;
+            last = newline - data;
+            in_record = true;
+            ++line;
+
+            // a record that arrived in one go may still be longer than
+            // the budget allows
+            if (! within_limit(last - record, budget.record_bytes)) {
+                reason = READ_BYTE_LIMIT;
+                ended = true;
+                co_return false;
+            }
+            continue;
+        }
+        if (ended) {
+            reason = max(reason, READ_END_OF_INPUT);
+            co_return false;
+        }
+
+        // drop the characters that have been used, and wait for more
+        buffer_offset += first;
+        buffer.erase(0, first);
+        first = 0;
+        if (! co_await loop.wait_readable(fd, value_deadline)) {
+            reason = READ_TIME_LIMIT;
+            ended = true;
+            co_return false;
+        }
+
+        char block[1 << 16];
+        ssize_t count;
+        do {
+            count = read(fd, block, sizeof(block));
+        } while ((count < 0) && (errno == EINTR));
+
+        size_t searched = buffer.size();   // holds no newline
+        if (count > 0) {
+            buffer.append(block, count);
+            received += count;
+        } else if ((count == 0) || (errno != EAGAIN)) {
+            ended = true;
+        }
+
+        // stop reading a stream that has sent more than its budget, or
+        // a record longer than it, without waiting for the rest; the
+        // record still arriving runs from the start of the buffer to
+        // its first newline, and the records after that are measured
+        // as they are taken
+        data = buffer.data();
+        size_t pending = find_delimiter(data + searched,
+                                        data + buffer.size(), '\n') - data;
+        if (! within_limit(received, budget.stream_bytes)
+            || ! within_limit(pending, budget.record_bytes)) {
+            reason = READ_BYTE_LIMIT;
+            ended = true;
+            co_return false;
+        }
+    }
+}
+
+bool async_stream::charge_retry(unsigned long &record_retries) {
+
+    // PRE:  an invalid input has just been rejected
+    //
+    // POST: see the prototype
+
+    ++record_retries;
+    ++retries;
+    if (! within_limit(record_retries, budget.record_retries)
+        || ! within_limit(retries, budget.stream_retries)) {
+        reason = READ_RETRY_LIMIT;
+        return false;
+    }
+    if ((value_deadline != event_loop::deadline::max())
+        && (chrono::steady_clock::now() >= value_deadline)) {
+        reason = READ_TIME_LIMIT;
+        return false;
+    }
+    return true;
+}
+
+void async_stream::discard() {
+
+    // PRE:  none
+    //
+    // POST: see the prototype
+
+    add_count(thread_counters().bytes_skipped, last - first);
+    first = last;
+}
+
+void async_stream::reply(const string &message) {
+
+    // PRE:  none
+    //
+    // POST: see the prototype
+    //
+    // the replies are short and the producers are slow, so a socket
+    // whose buffer is full is simply not sent the rest of a reply,
+    // rather than making every other stream wait for it
+
+    if (! replies) {
+        return;
+    }
+    ssize_t count;
+    do {
+        count = send(fd, message.data(), message.size(), MSG_NOSIGNAL);
+    } while ((count < 0) && (errno == EINTR));
+}
+
+void async_stream::log_rejection(validation_outcome reason,
+                                 const char *first, const char *last) {
+
+    // PRE:  see the prototype
+    //
+    // POST: see the prototype
+
+    if (rejections == nullptr) {
+        return;
+    }
+    first = skip_whitespace(first, last);
+    rejections->record(buffer_offset + (first - buffer.data()), line,
+                       reason, first, last);
+}
+
+template <typename T>
+task<optional<T>> async_read_validated(async_stream &stream,
+                                       const string &kind) {
+
+    // PRE:  none
+    //
+    // POST: like read_validated(), every record that did not start
+    //       with a T value has been discarded, the producer told so,
+    //       and the first T value has been returned; or the stream
+    //       has ended first, or used up its budget, and nothing has
+    //       been returned
+
+    unsigned long retries = 0;
+    stream.start_value();
+    while (co_await stream.fill()) {
+        T userval;
+        const char *end;
+        {
+            parse_timer timer;
+            end = parse_value(stream.pending_first(), stream.pending_last(),
+                              userval);
+        }
+        if (end != nullptr) {
+            stream.use_up_to(end);
+            add_count(thread_counters().accepted, 1);
+            co_return userval;
+        }
+
+        // log the rejected input, if asked to, and discard the rest of
+        // its record
+        stream.log_rejection(INVALID_TYPE, stream.pending_first(),
+                             stream.pending_last());
+        add_count(thread_counters().type_rejections, 1);
+        stream.discard();
+        if (! stream.charge_retry(retries)) {
+            break;
+        }
+
+        // tell the producer what happened, and to try again
+        stream.reply("Invalid data type, should be " + kind +
+                     ", try again: ");
+    }
+    co_return nullopt;
 }
 
+template <typename T>
+task<optional<T>> async_read_validated_in_range(async_stream &stream,
+                                                T low, T high,
+                                                const string &kind) {
+
+    // PRE:  none
+    //
+    // POST: like read_validated_in_range(), every value that either
+    //       was not a T value, or was not within the range of low to
+    //       high, has been discarded, the producer told so, and the
+    //       first value that is both has been returned; or the stream
+    //       has ended first, or used up its budget, and nothing has
+    //       been returned
+
+    unsigned long retries = 0;
+    stream.start_value();
+    while (co_await stream.fill()) {
+        T userval;
+        const char *end = nullptr;
+        validation_outcome outcome;
+        {
+            parse_timer timer;
+            outcome = validate_value(stream.pending_first(),
+                                     stream.pending_last(), low, high,
+                                     userval, end);
+        }
+
+        if (outcome == VALID) {
+            stream.use_up_to(end);
+            add_count(thread_counters().accepted, 1);
+            co_return userval;
+        }
+
+        if (outcome == INVALID_TYPE) {
+
+            // log the rejected input, if asked to, and discard the rest
+            // of its record
+            stream.log_rejection(INVALID_TYPE, stream.pending_first(),
+                                 stream.pending_last());
+            add_count(thread_counters().type_rejections, 1);
+            stream.discard();
+            if (! stream.charge_retry(retries)) {
+                break;
+            }
+
+            // tell the producer what happened, and to try again
+            stream.reply("Invalid data type, should be " + kind +
+                         ", try again: ");
+        } else {
+            stream.log_rejection(INVALID_RANGE, stream.pending_first(), end);
+            stream.use_up_to(end);
+            add_count(thread_counters().range_rejections, 1);
+            if (! stream.charge_retry(retries)) {
+                break;
+            }
+
+            // tell the producer what happened, and to try again
+            string message = "Invalid range, should be between ";
+            append_value(message, low);
+            message += " and ";
+            append_value(message, high);
+            message += ", try again: ";
+            stream.reply(message);
+        }
+    }
+    co_return nullopt;
+}
+
+template <typename T>
+detached serve_stream(event_loop &loop, int fd, bool replies,
+                      unsigned long id, T low, T high, string kind,
+                      unsigned long &given_up) {
+
+    // PRE:  fd is open, and set to non-blocking, and given_up outlives
+    //       the loop
+    //
+    // POST: every value of the stream that is both a T value and within
+    //       the range of low to high has been written to standard
+    //       output, after id and a tab, until the stream ended, and fd
+    //       has been closed; if a stream that takes no replies was
+    //       given up on, standard error has been told why, and it has
+    //       been counted in given_up
+    //
+    // the arguments are taken by value, so that they live in the
+    // coroutine's frame for as long as it is suspended
+
+    async_stream stream(loop, fd, replies);
+    string prompt = "Enter " + kind + " between ";
+    append_value(prompt, low);
+    prompt += " and ";
+    append_value(prompt, high);
+    prompt += ": ";
+
+    stream.reply(prompt);
+    while (optional<T> value =
+               co_await async_read_validated_in_range(stream, low, high,
+                                                      kind)) {
+        string out = to_string(id) + '\t';
+        append_value(out, *value);
+        out += '\n';
+        cout << out;
+        stream.reply(prompt);
+    }
+
+    // tell the producer if the stream was given up on before it ended,
+    // or standard error if the producer cannot be told
+    if (stream.end_reason() != READ_END_OF_INPUT) {
+        if (replies) {
+            stream.reply(string("\nGiving up: ")
+                         + describe_status(stream.end_reason()) + '\n');
+        } else {
+            cout.flush();
+            cerr << "Stream " << id << ": giving up: "
+                 << describe_status(stream.end_reason()) << endl;
+            ++given_up;
+        }
+    }
+}
+
+template <typename T>
+detached accept_streams(event_loop &loop, int listener,
+                        unsigned long &next_id, T low, T high, string kind,
+                        unsigned long &given_up) {
+
+    // PRE:  listener is a listening socket, set to non-blocking, and
+    //       next_id and given_up outlive the loop
+    //
+    // POST: never returns while the loop runs; every connection made
+    //       to listener is served by a serve_stream() coroutine of its
+    //       own, numbered from next_id on
+
+    bool backing_off = false;   // whether accepting has last failed
+
+    while (true) {
+        co_await loop.wait_readable(listener);
+
+        int fd;
+        while ((fd = accept4(listener, nullptr, nullptr,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+            backing_off = false;
+            serve_stream(loop, fd, true, next_id++, low, high, kind,
+                         given_up);
+        }
+
+        // a connection that could not be accepted for want of a file
+        // descriptor (EMFILE or ENFILE) or of memory stays queued, so
+        // the listener stays readable; rather than try again at once,
+        // and spin, the listener is left alone for a while, to let the
+        // streams being served end and give their descriptors back
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK) &&
+            (errno != EINTR) && (errno != ECONNABORTED)) {
+            if (! backing_off) {
+                cout.flush();
+                cerr << "Cannot accept a connection: " << strerror(errno)
+                     << "; trying again every "
+                     << ACCEPT_RETRY_DELAY.count() << " ms" << endl;
+                backing_off = true;
+            }
+            co_await loop.wait_until(chrono::steady_clock::now()
+                                     + ACCEPT_RETRY_DELAY);
+        }
+    }
+}
+
+template <typename T>
+bool serve_as(const vector<string> &addresses, T low, T high,
+              const string &kind) {
+
+    // PRE:  low is not greater than high
+    //
+    // POST: each of the addresses, which is a TCP port to accept
+    //       connections on, - for standard input, or the path of a
+    //       pipe or file, has been served until none of its streams
+    //       was left, which for a port is never, and true has been
+    //       returned; if one could not be opened, or a stream of a
+    //       pipe or file used up its budget, the reason has been
+    //       written to standard error and false has been returned
+
+    event_loop loop;
+    unsigned long next_id = 1;
+    unsigned long given_up = 0;     // the streams given up on early
+
+    if (loop.descriptor() < 0) {
+        cerr << "Cannot use epoll: " << strerror(errno) << endl;
+        return false;
+    }
+
+    for (const string &address : addresses) {
+        bool port = ! address.empty() &&
+                    all_of(address.begin(), address.end(),
+                           [](char c) { return isdigit((unsigned char) c); });
+
+        if (port) {
+
+            // a port of 0 would have the system pick one at random,
+            // which nobody could then connect to
+            unsigned int number = 0;
+            const char *last = address.data() + address.size();
+            auto [end, failure] = from_chars(address.data(), last, number);
+            if ((failure != errc()) || (end != last) || (number < 1)
+                || (number > 65535)) {
+                cerr << "Invalid port " << address
+                     << ", should be 1 to 65535" << endl;
+                return false;
+            }
+
+            int listener = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK |
+                                  SOCK_CLOEXEC, 0);
+            int on = 1;
+            int off = 0;
+            sockaddr_in6 where = {};
+            where.sin6_family = AF_INET6;
+            where.sin6_port = htons(uint16_t(number));
+            where.sin6_addr = in6addr_any;
+
+            // accept IPv4 connections on the same socket as well
+            if ((listener < 0) ||
+                (setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on,
+                            sizeof(on)) != 0) ||
+                (setsockopt(listener, IPPROTO_IPV6, IPV6_V6ONLY, &off,
+                            sizeof(off)) != 0) ||
+                (bind(listener, (sockaddr *) &where, sizeof(where)) != 0) ||
+                (listen(listener, SOMAXCONN) != 0)) {
+                int error = errno;
+                if (listener >= 0) {
+                    close(listener);
+                }
+                cerr << "Cannot listen on port " << address << ": "
+                     << strerror(error) << endl;
+                return false;
+            }
+            accept_streams(loop, listener, next_id, low, high, kind,
+                           given_up);
+        } else {
+            // standard input is opened again, rather than duplicated,
+            // since a duplicate shares its file description, and with
+            // it the O_NONBLOCK flag, with the shell that started the
+            // program, which would be left non-blocking afterwards
+            const char *path = (address == "-") ? "/dev/stdin"
+                                                : address.c_str();
+            int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+            if (fd < 0) {
+                cerr << "Cannot read " << address << ": "
+                     << strerror(errno) << endl;
+                return false;
+            }
+            serve_stream(loop, fd, false, next_id++, low, high, kind,
+                         given_up);
+        }
+    }
+
+    loop.run();
+    cout.flush();
+    return given_up == 0;
+}
+
+bool serve(const string &type, const vector<string> &addresses) {
+
+    // PRE:  none
+    //
+    // POST: if type names one of the supported data types, the
+    //       addresses have been served as by serve_as(), with the same
+    //       ranges as in batch mode, and whether that succeeded has
+    //       been returned; otherwise the unknown type has been written
+    //       to standard error and false has been returned
+
+    if (type == "int") {
+        return serve_as(addresses, int_demo_low, int_demo_high,
+                        string("a whole number"));
+    }
+    if (type == "float") {
+        return serve_as(addresses, float_demo_low, float_demo_high,
+                        string("a fractional number"));
+    }
+    if (type == "element") {
+        return serve_as(addresses, element_demo_low, element_demo_high,
+                        string("an element"));
+    }
+    if (type == "long") {
+        return serve_as(addresses, element_traits<long int>::LOW,
+                        element_traits<long int>::HIGH,
+                        string("a ") + element_traits<long int>::NAME);
+    }
+    if (type == "double") {
+        return serve_as(addresses, element_traits<double>::LOW,
+                        element_traits<double>::HIGH,
+                        string("a ") + element_traits<double>::NAME);
+    }
+    if (type == "char") {
+        return serve_as(addresses, element_traits<char>::LOW,
+                        element_traits<char>::HIGH,
+                        string("a ") + element_traits<char>::NAME);
+    }
+    if (type == "bool") {
+        return serve_as(addresses, element_traits<bool>::LOW,
+                        element_traits<bool>::HIGH,
+                        string("a ") + element_traits<bool>::NAME);
+    }
+    if (type == "string") {
+        return serve_as(addresses, string(element_traits<string>::LOW),
+                        string(element_traits<string>::HIGH),
+                        string("a ") + element_traits<string>::NAME);
+    }
+    cerr << "Unknown serve type " << type
+         << ", should be int, long, float, double, char, bool, string, "
+         << "or element" << endl;
+    return false;
+}
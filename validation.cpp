@@ -0,0 +1,4892 @@
+/*
+
+validation.cpp
+
+The parsing engine and the batch validators declared in
+validation_engine.h, and the library interface of validation.h built
+on them. The program in main.cpp is this file linked together with its
+own main(); the library is this file alone (see the README).
+
+*/
+
+
+//////////////////////////////////////////////////////////////////////
+
+
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <shared_mutex>
+#include <system_error>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "validation_engine.h"
+
+namespace validation {
+
+// this file is written, like main.cpp, with the names of the standard
+// library unqualified; validation_engine.h qualifies them, so that its
+// users are left to choose for themselves
+using namespace std;
+
+
+// the declarations of the helpers of the engine and the batch mode
+// that nothing outside this file uses, which are kept out of
+// validation_engine.h and given internal linkage, so that a program
+// linking the library in sees only the names it declares
+
+// the finalizer whose bits the hash functions of the perfect hash
+// tables, the record hashes of the outcome cache, and the fingerprints
+// of its checks are all mixed with
+
+static uint64_t mix_hash(uint64_t h);
+
+template <typename T>
+static bool parse_members(const vector<string> &texts,
+                          allowed_set<T> &allowed);
+
+// it returns the number of characters in the range from first up to
+// (but not including) last that match delim
+
+static size_t count_delimiters(const char *first, const char *last,
+                               char delim);
+
+// it returns a pointer to the first character in the range from first
+// up to (but not including) last that matches either delim or other,
+// or last if there is none
+
+static const char *find_either_delimiter(const char *first, const char *last,
+                                         char delim, char other);
+
+// prototypes for the range-check kernel, which uses AVX2 or SSE2
+// instructions for int, float, and double values, whichever the
+// program is compiled for, to check many values at a time
+//
+// for each of the count values, bit (i % 64) of bitmap[i / 64] is set
+// if values[i] is within the range of low to high, and cleared if it
+// is not
+
+template <typename T>
+static void range_check(const T *values, size_t count, T low, T high,
+                        uint64_t *bitmap);
+
+static void range_check(const int *values, size_t count, int low, int high,
+                        uint64_t *bitmap);
+
+static void range_check(const float *values, size_t count, float low,
+                        float high, uint64_t *bitmap);
+
+static void range_check(const double *values, size_t count, double low,
+                        double high, uint64_t *bitmap);
+
+static void range_check(const string_view *values, size_t count,
+                        string_view low, string_view high, uint64_t *bitmap);
+
+
+// the flag kernels, which validate runs of records that each hold
+// nothing but a single char or bool value, such as the flag and code
+// columns that make up much of a typical input, many records at a time
+// instead of parsing them one by one
+//
+// a flag_table tells which of those records are accepted: the record
+// made up of the character c alone if accepts[c] is true, and the
+// records "true" and "false" if accepts_true and accepts_false are;
+// if the characters accepted are exactly those from low up to high,
+// interval is true, which lets them be checked many at a time
+
+namespace {
+
+struct flag_table {
+    bool accepts[256];
+    bool interval;
+    unsigned char low;
+    unsigned char high;
+    bool accepts_true;
+    bool accepts_false;
+};
+
+}   // namespace
+
+// make_flag_table() returns the flag_table of a char or bool column
+// whose values must be within the range of low to high, and for which
+// allow(value) is true
+
+template <typename T, typename Allow>
+static flag_table make_flag_table(T low, T high, Allow allow);
+
+// each run function returns a pointer just past the longest run of
+// accepted records, each ended by a newline, that starts at first, and
+// adds the number of records in the run to count; accept_char_run()
+// uses AVX2 or SSE2 instructions, whichever the program is compiled
+// for, when the table is an interval, and accept_bool_run() compares
+// eight characters at a time as one 64-bit word
+
+static const char *accept_char_run(const char *first, const char *last,
+                                   const flag_table &table, size_t &count);
+
+static const char *accept_bool_run(const char *first, const char *last,
+                                   const flag_table &table, size_t &count);
+
+// the number of records type-checked before each range check of the
+// batch mode, which must be a multiple of 64
+const size_t BATCH_SIZE = 4096;
+
+// the number of characters of input that the batch mode validates at
+// a time, split between its threads
+const size_t BLOCK_SIZE = 16 << 20;
+
+// the number of characters in each of the small chunks that a block
+// is split into when idle threads may steal chunks from busy ones
+const size_t STEAL_CHUNK_SIZE = 64 << 10;
+
+// the number of blocks that the stages of the batch mode (reading,
+// validating, and writing) can be working on at once, which is one for
+// each of them and one more, so that reading can stay a block ahead
+const size_t PIPELINE_DEPTH = 4;
+
+namespace {
+
+// the table of built-in data types that rules may be made for, each
+// with the function that makes a rule of that data type from the text
+// of its bounds, if any are given (if not, the range the batch mode
+// uses for the data type is used), and of its allowed values, if any
+//
+// the table is only searched while a rule is being made, once per
+// rule; the rule that is made calls a validator specialized for its
+// data type directly, so validating a record never looks at the table
+struct rule_maker {
+    const char *type;
+    bool (*make)(const string &name, const string &type,
+                 const vector<string> &bounds,
+                 const vector<string> &members, loaded_rule &rule);
+};
+
+// the header at the start of a columnar output file
+//
+// the file holds one value for every non-blank record, in the order
+// they were read, as length packed little-endian values of width bytes
+// each, starting at values_offset, followed by a validity bitmap of
+// length bits starting at validity_offset, in which bit (i % 8) of
+// byte (i / 8) is set if value i was accepted; the value of a record
+// that was rejected is left undefined
+//
+// both buffers start on a 64-byte boundary and are padded with zeros
+// to a multiple of 64 bytes, which is the layout that Apache Arrow
+// uses for a primitive array, so the file can be mapped into memory
+// and its buffers handed to Arrow without being copied
+struct column_header {
+    char magic[8];              // "CDVCOL1" followed by a null
+    uint32_t type;              // a column_type
+    uint32_t width;             // the size of each value, in bytes
+    uint64_t length;            // the number of values
+    uint64_t null_count;        // the number of rejected values
+    uint64_t values_offset;
+    uint64_t validity_offset;
+    uint64_t reserved[2];
+};
+
+}   // namespace
+
+template <typename T>
+static constexpr column_type column_type_of();
+
+static void append_bits(vector<uint64_t> &bits, uint64_t &size,
+                        const uint64_t *source, size_t count);
+
+// a column file is little-endian whatever the host, so on a big-endian
+// host, little_endian() byte-swaps a value of the header, and
+// make_little_endian() each value of width bytes, 4 or 8, from first
+// up to last, on their way out; on a little-endian host, where the
+// bytes are already in order, both leave them as they are
+
+template <typename T>
+static T little_endian(T value);
+
+static void make_little_endian(char *first, char *last, uint32_t width);
+
+// the version of the cache file, which must be changed whenever the
+// parsers change what they accept or reject, or the values they give,
+// or the fingerprints of the checks are worked out differently, so
+// that the entries of an older build are not used
+const uint32_t VALIDATION_CACHE_VERSION = 5;
+
+namespace {
+
+// the header at the start of a cache file
+struct cache_header {
+    char magic[8];              // "CDVCACH" followed by a null
+    uint32_t version;           // VALIDATION_CACHE_VERSION
+    uint32_t reserved0;
+    uint64_t slot_count;        // a power of two
+    uint64_t reserved[5];
+};
+
+}   // namespace
+
+static uint64_t hash_record(const char *first, const char *last,
+                            uint64_t seed);
+
+template <typename T>
+static uint64_t check_fingerprint(T low, T high, const char *parser);
+
+template <typename T>
+static uint64_t encode_cached(const T &value, const char *record);
+
+template <typename T>
+static bool decode_cached(uint64_t payload, const char *first,
+                          const char *last, T &value);
+
+template <typename T, typename Parse>
+static validation_outcome parse_with_cache(validation_cache &cache,
+                                           const char *first, const char *last,
+                                           uint64_t key, Parse parse, T &value,
+                                           uint64_t &hits, uint64_t &misses);
+
+// parse_cpu_list() and pin_thread(), which the functions declared
+// with the topology in validation_engine.h are built on
+
+static bool parse_cpu_list(const string &text, vector<unsigned int> &cpus);
+
+static bool pin_thread(unsigned int cpu);
+
+namespace {
+
+// a fixed set of threads that are handed batches of tasks together
+//
+// if cpus is given, it holds a processor for each thread, which the
+// thread is pinned to for as long as the pool lasts; the thread that
+// creates the pool is pinned to the first one
+class thread_pool {
+public:
+    explicit thread_pool(unsigned int threads,
+                         const vector<unsigned int> &cpus = {});
+    ~thread_pool();
+
+    // POST: task(i) has been called once for every i from 0 to
+    //       count - 1, with task(i) running on thread (i % threads)
+    //
+    // if a task throws, the rest of that thread's share is skipped,
+    // but the call still waits for every other thread to finish, and
+    // then passes the first exception thrown on
+    void run(size_t count, const function<void(size_t)> &task);
+
+    // POST: task(i) has been called once for every i from 0 to
+    //       count - 1, with each thread starting on its own
+    //       contiguous share of them, and any thread that runs out of
+    //       work stealing half of what is left of another's share
+    void run_stealing(size_t count, const function<void(size_t)> &task);
+
+    unsigned int size() const { return workers.size() + 1; }
+
+private:
+    // the tasks still to be run from one thread's share of a batch
+    struct alignas(64) task_range {
+        mutex lock;
+        size_t next;                // the first task not yet taken
+        size_t end;                 // just past the last task
+    };
+
+    void run_on_all(const function<void(unsigned int)> &body);
+    void work(unsigned int index);
+
+    vector<thread> workers;
+    vector<task_range> ranges;
+    vector<unsigned int> cpus;
+    void stop();
+
+    cpu_set_t original_cpus;        // where the creating thread could
+                                    // run before it was pinned
+    bool placed;                    // whether it has been pinned yet
+    bool pinned;
+    mutex lock;
+    condition_variable started;     // signals that a batch is ready
+    condition_variable finished;    // signals that a worker is done
+    const function<void(unsigned int)> *current_body;
+    unsigned long generation;       // counts the batches started
+    unsigned int busy;              // the workers still running
+    exception_ptr failure;          // the first exception a worker's
+                                    // share of the batch threw, if any
+    bool stopping;
+};
+
+// a bounded queue that passes values from one thread, the producer, to
+// one other, the consumer, without a lock: only the producer moves
+// tail and only the consumer moves head, so each slot is written
+// before it is published and read before it is handed back
+//
+// a push into a full queue waits for the consumer, and a pop from an
+// empty one waits for the producer, which is what holds a stage back
+// when the stage after it falls behind; the waits are C++20 atomic
+// waits, which sleep rather than spin
+template <typename T>
+class spsc_queue {
+public:
+    explicit spsc_queue(size_t capacity);
+
+    // PRE:  only one thread pushes
+    //
+    // POST: value has been added at the back, once there was room
+    void push(T value);
+
+    // PRE:  only one thread pops
+    //
+    // POST: the value at the front has been removed and returned, once
+    //       there was one
+    T pop();
+
+private:
+    vector<T> slots;
+    alignas(64) atomic<size_t> head;    // the number of values popped
+    alignas(64) atomic<size_t> tail;    // the number of values pushed
+};
+
+// one block of records on its way through the stages of the batch
+// mode, with the buffers each stage fills, which are kept from one
+// block to the next
+struct pipeline_batch {
+    string input;               // a copy of the block, if its source
+                                // does not keep it
+    const char *first = nullptr;    // the records of the block
+    const char *last = nullptr;
+    vector<const char *> bounds;    // where each chunk starts
+    vector<chunk_result> results;   // the outcome of each chunk
+};
+
+}   // namespace
+
+template <typename T, typename Parse, typename Allow>
+static void validate_column(const char *first, const char *last, T low, T high,
+                            const char *parser, Parse parse, Allow allow,
+                            const batch_options &options,
+                            chunk_result &result);
+
+template <typename T>
+static void validate_records(const char *first, const char *last, T low,
+                             T high, const batch_options &options,
+                             chunk_result &result);
+
+template <auto Rule>
+static void validate_records_by_rule(const char *first, const char *last,
+                                     const batch_options &options,
+                                     chunk_result &result);
+
+template <typename Validate>
+static void batch_records(input_source &source, const batch_options &options,
+                          Validate validate);
+
+template <typename T>
+static void batch_type_and_range_checking(input_source &source,
+                                          const batch_options &options,
+                                          T low = T(element_traits<T>::LOW),
+                                          T high = T(element_traits<T>::HIGH));
+
+template <typename T, typename Member>
+static void validate_records_in_set(const char *first, const char *last, T low,
+                                    T high, const allowed_set<Member> &allowed,
+                                    const batch_options &options,
+                                    chunk_result &result);
+
+template <typename T, typename Member>
+static void batch_in_set(input_source &source, const batch_options &options,
+                         T low, T high, const allowed_set<Member> &allowed);
+
+template <auto Rule>
+static void batch_by_rule(input_source &source, const batch_options &options);
+
+template <typename T>
+static void batch_elements(input_source &source, const batch_options &options);
+
+template <typename T>
+static bool parse_bounds(const vector<string> &bounds, T &low, T &high);
+
+template <typename T>
+static void make_field_rule(const string &type, T low, T high,
+                            field_rule &rule,
+                            shared_ptr<const allowed_set<T>> allowed = {});
+
+template <typename T>
+static bool make_loaded_rule(const string &name, const string &type, T low,
+                             T high, const vector<string> &bounds,
+                             const vector<string> &members, loaded_rule &rule);
+
+template <auto Rule>
+static bool make_rule_by(const string &name, const string &type,
+                         const vector<string> &bounds,
+                         const vector<string> &members, loaded_rule &rule);
+
+static bool make_string_rule(const string &name, const string &type,
+                             const vector<string> &bounds,
+                             const vector<string> &members, loaded_rule &rule);
+
+static bool make_element_rule(const string &name, const string &type,
+                              const vector<string> &bounds,
+                              const vector<string> &members,
+                              loaded_rule &rule);
+
+template <typename T>
+static void set_demo_range(const string &name, T low, T high,
+                           const allowed_set<T> *allowed = nullptr);
+
+static bool make_rule(const string &name, const string &spec,
+                      loaded_rule &rule);
+
+static bool parse_field_rule(const string &spec, field_rule &rule);
+
+static void validate_fields(const char *first, const char *last,
+                            const batch_options &options,
+                            chunk_result &result);
+
+static void batch_fields(input_source &source, const batch_options &options);
+
+
+//////////////////////////////////////////////////////////////////////
+
+
+// the characters treated as whitespace by cin >> in the "C" locale
+const char WHITESPACE[] = " \t\n\v\f\r";
+
+bool is_whitespace(char c) {
+
+    // PRE:  none
+    //
+    // POST: true has been returned if c is one of the WHITESPACE
+    //       characters, and false otherwise
+
+    // apart from the space, the WHITESPACE characters are the
+    // consecutive character codes from '\t' to '\r', so two
+    // comparisons find them without searching WHITESPACE itself
+    return (c == ' ') || ((c >= '\t') && (c <= '\r'));
+}
+
+const char *skip_whitespace(const char *first, const char *last) {
+
+    // PRE:  first and last delimit a range of characters
+    //
+    // POST: a pointer to the first non-whitespace character in the
+    //       range has been returned, or last if there is none
+
+    while ((first != last) && is_whitespace(*first)) {
+        ++first;
+    }
+    return first;
+}
+
+thread_local bool strict_tokens = false;
+
+bool ends_token(const char *end, const char *last) {
+
+    // PRE:  end and last delimit a range of characters
+    //
+    // POST: see the prototype
+
+    return ! strict_tokens || (skip_whitespace(end, last) == last);
+}
+
+template <typename T>
+static const char *parse_whole_number(const char *first, const char *last,
+                                      T &value) {
+
+    // PRE:  first and last delimit a range of characters
+    //
+    // POST: if the range begins with an optionally signed whole number
+    //       that fits in a T, it has been stored in value and a
+    //       pointer just past it returned; otherwise a null pointer
+    //       has been returned
+
+    const char *digits = skip_whitespace(first, last);
+
+    // from_chars() does not accept a leading plus sign, but cin >>
+    // does, so step over one here
+    if ((digits != last) && (*digits == '+')) {
+        ++digits;
+        if ((digits != last) && (*digits == '-')) {
+            return nullptr;
+        }
+    }
+
+    // a value that does not fit in a T is a failure, just as it is
+    // for cin >>
+    T candidate;
+    from_chars_result result = from_chars(digits, last, candidate);
+    if ((result.ec != errc()) || ! ends_token(result.ptr, last)) {
+        return nullptr;
+    }
+    value = candidate;
+    return result.ptr;
+}
+
+// the powers of ten that a float and a double can hold exactly
+const float FLOAT_POWERS_OF_TEN[] = {
+    1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+};
+const double DOUBLE_POWERS_OF_TEN[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+template <typename T>
+static const char *parse_fractional_number(const char *first, const char *last,
+                                           T &value) {
+
+    // PRE:  first and last delimit a range of characters
+    //
+    // POST: if the range begins with an optionally signed fractional
+    //       number that fits in a T, and that is followed by
+    //       whitespace or by the end of the range, the correctly
+    //       rounded value of the number has been stored in value and a
+    //       pointer just past it returned; otherwise a null pointer
+    //       has been returned
+
+    const char *digits = skip_whitespace(first, last);
+
+    // from_chars() does not accept a leading plus sign, but cin >>
+    // does, so step over one here
+    if ((digits != last) && (*digits == '+')) {
+        ++digits;
+        if ((digits != last) && (*digits == '-')) {
+            return nullptr;
+        }
+    }
+
+    // scan the number: its digits, with at most one decimal point
+    // among them, and then an optional exponent, adding up the
+    // significant digits as a whole number while there are no more
+    // than 19 of them, which is as many as a uint64_t can always hold
+    //
+    // insisting on a digit here also rejects "inf" and "nan", which
+    // from_chars() accepts but cin >> does not
+    const char *next = digits;
+    bool negative = false;
+    if ((next != last) && (*next == '-')) {
+        negative = true;
+        ++next;
+    }
+
+    uint64_t mantissa = 0;
+    int significant = 0;        // the significant digits added up
+    int exponent = 0;           // the power of ten to scale them by
+    bool any_digits = false;
+    bool truncated = false;     // whether a nonzero digit was left out
+
+    for (bool point = false; next != last; ++next) {
+        if ((*next >= '0') && (*next <= '9')) {
+            any_digits = true;
+            if (significant < 19) {
+                mantissa = mantissa * 10 + (*next - '0');
+                significant += (mantissa != 0);
+                exponent -= point;
+            } else {
+                truncated = truncated || (*next != '0');
+                exponent += ! point;
+            }
+        } else if ((*next == '.') && ! point) {
+            point = true;
+        } else {
+            break;
+        }
+    }
+    if (! any_digits) {
+        return nullptr;
+    }
+
+    // an exponent is only part of the number if it has digits, just as
+    // for cin >>; its value is capped well beyond the range of a
+    // double, since any larger one fails the same way
+    if ((next != last) && ((*next == 'e') || (*next == 'E'))) {
+        const char *power = next + 1;
+        bool negative_power = false;
+        if ((power != last) && ((*power == '+') || (*power == '-'))) {
+            negative_power = (*power == '-');
+            ++power;
+        }
+        if ((power != last) && (*power >= '0') && (*power <= '9')) {
+            int magnitude = 0;
+            for (; (power != last) && (*power >= '0') && (*power <= '9');
+                 ++power) {
+                magnitude = min(magnitude * 10 + (*power - '0'), 100000);
+            }
+            exponent += negative_power ? -magnitude : magnitude;
+            next = power;
+        }
+    }
+
+    // the number must make up the whole of its token, so that an input
+    // such as "1.2.3" or "4.5kg" is rejected instead of being taken as
+    // 1.2 or 4.5
+    if (((next != last) && ! is_whitespace(*next))
+        || ! ends_token(next, last)) {
+        return nullptr;
+    }
+
+    // if the significant digits and the power of ten are both exact in
+    // a T, one multiplication or division of the two gives the
+    // correctly rounded value, since IEEE arithmetic rounds the exact
+    // result of each operation (this is Clinger's fast path)
+    const uint64_t EXACT_MANTISSA = uint64_t(1)
+                                    << numeric_limits<T>::digits;
+    const int EXACT_POWER = is_same_v<T, float> ? 10 : 22;
+    if (! truncated && (mantissa <= EXACT_MANTISSA)
+        && (exponent >= -EXACT_POWER) && (exponent <= EXACT_POWER)) {
+        T scale;
+        if constexpr (is_same_v<T, float>) {
+            scale = FLOAT_POWERS_OF_TEN[abs(exponent)];
+        } else {
+            scale = DOUBLE_POWERS_OF_TEN[abs(exponent)];
+        }
+        T magnitude = T(mantissa);
+        magnitude = (exponent < 0) ? magnitude / scale : magnitude * scale;
+        value = negative ? -magnitude : magnitude;
+        return next;
+    }
+
+    // any other number, such as one with many digits or a large
+    // exponent, is left to from_chars(), which also rounds correctly
+    // (libstdc++ uses the Eisel-Lemire algorithm for it); a value too
+    // large for a T is a failure, just as it is for cin >>, but one too
+    // small is taken as zero, as cin >> takes it, which from_chars()
+    // reports as out of range too, so the two are told apart by the
+    // power of ten of the first significant digit
+    from_chars_result result = from_chars(digits, next, value);
+    if ((result.ec == errc::result_out_of_range) && (result.ptr == next)
+        && (exponent + significant <= 0)) {
+        value = negative ? -T(0) : T(0);
+        return next;
+    }
+    if ((result.ec != errc()) || (result.ptr != next)) {
+        return nullptr;
+    }
+    return next;
+}
+
+const char *parse_value(const char *first, const char *last, int &value) {
+
+    // PRE:  first and last delimit a range of characters
+    //
+    // POST: see the prototype
+
+    return parse_whole_number(first, last, value);
+}
+
+const char *parse_value(const char *first, const char *last,
+                        long int &value) {
+
+    // PRE:  first and last delimit a range of characters
+    //
+    // POST: see the prototype
+
+    return parse_whole_number(first, last, value);
+}
+
+const char *parse_value(const char *first, const char *last,
+                        float &value) {
+
+    // PRE:  first and last delimit a range of characters
+    //
+    // POST: see the prototype
+
+    return parse_fractional_number(first, last, value);
+}
+
+const char *parse_value(const char *first, const char *last,
+                        double &value) {
+
+    // PRE:  first and last delimit a range of characters
+    //
+    // POST: see the prototype
+
+    return parse_fractional_number(first, last, value);
+}
+
+const char *parse_value(const char *first, const char *last, char &value) {
+
+    // PRE:  first and last delimit a range of characters
+    //
+    // POST: see the prototype; any single non-whitespace character is
+    //       a valid char
+
+    first = skip_whitespace(first, last);
+    if ((first == last) || ! ends_token(first + 1, last)) {
+        return nullptr;
+    }
+    value = *first;
+    return first + 1;
+}
+
+const char *parse_value(const char *first, const char *last, bool &value) {
+
+    // PRE:  first and last delimit a range of characters
+    //
+    // POST: see the prototype; only the keystroke sequences "true" and
+    //       "false" are valid bools, as with cin's boolalpha
+    //       manipulator
+
+    first = skip_whitespace(first, last);
+    if ((last - first >= 4) && (memcmp(first, "true", 4) == 0)
+        && ends_token(first + 4, last)) {
+        value = true;
+        return first + 4;
+    }
+    if ((last - first >= 5) && (memcmp(first, "false", 5) == 0)
+        && ends_token(first + 5, last)) {
+        value = false;
+        return first + 5;
+    }
+    return nullptr;
+}
+
+const char *parse_value(const char *first, const char *last,
+                        string &value) {
+
+    // PRE:  first and last delimit a range of characters
+    //
+    // POST: see the prototype; a string is the run of non-whitespace
+    //       characters that follows any leading whitespace
+
+    string_view token;
+    const char *end = parse_value(first, last, token);
+
+    // the characters are only copied once they are known to make up a
+    // string, and into whatever room value already has
+    if (end != nullptr) {
+        value.assign(token);
+    }
+    return end;
+}
+
+const char *parse_value(const char *first, const char *last,
+                        string_view &value) {
+
+    // PRE:  first and last delimit a range of characters
+    //
+    // POST: see the prototype; value refers to the characters in place,
+    //       so it is only valid for as long as they are
+
+    first = skip_whitespace(first, last);
+    const char *end = first;
+    while ((end != last) && (! is_whitespace(*end))) {
+        ++end;
+    }
+    if ((end == first) || ! ends_token(end, last)) {
+        return nullptr;
+    }
+    value = string_view(first, end - first);
+    return end;
+}
+
+
+
+
+const char *find_delimiter(const char *first, const char *last,
+                           char delim) {
+
+    // PRE:  first and last delimit a range of characters
+    //
+    // POST: see the prototype
+
+#if defined(__AVX2__)
+    // compare 32 characters at a time
+    const __m256i wide_pattern = _mm256_set1_epi8(delim);
+    while (last - first >= 32) {
+        __m256i block = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(first));
+        unsigned int mask = _mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(block, wide_pattern));
+        if (mask != 0) {
+            return first + __builtin_ctz(mask);
+        }
+        first += 32;
+    }
+#endif
+
+#if defined(__SSE2__)
+    // compare 16 characters at a time
+    const __m128i pattern = _mm_set1_epi8(delim);
+    while (last - first >= 16) {
+        __m128i block = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(first));
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, pattern));
+        if (mask != 0) {
+            return first + __builtin_ctz(mask);
+        }
+        first += 16;
+    }
+#elif defined(__ARM_NEON)
+    // compare 16 characters at a time, narrowing the result to four
+    // bits per character so that it fits in a 64-bit mask
+    const uint8x16_t pattern = vdupq_n_u8(static_cast<uint8_t>(delim));
+    while (last - first >= 16) {
+        uint8x16_t block = vld1q_u8(reinterpret_cast<const uint8_t *>(first));
+        uint8x16_t matches = vceqq_u8(block, pattern);
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(
+            vshrn_n_u16(vreinterpretq_u16_u8(matches), 4)), 0);
+        if (mask != 0) {
+            return first + (__builtin_ctzll(mask) >> 2);
+        }
+        first += 16;
+    }
+#endif
+
+    // compare the last few characters one at a time
+    while ((first != last) && (*first != delim)) {
+        ++first;
+    }
+    return first;
+}
+
+static size_t count_delimiters(const char *first, const char *last,
+                               char delim) {
+
+    // PRE:  first and last delimit a range of characters
+    //
+    // POST: see the prototype
+
+    size_t count = 0;
+
+#if defined(__AVX2__)
+    // count 32 characters at a time
+    const __m256i wide_pattern = _mm256_set1_epi8(delim);
+    while (last - first >= 32) {
+        __m256i block = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(first));
+        count += __builtin_popcount(_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(block, wide_pattern)));
+        first += 32;
+    }
+#endif
+
+#if defined(__SSE2__)
+    // count 16 characters at a time
+    const __m128i pattern = _mm_set1_epi8(delim);
+    while (last - first >= 16) {
+        __m128i block = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(first));
+        count += __builtin_popcount(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(block, pattern)));
+        first += 16;
+    }
+#endif
+
+    // count the last few characters (or, without SSE2, all of them)
+    // one at a time
+    for (; first != last; ++first) {
+        count += (*first == delim);
+    }
+    return count;
+}
+
+static const char *find_either_delimiter(const char *first, const char *last,
+                                         char delim, char other) {
+
+    // PRE:  first and last delimit a range of characters
+    //
+    // POST: see the prototype
+
+#if defined(__AVX2__)
+    // compare 32 characters at a time against both delimiters
+    const __m256i wide_pattern = _mm256_set1_epi8(delim);
+    const __m256i wide_other = _mm256_set1_epi8(other);
+    while (last - first >= 32) {
+        __m256i block = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(first));
+        unsigned int mask = _mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(block, wide_pattern),
+                            _mm256_cmpeq_epi8(block, wide_other)));
+        if (mask != 0) {
+            return first + __builtin_ctz(mask);
+        }
+        first += 32;
+    }
+#endif
+
+#if defined(__SSE2__)
+    // compare 16 characters at a time against both delimiters
+    const __m128i pattern = _mm_set1_epi8(delim);
+    const __m128i other_pattern = _mm_set1_epi8(other);
+    while (last - first >= 16) {
+        __m128i block = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(first));
+        unsigned int mask = _mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(block, pattern),
+                         _mm_cmpeq_epi8(block, other_pattern)));
+        if (mask != 0) {
+            return first + __builtin_ctz(mask);
+        }
+        first += 16;
+    }
+#elif defined(__ARM_NEON)
+    // compare 16 characters at a time against both delimiters,
+    // narrowing the result as find_delimiter() does
+    const uint8x16_t pattern = vdupq_n_u8(static_cast<uint8_t>(delim));
+    const uint8x16_t other_pattern = vdupq_n_u8(static_cast<uint8_t>(other));
+    while (last - first >= 16) {
+        uint8x16_t block = vld1q_u8(reinterpret_cast<const uint8_t *>(first));
+        uint8x16_t matches = vorrq_u8(vceqq_u8(block, pattern),
+                                      vceqq_u8(block, other_pattern));
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(
+            vshrn_n_u16(vreinterpretq_u16_u8(matches), 4)), 0);
+        if (mask != 0) {
+            return first + (__builtin_ctzll(mask) >> 2);
+        }
+        first += 16;
+    }
+#endif
+
+    // compare the last few characters one at a time
+    while ((first != last) && (*first != delim) && (*first != other)) {
+        ++first;
+    }
+    return first;
+}
+
+
+template <typename T>
+static void range_check(const T *values, size_t count, T low, T high,
+                        uint64_t *bitmap) {
+
+    // PRE:  values holds count values, and bitmap has room for count
+    //       bits
+    //
+    // POST: see the prototype
+
+    fill(bitmap, bitmap + (count + 63) / 64, 0);
+    for (size_t i = 0; i < count; ++i) {
+        bool valid = ! ((values[i] < low) || (values[i] > high));
+        bitmap[i / 64] |= uint64_t(valid) << (i % 64);
+    }
+}
+
+static void range_check(const int *values, size_t count, int low, int high,
+                        uint64_t *bitmap) {
+
+    // PRE:  values holds count values, and bitmap has room for count
+    //       bits
+    //
+    // POST: see the prototype
+
+    size_t i = 0;
+    fill(bitmap, bitmap + (count + 63) / 64, 0);
+
+    // each group of lanes starts at a multiple of the number of
+    // lanes, which divides 64, so its bits never straddle two words
+    // of the bitmap
+#if defined(__AVX2__)
+    const __m256i wide_low = _mm256_set1_epi32(low);
+    const __m256i wide_high = _mm256_set1_epi32(high);
+    for (; i + 8 <= count; i += 8) {
+        __m256i block = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(values + i));
+        __m256i outside = _mm256_or_si256(
+            _mm256_cmpgt_epi32(wide_low, block),
+            _mm256_cmpgt_epi32(block, wide_high));
+        uint64_t inside = ~_mm256_movemask_ps(_mm256_castsi256_ps(outside))
+                          & 0xFF;
+        bitmap[i / 64] |= inside << (i % 64);
+    }
+#elif defined(__SSE2__)
+    const __m128i narrow_low = _mm_set1_epi32(low);
+    const __m128i narrow_high = _mm_set1_epi32(high);
+    for (; i + 4 <= count; i += 4) {
+        __m128i block = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(values + i));
+        __m128i outside = _mm_or_si128(_mm_cmplt_epi32(block, narrow_low),
+                                       _mm_cmpgt_epi32(block, narrow_high));
+        uint64_t inside = ~_mm_movemask_ps(_mm_castsi128_ps(outside)) & 0xF;
+        bitmap[i / 64] |= inside << (i % 64);
+    }
+#endif
+
+    // check the last few values one at a time
+    for (; i < count; ++i) {
+        bool valid = ! ((values[i] < low) || (values[i] > high));
+        bitmap[i / 64] |= uint64_t(valid) << (i % 64);
+    }
+}
+
+static void range_check(const float *values, size_t count, float low,
+                        float high, uint64_t *bitmap) {
+
+    // PRE:  values holds count values, and bitmap has room for count
+    //       bits
+    //
+    // POST: see the prototype
+
+    size_t i = 0;
+    fill(bitmap, bitmap + (count + 63) / 64, 0);
+
+#if defined(__AVX2__)
+    const __m256 wide_low = _mm256_set1_ps(low);
+    const __m256 wide_high = _mm256_set1_ps(high);
+    for (; i + 8 <= count; i += 8) {
+        __m256 block = _mm256_loadu_ps(values + i);
+        __m256 inside = _mm256_and_ps(
+            _mm256_cmp_ps(block, wide_low, _CMP_GE_OQ),
+            _mm256_cmp_ps(block, wide_high, _CMP_LE_OQ));
+        bitmap[i / 64] |= uint64_t(_mm256_movemask_ps(inside)) << (i % 64);
+    }
+#elif defined(__SSE2__)
+    const __m128 narrow_low = _mm_set1_ps(low);
+    const __m128 narrow_high = _mm_set1_ps(high);
+    for (; i + 4 <= count; i += 4) {
+        __m128 block = _mm_loadu_ps(values + i);
+        __m128 inside = _mm_and_ps(_mm_cmpge_ps(block, narrow_low),
+                                   _mm_cmple_ps(block, narrow_high));
+        bitmap[i / 64] |= uint64_t(_mm_movemask_ps(inside)) << (i % 64);
+    }
+#endif
+
+    // check the last few values one at a time
+    for (; i < count; ++i) {
+        bool valid = ! ((values[i] < low) || (values[i] > high));
+        bitmap[i / 64] |= uint64_t(valid) << (i % 64);
+    }
+}
+
+static void range_check(const double *values, size_t count, double low,
+                        double high, uint64_t *bitmap) {
+
+    // PRE:  values holds count values, and bitmap has room for count
+    //       bits
+    //
+    // POST: see the prototype
+
+    size_t i = 0;
+    fill(bitmap, bitmap + (count + 63) / 64, 0);
+
+#if defined(__AVX2__)
+    const __m256d wide_low = _mm256_set1_pd(low);
+    const __m256d wide_high = _mm256_set1_pd(high);
+    for (; i + 4 <= count; i += 4) {
+        __m256d block = _mm256_loadu_pd(values + i);
+        __m256d inside = _mm256_and_pd(
+            _mm256_cmp_pd(block, wide_low, _CMP_GE_OQ),
+            _mm256_cmp_pd(block, wide_high, _CMP_LE_OQ));
+        bitmap[i / 64] |= uint64_t(_mm256_movemask_pd(inside)) << (i % 64);
+    }
+#elif defined(__SSE2__)
+    const __m128d narrow_low = _mm_set1_pd(low);
+    const __m128d narrow_high = _mm_set1_pd(high);
+    for (; i + 2 <= count; i += 2) {
+        __m128d block = _mm_loadu_pd(values + i);
+        __m128d inside = _mm_and_pd(_mm_cmpge_pd(block, narrow_low),
+                                    _mm_cmple_pd(block, narrow_high));
+        bitmap[i / 64] |= uint64_t(_mm_movemask_pd(inside)) << (i % 64);
+    }
+#endif
+
+    // check the last few values one at a time
+    for (; i < count; ++i) {
+        bool valid = ! ((values[i] < low) || (values[i] > high));
+        bitmap[i / 64] |= uint64_t(valid) << (i % 64);
+    }
+}
+
+static void range_check(const string_view *values, size_t count,
+                        string_view low, string_view high, uint64_t *bitmap) {
+
+    // PRE:  values holds count values, and bitmap has room for count
+    //       bits
+    //
+    // POST: see the prototype
+
+    fill(bitmap, bitmap + (count + 63) / 64, 0);
+
+    // strings compare as unsigned characters, so a string whose first
+    // character falls strictly between the first characters of low and
+    // high is within the range without comparing any more of it; only
+    // the rest need a full comparison
+    unsigned int low_first = low.empty() ? 0 : (unsigned char) low[0];
+    unsigned int high_first = high.empty() ? 0 : (unsigned char) high[0];
+
+    for (size_t i = 0; i < count; ++i) {
+        const string_view &value = values[i];
+        unsigned int first = value.empty() ? 0 : (unsigned char) value[0];
+        bool valid = (! value.empty() && ! low.empty()
+                      && (first > low_first) && (first < high_first))
+                     || ! ((value < low) || (value > high));
+        bitmap[i / 64] |= uint64_t(valid) << (i % 64);
+    }
+}
+
+
+template <typename T, typename Allow>
+static flag_table make_flag_table(T low, T high, Allow allow) {
+
+    // PRE:  T is char or bool
+    //
+    // POST: see the prototype
+
+    flag_table table = {};
+
+    if constexpr (is_same_v<T, char>) {
+        int first = -1;
+        int last = -1;
+        bool gaps = false;
+
+        // whitespace is never a char, since a record of whitespace
+        // alone is blank
+        for (int c = 0; c < 256; ++c) {
+            char value = char(c);
+            table.accepts[c] = ! is_whitespace(value)
+                               && ! ((value < low) || (value > high))
+                               && allow(value);
+            if (table.accepts[c]) {
+                gaps = gaps || ((last >= 0) && (last != c - 1));
+                first = (first < 0) ? c : first;
+                last = c;
+            }
+        }
+        table.interval = (first >= 0) && ! gaps;
+        table.low = (unsigned char) max(first, 0);
+        table.high = (unsigned char) max(last, 0);
+    } else {
+        table.accepts_true = ! ((true < low) || (true > high)) && allow(true);
+        table.accepts_false = ! ((false < low) || (false > high))
+                              && allow(false);
+    }
+    return table;
+}
+
+static const char *accept_char_run(const char *first, const char *last,
+                                   const flag_table &table, size_t &count) {
+
+    // PRE:  first and last delimit a range of characters, and first is
+    //       the start of a record
+    //
+    // POST: see the prototype
+
+    const char *start = first;
+
+    // each record takes two characters, so a block that starts at a
+    // record holds a value at every even position and a newline at
+    // every odd one; a value is within the interval if subtracting low
+    // from it leaves no more than high - low, as an unsigned character
+#if defined(__AVX2__)
+    if (table.interval) {
+        const __m256i wide_low = _mm256_set1_epi8(char(table.low));
+        const __m256i wide_span = _mm256_set1_epi8(
+            char(table.high - table.low));
+        const __m256i wide_newline = _mm256_set1_epi8('\n');
+        const unsigned int NEWLINES = 0xAAAAAAAAU;
+        while (last - first >= 32) {
+            __m256i block = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i *>(first));
+            __m256i offset = _mm256_sub_epi8(block, wide_low);
+            unsigned int inside = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+                _mm256_max_epu8(offset, wide_span), wide_span));
+            unsigned int newlines = _mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(block, wide_newline));
+            if (((inside & ~NEWLINES) | (newlines & NEWLINES))
+                != 0xFFFFFFFFU) {
+                break;
+            }
+            first += 32;
+        }
+    }
+#endif
+
+#if defined(__SSE2__)
+    if (table.interval) {
+        const __m128i narrow_low = _mm_set1_epi8(char(table.low));
+        const __m128i narrow_span = _mm_set1_epi8(
+            char(table.high - table.low));
+        const __m128i newline = _mm_set1_epi8('\n');
+        const unsigned int NEWLINES = 0xAAAAU;
+        while (last - first >= 16) {
+            __m128i block = _mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(first));
+            __m128i offset = _mm_sub_epi8(block, narrow_low);
+            unsigned int inside = _mm_movemask_epi8(_mm_cmpeq_epi8(
+                _mm_max_epu8(offset, narrow_span), narrow_span));
+            unsigned int newlines = _mm_movemask_epi8(
+                _mm_cmpeq_epi8(block, newline));
+            if (((inside & ~NEWLINES) | (newlines & NEWLINES)) != 0xFFFFU) {
+                break;
+            }
+            first += 16;
+        }
+    }
+#endif
+
+    // check the rest of the run (or, without SSE2, all of it) one
+    // record at a time, with the table
+    while ((last - first >= 2) && table.accepts[(unsigned char) first[0]]
+           && (first[1] == '\n')) {
+        first += 2;
+    }
+    count += (first - start) / 2;
+    return first;
+}
+
+static const char *accept_bool_run(const char *first, const char *last,
+                                   const flag_table &table, size_t &count) {
+
+    // PRE:  first and last delimit a range of characters, and first is
+    //       the start of a record
+    //
+    // POST: see the prototype
+
+    // the characters of each record, newline included, as the low
+    // bytes of a little-endian word, and the masks that keep just
+    // those bytes
+    const uint64_t TRUE_WORD = 0x0A65757274ULL;         // "true\n"
+    const uint64_t FALSE_WORD = 0x0A65736C6166ULL;      // "false\n"
+    const uint64_t TRUE_MASK = 0xFFFFFFFFFFULL;
+    const uint64_t FALSE_MASK = 0xFFFFFFFFFFFFULL;
+    uint64_t true_word = table.accepts_true ? TRUE_WORD : ~uint64_t(0);
+    uint64_t false_word = table.accepts_false ? FALSE_WORD : ~uint64_t(0);
+
+    // a word is read from the characters directly only while eight of
+    // them are left
+    while (last - first >= 8) {
+        uint64_t word;
+        memcpy(&word, first, sizeof(word));
+        if constexpr (endian::native == endian::big) {
+            word = __builtin_bswap64(word);
+        }
+        if ((word & TRUE_MASK) == true_word) {
+            first += 5;
+            ++count;
+        } else if ((word & FALSE_MASK) == false_word) {
+            first += 6;
+            ++count;
+        } else {
+            return first;
+        }
+    }
+
+    // compare the last few records as strings
+    while (true) {
+        if (table.accepts_true && (last - first >= 5)
+            && (memcmp(first, "true\n", 5) == 0)) {
+            first += 5;
+        } else if (table.accepts_false && (last - first >= 6)
+                   && (memcmp(first, "false\n", 6) == 0)) {
+            first += 6;
+        } else {
+            return first;
+        }
+        ++count;
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////
+
+
+stdin_source::stdin_source(int fd)
+    : fd(fd), buffer(65536), begin(0), scanned(0), end(0), at_end(false),
+      max_bytes(0), deadline(chrono::steady_clock::time_point::max()),
+      reason(READ_OK) {
+
+    // PRE:  fd is open for reading
+    //
+    // POST: the source will read its records from fd
+}
+
+bool stdin_source::next_record(const char *&first, const char *&last) {
+
+    // PRE:  none
+    //
+    // POST: see input_source::next_record()
+
+    while (true) {
+
+        // if a whole record has already been read, hand it out in
+        // place
+        //
+        // the characters before scanned were searched on an earlier
+        // pass, so only the newly read ones are searched now
+        const char *data = buffer.data();
+        const char *newline = find_delimiter(data + scanned, data + end,
+                                             '\n');
+
+        if (newline != data + end) {
+            first = data + begin;
+            last = newline;
+            begin = newline + 1 - data;
+            scanned = begin;
+            return true;
+        }
+        scanned = end;
+
+        // at the end of input, hand out any final record that has no
+        // newline of its own
+        if (at_end) {
+            if (begin == end) {
+                reason = max(reason, READ_END_OF_INPUT);
+                return false;
+            }
+            first = data + begin;
+            last = data + end;
+            begin = end;
+            scanned = end;
+            return true;
+        }
+
+        // give up on a record that has grown too long, rather than
+        // making room for ever more of it
+        if ((max_bytes != 0) && (end - begin > max_bytes)) {
+            reason = READ_BYTE_LIMIT;
+            at_end = true;
+            begin = end;
+            return false;
+        }
+
+        read_more();
+    }
+}
+
+void stdin_source::set_limits(uint64_t max_bytes,
+                              chrono::steady_clock::time_point deadline) {
+
+    // PRE:  none
+    //
+    // POST: see input_source::set_limits()
+
+    this->max_bytes = max_bytes;
+    this->deadline = deadline;
+}
+
+bool stdin_source::next_block(const char *&first, const char *&last,
+                              size_t size) {
+
+    // PRE:  none
+    //
+    // POST: see input_source::next_block()
+
+    while (true) {
+        const char *data = buffer.data();
+
+        // at the end of input, hand out everything that is left
+        if (at_end) {
+            if (begin == end) {
+                return false;
+            }
+            first = data + begin;
+            last = data + end;
+            begin = end;
+            scanned = end;
+            return true;
+        }
+
+        // once enough has been read, hand out everything up to and
+        // including the last newline
+        if (end - begin >= size) {
+            const char *newline = static_cast<const char *>(
+                memrchr(data + begin, '\n', end - begin));
+            if (newline != nullptr) {
+                first = data + begin;
+                last = newline + 1;
+                begin = last - data;
+                scanned = begin;
+                return true;
+            }
+        }
+
+        read_more();
+    }
+}
+
+void stdin_source::read_more() {
+
+    // PRE:  the end of input has not been seen
+    //
+    // POST: the unused characters have been moved to the front of the
+    //       buffer, the buffer has been made bigger if they fill it,
+    //       and as many more characters as one read brings have been
+    //       added, or the end of input has been seen
+
+    if (begin > 0) {
+        memmove(buffer.data(), buffer.data() + begin, end - begin);
+        end -= begin;
+        scanned -= begin;
+        begin = 0;
+    }
+    if (end == buffer.size()) {
+        buffer.resize(buffer.size() * 2);
+    }
+
+    // with a deadline, wait for the input only until then, treating
+    // what has been read so far as all there is
+    if (deadline != chrono::steady_clock::time_point::max()) {
+        auto remaining = chrono::duration_cast<chrono::milliseconds>(
+            deadline - chrono::steady_clock::now());
+        pollfd ready = { fd, POLLIN, 0 };
+        if ((remaining.count() <= 0)
+            || (poll(&ready, 1, int(min<long long>(remaining.count(),
+                                                  INT_MAX))) == 0)) {
+            reason = READ_TIME_LIMIT;
+            at_end = true;
+            begin = end;
+            return;
+        }
+    }
+
+    ssize_t count = read(fd, buffer.data() + end, buffer.size() - end);
+    if (count > 0) {
+        end += count;
+    } else if ((count == 0) || (errno != EINTR)) {
+        at_end = true;
+    }
+}
+
+memory_source::memory_source(const char *first, const char *last)
+    : position(first), finish(last) {
+
+    // PRE:  first and last delimit a range of characters, which must
+    //       stay valid for as long as the source is used
+    //
+    // POST: the source holds the records from first up to last
+}
+
+void memory_source::reset(const char *first, const char *last) {
+
+    // PRE:  see the constructor
+    //
+    // POST: see the class definition
+
+    position = first;
+    finish = last;
+}
+
+mapped_file_source::mapped_file_source()
+    : mapping(nullptr), length(0) {
+
+    // PRE:  none
+    //
+    // POST: the source holds no records until open() succeeds
+}
+
+mapped_file_source::~mapped_file_source() {
+
+    // PRE:  none
+    //
+    // POST: the file, if any, has been unmapped
+
+    if (mapping != nullptr) {
+        munmap(mapping, length);
+    }
+}
+
+bool mapped_file_source::open(const char *path) {
+
+    // PRE:  no file has been opened yet
+    //
+    // POST: see the class definition
+
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return false;
+    }
+
+    // an empty file cannot be mapped, but holds no records anyway
+    length = info.st_size;
+    if (length > 0) {
+        void *address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address == MAP_FAILED) {
+            int error = errno;
+            close(fd);
+            errno = error;
+            return false;
+        }
+        mapping = address;
+
+        // the records will be read from start to end, so let the
+        // kernel read ahead
+        madvise(mapping, length, MADV_SEQUENTIAL);
+    }
+
+    // the mapping stays valid after the file descriptor is closed
+    close(fd);
+
+    const char *first = static_cast<const char *>(mapping);
+    reset(first, first + length);
+    return true;
+}
+
+gzip_source::gzip_source()
+    : fd(-1), chunks(CHUNKS), finished(false), stopping(false),
+      corrupt(false), trailing(false), current(CHUNKS), begin(nullptr),
+      scanned(nullptr), end(nullptr), at_end(false) {
+
+    // PRE:  none
+    //
+    // POST: the source holds no records until a stream is opened
+
+    for (size_t i = 0; i < CHUNKS; ++i) {
+        chunks[i].data.reset(new char[CARRY_ROOM + CHUNK_SIZE]);
+        available.push_back(i);
+    }
+}
+
+gzip_source::~gzip_source() {
+
+    // PRE:  none
+    //
+    // POST: the decompressing thread has been stopped
+
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    changed.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+void gzip_source::open(int fd) {
+
+    // PRE:  see the class definition
+    //
+    // POST: see the class definition
+
+    this->fd = fd;
+    worker = thread(&gzip_source::decompress, this);
+}
+
+void gzip_source::decompress() {
+
+    // PRE:  the stream has been opened
+    //
+    // POST: the whole stream has been inflated into the buffers and
+    //       handed to the reader in order, or the reader has stopped
+    //       this thread; if the stream was corrupt or cut short, or
+    //       had bytes after its last member that were ignored, that has
+    //       been noted
+    //
+    // a file made by joining several gzip files one after another is
+    // inflated as a whole, just as gzip -d would; and, again like
+    // gzip -d, whatever follows the last member without starting with
+    // the gzip magic number, such as the zero padding of a tape or a
+    // block device, ends the stream rather than making it corrupt
+
+    z_stream stream = {};
+    vector<unsigned char> input(1 << 18);
+    bool member_ended = false;      // whether a whole gzip member has
+                                    // just been inflated
+    bool done = false;
+
+    // 15 + 32 lets zlib accept either a gzip or a zlib header
+    if (inflateInit2(&stream, 15 + 32) != Z_OK) {
+        corrupt = true;
+        done = true;
+    }
+
+    while (! done) {
+
+        // wait for a buffer to inflate into
+        size_t index;
+        {
+            unique_lock<mutex> guard(lock);
+            changed.wait(guard, [&] {
+                return stopping || ! available.empty();
+            });
+            if (stopping) {
+                break;
+            }
+            index = available.front();
+            available.pop_front();
+        }
+
+        chunk &target = chunks[index];
+        stream.next_out =
+            reinterpret_cast<unsigned char *>(target.data.get() + CARRY_ROOM);
+        stream.avail_out = CHUNK_SIZE;
+
+        while ((stream.avail_out > 0) && ! done) {
+            // after a member, both bytes of the magic number are needed
+            // to tell whether another one follows, so a lone byte left
+            // from the last read is kept in front of the next one
+            while ((stream.avail_in == 0)
+                   || (member_ended && (stream.avail_in < 2))) {
+                size_t kept = stream.avail_in;
+                if (kept > 0) {
+                    input[0] = *stream.next_in;
+                }
+                ssize_t count;
+                do {
+                    count = read(fd, input.data() + kept,
+                                 input.size() - kept);
+                } while ((count < 0) && (errno == EINTR));
+
+                if ((count == 0) && (kept > 0)) {
+
+                    // a single byte after the last member
+                    trailing = true;
+                    done = true;
+                    break;
+                }
+                if (count <= 0) {
+
+                    // the stream must end where a member does
+                    corrupt = (count < 0) || ! member_ended;
+                    done = true;
+                    break;
+                }
+                stream.next_in = input.data();
+                stream.avail_in = kept + count;
+            }
+            if (done) {
+                break;
+            }
+
+            if (member_ended) {
+
+                // what follows the member that just ended is not another
+                if ((stream.next_in[0] != 0x1f)
+                    || (stream.next_in[1] != 0x8b)) {
+                    trailing = true;
+                    done = true;
+                    break;
+                }
+
+                // another member follows the one that just ended
+                inflateReset(&stream);
+                member_ended = false;
+            }
+
+            int status = inflate(&stream, Z_NO_FLUSH);
+            if (status == Z_STREAM_END) {
+                member_ended = true;
+            } else if ((status != Z_OK) && (status != Z_BUF_ERROR)) {
+                corrupt = true;
+                done = true;
+            }
+        }
+
+        // hand the buffer to the reader, or give it back if nothing was
+        // inflated into it
+        target.size = CHUNK_SIZE - stream.avail_out;
+        {
+            lock_guard<mutex> guard(lock);
+            if (target.size > 0) {
+                ready.push_back(index);
+            } else {
+                available.push_back(index);
+            }
+        }
+        changed.notify_all();
+    }
+
+    inflateEnd(&stream);
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+    {
+        lock_guard<mutex> guard(lock);
+        finished = true;
+    }
+    changed.notify_all();
+}
+
+void gzip_source::release(size_t index) {
+
+    // PRE:  index is a chunk the reader has finished with, or CHUNKS
+    //
+    // POST: the chunk may be inflated into again
+
+    if (index == CHUNKS) {
+        return;
+    }
+    {
+        lock_guard<mutex> guard(lock);
+        available.push_back(index);
+    }
+    changed.notify_all();
+}
+
+void gzip_source::replace_current(size_t index) {
+
+    // PRE:  index is a chunk taken from ready, or CHUNKS
+    //
+    // POST: the records are being handed out from index, and the chunk
+    //       they were being handed out from may be inflated into again,
+    //       unless a block handed out from it has not been released
+
+    {
+        lock_guard<mutex> guard(lock);
+        size_t previous = current;
+        current = index;
+        if ((previous != CHUNKS) && ! is_held(previous)) {
+            available.push_back(previous);
+        }
+    }
+    changed.notify_all();
+}
+
+bool gzip_source::is_held(size_t index) const {
+
+    // PRE:  lock is held
+    //
+    // POST: whether a block handed out from chunk index has not yet
+    //       been released has been returned
+
+    for (const held_block &block : held) {
+        if (block.chunk == index) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void gzip_source::hand_out(const char *&first, const char *&last,
+                           const char *stop) {
+
+    // PRE:  stop is within the unused characters, after begin
+    //
+    // POST: first and last delimit the unused characters up to stop,
+    //       which are held until release_block() gives them back, and
+    //       the rest are left unused
+    //
+    // a block in the gathered buffer keeps that buffer, and the rest
+    // of the characters are moved to a new one
+
+    lock_guard<mutex> guard(lock);
+    first = begin;
+    last = stop;
+    if (current != CHUNKS) {
+        held.push_back(held_block{ current, {} });
+        begin = stop;
+    } else {
+        vector<char> rest(stop, end);
+        held.push_back(held_block{ CHUNKS, move(carry) });
+        carry = move(rest);
+        begin = carry.data();
+        end = carry.data() + carry.size();
+    }
+    scanned = begin;
+}
+
+void gzip_source::release_block() {
+
+    // PRE:  see input_source::release_block()
+    //
+    // POST: see input_source::release_block(); the chunk the block was
+    //       in may be inflated into again once no other block, and not
+    //       the records still being handed out, are in it
+
+    {
+        lock_guard<mutex> guard(lock);
+        size_t index = held.front().chunk;
+        held.pop_front();
+        if ((index != CHUNKS) && (index != current) && ! is_held(index)) {
+            available.push_back(index);
+        }
+    }
+    changed.notify_all();
+}
+
+void gzip_source::take_chunk() {
+
+    // PRE:  not everything has been read
+    //
+    // POST: the next inflated buffer follows the unused characters, and
+    //       the buffer they were in may be inflated into again; or
+    //       there are no more, and everything has been read
+
+    size_t index;
+    {
+        unique_lock<mutex> guard(lock);
+        changed.wait(guard, [&] { return finished || ! ready.empty(); });
+        if (ready.empty()) {
+            at_end = true;
+            return;
+        }
+        index = ready.front();
+        ready.pop_front();
+    }
+
+    chunk &next = chunks[index];
+    size_t unused = end - begin;
+    size_t searched = scanned - begin;
+
+    if (unused <= CARRY_ROOM) {
+
+        // copy the unused characters into the room in front of the new
+        // buffer, and hand the records out from it
+        char *start = next.data.get() + CARRY_ROOM - unused;
+        if (unused > 0) {
+            memcpy(start, begin, unused);
+        }
+        replace_current(index);
+        carry.clear();
+        begin = start;
+        end = next.data.get() + CARRY_ROOM + next.size;
+    } else {
+
+        // gather an overlong record into a buffer of its own
+        vector<char> gathered;
+        gathered.reserve(unused + next.size);
+        gathered.insert(gathered.end(), begin, end);
+        gathered.insert(gathered.end(), next.data.get() + CARRY_ROOM,
+                        next.data.get() + CARRY_ROOM + next.size);
+        replace_current(CHUNKS);
+        release(index);
+        carry.swap(gathered);
+        begin = carry.data();
+        end = carry.data() + carry.size();
+    }
+    scanned = begin + searched;
+}
+
+bool gzip_source::next_record(const char *&first, const char *&last) {
+
+    // PRE:  none
+    //
+    // POST: see input_source::next_record()
+
+    while (true) {
+
+        // if a whole record is in the buffer, hand it out in place
+        const char *newline = find_delimiter(scanned, end, '\n');
+        if (newline != end) {
+            first = begin;
+            last = newline;
+            begin = newline + 1;
+            scanned = begin;
+            return true;
+        }
+        scanned = end;
+
+        // at the end of input, hand out any final record that has no
+        // newline of its own
+        if (at_end) {
+            if (begin == end) {
+                return false;
+            }
+            first = begin;
+            last = end;
+            begin = end;
+            scanned = end;
+            return true;
+        }
+
+        take_chunk();
+    }
+}
+
+bool gzip_source::next_block(const char *&first, const char *&last,
+                             size_t size) {
+
+    // PRE:  none
+    //
+    // POST: see input_source::next_block()
+    //
+    // each buffer is handed out as a block once the records of the one
+    // before have been used, so a block is one buffer's worth of
+    // records, which is about size characters when size is BLOCK_SIZE
+
+    (void) size;
+
+    while (true) {
+
+        // at the end of input, hand out everything that is left
+        if (at_end) {
+            if (begin == end) {
+                return false;
+            }
+            hand_out(first, last, end);
+            return true;
+        }
+
+        // hand out everything up to and including the last newline
+        if (begin != end) {
+            const char *newline = static_cast<const char *>(
+                memrchr(begin, '\n', end - begin));
+            if (newline != nullptr) {
+                hand_out(first, last, newline + 1);
+                return true;
+            }
+        }
+
+        take_chunk();
+    }
+}
+
+compression_kind compression_of(const unsigned char *first, size_t size) {
+
+    // PRE:  first points to the first size characters of a file
+    //
+    // POST: the kind of compression that the file's magic number says
+    //       it uses has been returned
+
+    if ((size >= 2) && (first[0] == 0x1f) && (first[1] == 0x8b)) {
+        return COMPRESSION_GZIP;
+    }
+    if ((size >= 4) && (first[0] == 0x28) && (first[1] == 0xb5)
+        && (first[2] == 0x2f) && (first[3] == 0xfd)) {
+        return COMPRESSION_ZSTD;
+    }
+    return COMPRESSION_NONE;
+}
+
+bool memory_source::next_record(const char *&first, const char *&last) {
+
+    // PRE:  none
+    //
+    // POST: see input_source::next_record()
+
+    if (position == finish) {
+        return false;
+    }
+
+    const char *newline = find_delimiter(position, finish, '\n');
+
+    first = position;
+    last = newline;
+    position = (newline == finish) ? finish : newline + 1;
+    return true;
+}
+
+bool memory_source::next_block(const char *&first, const char *&last,
+                               size_t size) {
+
+    // PRE:  none
+    //
+    // POST: see input_source::next_block()
+
+    if (position == finish) {
+        return false;
+    }
+
+    // hand out size characters, and then the rest of the record that
+    // they end in
+    first = position;
+    if (size_t(finish - position) <= size) {
+        last = finish;
+    } else {
+        last = find_delimiter(position + size, finish, '\n');
+        if (last != finish) {
+            ++last;
+        }
+    }
+    position = last;
+    return true;
+}
+
+size_t memory_source::records() const {
+
+    // PRE:  none
+    //
+    // POST: see the class declaration
+
+    size_t lines = count_delimiters(position, finish, '\n');
+    if ((position != finish) && (finish[-1] != '\n')) {
+        ++lines;
+    }
+    return lines;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+
+rejection_log::rejection_log()
+    : enqueue_position(0), dequeue_position(0), published(0),
+      sleeping(false), stopping(false), fd(-1) {
+
+    // PRE:  none
+    //
+    // POST: the log is not yet open, so nothing may be recorded in it
+}
+
+rejection_log::~rejection_log() {
+
+    // PRE:  no thread is still recording entries
+    //
+    // POST: every queued entry has been written out, and the log file
+    //       has been closed
+
+    if (writer.joinable()) {
+        stopping.store(true);
+        published.fetch_add(1);
+        published.notify_one();
+        writer.join();
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+bool rejection_log::open(const char *path) {
+
+    // PRE:  the log is not yet open
+    //
+    // POST: see the class declaration
+
+    fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        return false;
+    }
+
+    // mark every slot as free for the first pass around the ring
+    ring.reset(new slot[CAPACITY]);
+    for (size_t i = 0; i < CAPACITY; ++i) {
+        ring[i].sequence.store(i, memory_order_relaxed);
+    }
+
+    writer = thread(&rejection_log::write_entries, this);
+    return true;
+}
+
+void rejection_log::record(uint64_t offset, uint64_t line,
+                           validation_outcome reason,
+                           const char *first, const char *last,
+                           uint32_t field) {
+
+    // PRE:  see the class declaration
+    //
+    // POST: see the class declaration
+
+    size_t position = enqueue_position.load(memory_order_relaxed);
+    slot *entry;
+
+    // claim the slot at the next position, unless the writer has not
+    // yet emptied it, in which case the ring is full, and this thread
+    // waits until the writer has
+    while (true) {
+        entry = &ring[position & (CAPACITY - 1)];
+        size_t sequence = entry->sequence.load(memory_order_acquire);
+        intptr_t difference = intptr_t(sequence) - intptr_t(position);
+
+        if (difference == 0) {
+            if (enqueue_position.compare_exchange_weak(
+                    position, position + 1, memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            entry->sequence.wait(sequence, memory_order_acquire);
+            position = enqueue_position.load(memory_order_relaxed);
+        } else {
+            position = enqueue_position.load(memory_order_relaxed);
+        }
+    }
+
+    // fill the slot, and then hand it over to the writer
+    size_t length = last - first;
+    entry->offset = offset;
+    entry->line = line;
+    entry->reason = reason;
+    entry->field = field;
+    entry->length = uint32_t(min<size_t>(length, UINT32_MAX));
+    memcpy(entry->bytes, first, min(length, REJECTION_BYTES));
+    entry->sequence.store(position + 1, memory_order_release);
+
+    // wake the writer, if it has gone to sleep; only the first entry
+    // recorded after it has finds sleeping set, so that while the
+    // writer is busy, recording an entry makes no system call
+    published.fetch_add(1);
+    if (sleeping.load() && sleeping.exchange(false)) {
+        published.notify_one();
+    }
+}
+
+void rejection_log::write_entries() {
+
+    // PRE:  the log is open
+    //
+    // POST: every entry recorded before stopping was set has been
+    //       written to the log file
+
+    string out;
+
+    // empty the ring into the log file, checking for the end only once
+    // it has been found empty after stopping was set, so that no entry
+    // recorded before then is left behind
+    //
+    // when there is nothing to write, the writer sets sleeping and then
+    // sleeps until published changes from the value it had before the
+    // ring was found empty; every access to the two is sequentially
+    // consistent, so either the writer sees the entry of a thread
+    // recording one, or that thread sees sleeping set and wakes it
+    while (true) {
+        uint32_t seen = published.load();
+        bool stop = stopping.load();
+
+        if (drain(out)) {
+            flush(out);
+        } else if (stop) {
+            break;
+        } else {
+            sleeping.store(true);
+            if (published.load() == seen) {
+                published.wait(seen);
+            }
+            sleeping.store(false);
+        }
+    }
+}
+
+bool rejection_log::drain(string &out) {
+
+    // PRE:  this is called only by the writer thread
+    //
+    // POST: every entry that was ready, up to a limit, has been
+    //       appended to out as one line of JSON and its slot freed,
+    //       and whether there were any has been returned
+
+    size_t taken = 0;
+
+    while (taken < CAPACITY) {
+        slot &entry = ring[dequeue_position & (CAPACITY - 1)];
+        if (entry.sequence.load(memory_order_acquire)
+            != dequeue_position + 1) {
+            break;
+        }
+
+        size_t kept = min<size_t>(entry.length, REJECTION_BYTES);
+        out += "{\"offset\":";
+        out += to_string(entry.offset);
+        out += ",\"line\":";
+        out += to_string(entry.line);
+        out += (entry.reason == INVALID_RANGE) ? ",\"rule\":\"range\""
+                                               : ",\"rule\":\"type\"";
+        if (entry.field != 0) {
+            out += ",\"field\":";
+            out += to_string(entry.field);
+        }
+        out += ",\"bytes\":";
+        append_json_string(out, entry.bytes, entry.bytes + kept);
+        if (kept < entry.length) {
+            out += ",\"truncated\":true";
+        }
+        out += "}\n";
+
+        // free the slot for the next pass around the ring, waking any
+        // thread waiting for it
+        entry.sequence.store(dequeue_position + CAPACITY,
+                             memory_order_release);
+        entry.sequence.notify_all();
+        ++dequeue_position;
+        ++taken;
+    }
+    return taken != 0;
+}
+
+void rejection_log::flush(string &out) {
+
+    // PRE:  the log is open
+    //
+    // POST: out has been written to the log file, as far as it could
+    //       be, and cleared
+
+    const char *next = out.data();
+    size_t remaining = out.size();
+
+    while (remaining != 0) {
+        ssize_t written = write(fd, next, remaining);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        next += written;
+        remaining -= written;
+    }
+    out.clear();
+}
+
+void append_json_string(string &out, const char *first, const char *last) {
+
+    // PRE:  first and last delimit a range of characters
+    //
+    // POST: the characters have been appended to out as a JSON string,
+    //       with quotes, backslashes, control characters, and bytes
+    //       outside of ASCII written as escapes, so that the raw bytes
+    //       of any record can be recovered from it
+
+    static const char HEX[] = "0123456789abcdef";
+
+    out += '"';
+    for (; first != last; ++first) {
+        unsigned char c = *first;
+        if ((c == '"') || (c == '\\')) {
+            out += '\\';
+            out += char(c);
+        } else if ((c < 0x20) || (c >= 0x7f)) {
+            out += "\\u00";
+            out += HEX[c >> 4];
+            out += HEX[c & 15];
+        } else {
+            out += char(c);
+        }
+    }
+    out += '"';
+}
+
+
+//////////////////////////////////////////////////////////////////////
+
+
+bool timing_parses = false;
+
+// the counters of every thread that has counted anything, which are
+// kept after the thread has finished, so that nothing it counted is lost
+static vector<unique_ptr<validation_counters>> counter_registry;
+static mutex counter_registry_lock;
+
+parse_timer::parse_timer() {
+
+    // PRE:  none
+    //
+    // POST: the time has been taken, if parse times are being measured
+
+    if (timing_parses) {
+        start = chrono::steady_clock::now();
+    }
+}
+
+parse_timer::~parse_timer() {
+
+    // PRE:  none
+    //
+    // POST: the time since construction has been added to the parse
+    //       time of this thread, if parse times are being measured
+
+    if (timing_parses) {
+        add_count(thread_counters().parse_nanoseconds,
+                  chrono::duration_cast<chrono::nanoseconds>(
+                      chrono::steady_clock::now() - start).count());
+    }
+}
+
+validation_counters &thread_counters() {
+
+    // PRE:  none
+    //
+    // POST: the counters of this thread have been returned, having
+    //       been registered the first time this thread asked for them
+
+    thread_local validation_counters *counters = nullptr;
+
+    if (counters == nullptr) {
+        lock_guard<mutex> guard(counter_registry_lock);
+        counter_registry.push_back(make_unique<validation_counters>());
+        counters = counter_registry.back().get();
+    }
+    return *counters;
+}
+
+void add_count(atomic<uint64_t> &counter, uint64_t amount) {
+
+    // PRE:  counter is one of this thread's own counters
+    //
+    // POST: amount has been added to counter
+    //
+    // no other thread adds to the counter, so a plain load and store
+    // is enough, and is cheaper than an atomic addition; the atomic
+    // type only keeps snapshot_counters() from reading a torn value
+
+    counter.store(counter.load(memory_order_relaxed) + amount,
+                  memory_order_relaxed);
+}
+
+vector<counter_snapshot> snapshot_counters() {
+
+    // PRE:  none
+    //
+    // POST: the values of the counters of every thread that has
+    //       counted anything have been returned, in the order the
+    //       threads first counted
+
+    lock_guard<mutex> guard(counter_registry_lock);
+    vector<counter_snapshot> snapshots;
+
+    for (const unique_ptr<validation_counters> &counters : counter_registry) {
+        counter_snapshot snapshot;
+        snapshot.accepted = counters->accepted.load(memory_order_relaxed);
+        snapshot.type_rejections =
+            counters->type_rejections.load(memory_order_relaxed);
+        snapshot.range_rejections =
+            counters->range_rejections.load(memory_order_relaxed);
+        snapshot.bytes_skipped =
+            counters->bytes_skipped.load(memory_order_relaxed);
+        snapshot.parse_nanoseconds =
+            counters->parse_nanoseconds.load(memory_order_relaxed);
+        snapshots.push_back(snapshot);
+    }
+    return snapshots;
+}
+
+string format_counters(bool json) {
+
+    // PRE:  none
+    //
+    // POST: the counters of every thread, and their totals, have been
+    //       returned as a JSON object if json is true, and otherwise
+    //       in the Prometheus text exposition format, with one sample
+    //       per thread labelled by the thread's number
+
+    vector<counter_snapshot> snapshots = snapshot_counters();
+
+    // the name, help text, and snapshot member of each counter
+    struct counter_field {
+        const char *name;
+        const char *help;
+        uint64_t counter_snapshot::*member;
+    };
+    static const counter_field FIELDS[] = {
+        { "accepted", "Values accepted.", &counter_snapshot::accepted },
+        { "type_rejections", "Values rejected for their data type.",
+          &counter_snapshot::type_rejections },
+        { "range_rejections", "Values rejected for their range.",
+          &counter_snapshot::range_rejections },
+        { "bytes_skipped", "Characters discarded to reach a new record.",
+          &counter_snapshot::bytes_skipped },
+        { "parse_nanoseconds", "Time spent validating, if measured.",
+          &counter_snapshot::parse_nanoseconds },
+    };
+
+    string out;
+
+    if (json) {
+        counter_snapshot total;
+        out += "{\"threads\":[";
+        for (size_t i = 0; i < snapshots.size(); ++i) {
+            out += (i == 0) ? "{" : ",{";
+            for (const counter_field &field : FIELDS) {
+                if (&field != FIELDS) {
+                    out += ',';
+                }
+                out += string("\"") + field.name + "\":"
+                       + to_string(snapshots[i].*field.member);
+                total.*field.member += snapshots[i].*field.member;
+            }
+            out += '}';
+        }
+        out += "],\"total\":{";
+        for (const counter_field &field : FIELDS) {
+            if (&field != FIELDS) {
+                out += ',';
+            }
+            out += string("\"") + field.name + "\":"
+                   + to_string(total.*field.member);
+        }
+        out += "}}\n";
+    } else {
+        for (const counter_field &field : FIELDS) {
+            string name = string("validation_") + field.name + "_total";
+            out += "# HELP " + name + " " + field.help + "\n";
+            out += "# TYPE " + name + " counter\n";
+            for (size_t i = 0; i < snapshots.size(); ++i) {
+                out += name + "{thread=\"" + to_string(i) + "\"} "
+                       + to_string(snapshots[i].*field.member) + "\n";
+            }
+        }
+    }
+    return out;
+}
+
+bool export_counters(const char *path, bool json) {
+
+    // PRE:  none
+    //
+    // POST: if path is a null pointer, nothing has been done; otherwise
+    //       the formatted counters have been written to path, or to
+    //       standard error if path is "-"; true has been returned,
+    //       unless they could not be written, in which case the
+    //       problem has been reported and false has been returned
+
+    if (path == nullptr) {
+        return true;
+    }
+
+    string out = format_counters(json);
+
+    if (string(path) == "-") {
+        cerr << out;
+        return true;
+    }
+
+    int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    bool written = (fd >= 0)
+                   && (write(fd, out.data(), out.size())
+                       == ssize_t(out.size()));
+    int error = errno;
+    if (fd >= 0) {
+        written = (close(fd) == 0) && written;
+    }
+    if (! written) {
+        cerr << "Cannot write " << path << ": " << strerror(error) << endl;
+    }
+    return written;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////
+
+
+thread_pool::thread_pool(unsigned int threads,
+                         const vector<unsigned int> &cpus)
+    : ranges(threads), cpus(cpus), placed(false), pinned(false),
+      current_body(nullptr), generation(0), busy(0), stopping(false) {
+
+    // PRE:  threads is at least 1, and cpus is either empty or holds
+    //       threads processors
+    //
+    // POST: threads - 1 worker threads have been started; the thread
+    //       that calls run() does the share of the work of the last
+    //       one; if one of them could not be started, those that were
+    //       have been stopped again, and the exception passed on
+    //
+    // the creating thread is only pinned by its first call of run(),
+    // so that any threads it starts meanwhile are not pinned with it
+
+    try {
+        for (unsigned int i = 1; i < threads; ++i) {
+            workers.emplace_back(&thread_pool::work, this, i);
+        }
+    } catch (...) {
+        stop();
+        throw;
+    }
+}
+
+thread_pool::~thread_pool() {
+
+    // PRE:  no call to run() is in progress
+    //
+    // POST: all of the worker threads have finished
+
+    stop();
+}
+
+void thread_pool::stop() {
+
+    // PRE:  no call to run() is in progress
+    //
+    // POST: all of the worker threads have finished, and the creating
+    //       thread may run wherever it could before it was pinned
+
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    started.notify_all();
+    for (thread &worker : workers) {
+        worker.join();
+    }
+
+    // let the creating thread run anywhere it could before
+    if (pinned) {
+        pthread_setaffinity_np(pthread_self(), sizeof(original_cpus),
+                               &original_cpus);
+    }
+}
+
+void thread_pool::run(size_t count, const function<void(size_t)> &task) {
+
+    // PRE:  none
+    //
+    // POST: see the class definition
+
+    run_on_all([&](unsigned int index) {
+        for (size_t i = index; i < count; i += size()) {
+            task(i);
+        }
+    });
+}
+
+void thread_pool::run_stealing(size_t count,
+                               const function<void(size_t)> &task) {
+
+    // PRE:  none
+    //
+    // POST: see the class definition
+
+    // give each thread its own contiguous share of the tasks
+    for (unsigned int i = 0; i < size(); ++i) {
+        ranges[i].next = count * i / size();
+        ranges[i].end = count * (i + 1) / size();
+    }
+
+    run_on_all([&](unsigned int index) {
+        task_range &own = ranges[index];
+
+        while (true) {
+            size_t next;
+
+            // take the next task of this thread's own share
+            {
+                lock_guard<mutex> guard(own.lock);
+                next = own.next;
+                if (next < own.end) {
+                    ++own.next;
+                }
+            }
+            if (next < own.end) {
+                task(next);
+                continue;
+            }
+
+            // this thread's share is done, so steal the second half of
+            // what is left of the share of the first other thread, in
+            // turn, that still has some
+            //
+            // only one lock is held at a time, so that two threads
+            // stealing from each other cannot deadlock
+            size_t stolen_next = 0;
+            size_t stolen_end = 0;
+            for (unsigned int offset = 1;
+                 (offset < size()) && (stolen_next == stolen_end);
+                 ++offset) {
+                task_range &victim = ranges[(index + offset) % size()];
+                lock_guard<mutex> guard(victim.lock);
+
+                if (victim.next < victim.end) {
+                    stolen_next = victim.next
+                                  + (victim.end - victim.next) / 2;
+                    stolen_end = victim.end;
+                    victim.end = stolen_next;
+                }
+            }
+
+            // when there is nothing left to steal, everything has been
+            // taken
+            if (stolen_next == stolen_end) {
+                return;
+            }
+
+            lock_guard<mutex> guard(own.lock);
+            own.next = stolen_next;
+            own.end = stolen_end;
+        }
+    });
+}
+
+void thread_pool::run_on_all(const function<void(unsigned int)> &body) {
+
+    // PRE:  none
+    //
+    // POST: body(i) has been called once on each thread i of the pool,
+    //       and all of the calls have returned
+
+    // move this thread to its processor the first time, as thread 0
+    if (! placed && ! cpus.empty()) {
+        pinned = (pthread_getaffinity_np(pthread_self(),
+                                         sizeof(original_cpus),
+                                         &original_cpus) == 0)
+                 && pin_thread(cpus[0]);
+    }
+    placed = true;
+
+    // hand the batch to the workers
+    {
+        lock_guard<mutex> guard(lock);
+        current_body = &body;
+        busy = workers.size();
+        ++generation;
+    }
+    started.notify_all();
+
+    // do this thread's share, as thread 0, and then wait for the
+    // workers to do theirs, even if it threw, since they are still
+    // using body
+    exception_ptr thrown;
+    try {
+        body(0);
+    } catch (...) {
+        thrown = current_exception();
+    }
+    unique_lock<mutex> guard(lock);
+    finished.wait(guard, [this] { return busy == 0; });
+    if (thrown == nullptr) {
+        thrown = failure;
+    }
+    failure = nullptr;
+    guard.unlock();
+    if (thrown != nullptr) {
+        rethrow_exception(thrown);
+    }
+}
+
+void thread_pool::work(unsigned int index) {
+
+    // PRE:  index is the number of this worker, from 1 up
+    //
+    // POST: this worker has done its share of every batch handed out
+    //       until the pool was destroyed
+
+    unsigned long seen = 0;
+
+    // move to this worker's processor before touching any memory, so
+    // that what it allocates is placed on its own node
+    if (! cpus.empty()) {
+        pin_thread(cpus[index]);
+    }
+
+    while (true) {
+        const function<void(unsigned int)> *body;
+
+        // wait for a new batch, or for the pool to be destroyed
+        {
+            unique_lock<mutex> guard(lock);
+            started.wait(guard, [&] { return stopping
+                                             || (generation != seen); });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+            body = current_body;
+        }
+
+        // do this worker's share of the batch, keeping what it throws
+        // for run_on_all() to pass on, since an exception that left the
+        // thread would end the program
+        exception_ptr thrown;
+        try {
+            (*body)(index);
+        } catch (...) {
+            thrown = current_exception();
+        }
+
+        // report that this worker is done
+        {
+            lock_guard<mutex> guard(lock);
+            if ((thrown != nullptr) && (failure == nullptr)) {
+                failure = thrown;
+            }
+            --busy;
+        }
+        finished.notify_one();
+    }
+}
+
+template <typename T>
+spsc_queue<T>::spsc_queue(size_t capacity)
+    : slots(capacity), head(0), tail(0) {
+
+    // PRE:  capacity > 0
+    //
+    // POST: the queue is empty, with room for capacity values
+}
+
+template <typename T>
+void spsc_queue<T>::push(T value) {
+
+    // PRE:  see the class declaration
+    //
+    // POST: see the class declaration
+
+    size_t position = tail.load(memory_order_relaxed);
+    size_t popped = head.load(memory_order_acquire);
+    while (position - popped == slots.size()) {
+        head.wait(popped, memory_order_acquire);
+        popped = head.load(memory_order_acquire);
+    }
+    slots[position % slots.size()] = move(value);
+    tail.store(position + 1, memory_order_release);
+    tail.notify_one();
+}
+
+template <typename T>
+T spsc_queue<T>::pop() {
+
+    // PRE:  see the class declaration
+    //
+    // POST: see the class declaration
+
+    size_t position = head.load(memory_order_relaxed);
+    size_t pushed = tail.load(memory_order_acquire);
+    while (pushed == position) {
+        tail.wait(pushed, memory_order_acquire);
+        pushed = tail.load(memory_order_acquire);
+    }
+    T value = move(slots[position % slots.size()]);
+    head.store(position + 1, memory_order_release);
+    head.notify_one();
+    return value;
+}
+
+bool parse_thread_count(const char *text, unsigned int &threads) {
+
+    // PRE:  none
+    //
+    // POST: see the prototype
+
+    char *end;
+    errno = 0;
+    unsigned long count = strtoul(text, &end, 10);
+    if ((*text < '0') || (*text > '9') || (*end != '\0') || (errno != 0)
+        || (count > MAX_THREADS)) {
+        return false;
+    }
+    threads = (count == 0) ? max(1u, thread::hardware_concurrency())
+                           : (unsigned int) count;
+    threads = min(threads, MAX_THREADS);
+    return true;
+}
+
+static bool parse_cpu_list(const string &text, vector<unsigned int> &cpus) {
+
+    // PRE:  none
+    //
+    // POST: see the prototype; the processors listed have been
+    //       appended to cpus
+
+    const char *next = text.data();
+    const char *last = text.data() + text.size();
+
+    while (next != last) {
+        unsigned int first_cpu;
+        unsigned int last_cpu;
+        from_chars_result result = from_chars(next, last, first_cpu);
+        if (result.ec != errc()) {
+            return false;
+        }
+        last_cpu = first_cpu;
+        next = result.ptr;
+        if ((next != last) && (*next == '-')) {
+            result = from_chars(next + 1, last, last_cpu);
+            if ((result.ec != errc()) || (last_cpu < first_cpu)
+                || (last_cpu >= CPU_SETSIZE)) {
+                return false;
+            }
+            next = result.ptr;
+        }
+        for (unsigned int cpu = first_cpu; cpu <= last_cpu; ++cpu) {
+            cpus.push_back(cpu);
+        }
+        if (next != last) {
+            if ((*next != ',') || (next + 1 == last)) {
+                return false;
+            }
+            ++next;
+        }
+    }
+    return ! cpus.empty();
+}
+
+bool parse_topology(const string &spec, numa_topology &topology) {
+
+    // PRE:  none
+    //
+    // POST: see the prototype; topology holds the nodes read
+
+    topology.nodes.clear();
+    size_t start = 0;
+    while (start <= spec.size()) {
+        size_t slash = spec.find('/', start);
+        if (slash == string::npos) {
+            slash = spec.size();
+        }
+        topology.nodes.emplace_back();
+        if (! parse_cpu_list(spec.substr(start, slash - start),
+                             topology.nodes.back())) {
+            return false;
+        }
+        start = slash + 1;
+    }
+    return true;
+}
+
+void read_system_topology(numa_topology &topology) {
+
+    // PRE:  none
+    //
+    // POST: see the prototype
+
+    topology.nodes.clear();
+
+    // the nodes are numbered from 0, but a machine may leave gaps in
+    // the numbering, so look a little past the last one found
+    for (unsigned int node = 0, missing = 0; missing < 8; ++node) {
+        ifstream list("/sys/devices/system/node/node" + to_string(node)
+                      + "/cpulist");
+        string text;
+        vector<unsigned int> cpus;
+        if (! getline(list, text)) {
+            ++missing;
+            continue;
+        }
+        missing = 0;
+
+        // a node with memory but no processors has an empty list
+        if (parse_cpu_list(text, cpus)) {
+            topology.nodes.push_back(cpus);
+        }
+    }
+
+    if (topology.nodes.empty()) {
+        topology.nodes.emplace_back();
+        for (unsigned int cpu = 0;
+             cpu < max(1u, thread::hardware_concurrency()); ++cpu) {
+            topology.nodes.back().push_back(cpu);
+        }
+    }
+}
+
+vector<unsigned int> place_threads(const numa_topology &topology,
+                                   unsigned int threads) {
+
+    // PRE:  topology has at least one node, each with at least one
+    //       processor
+    //
+    // POST: see the prototype; if a node has fewer processors than
+    //       threads, its threads share them in turn
+
+    vector<unsigned int> cpus;
+    size_t nodes = topology.nodes.size();
+    size_t node_start = 0;      // the first thread of the current node
+
+    for (unsigned int i = 0; i < threads; ++i) {
+        size_t node = size_t(i) * nodes / threads;
+        if ((i == 0) || (node != size_t(i - 1) * nodes / threads)) {
+            node_start = i;
+        }
+        const vector<unsigned int> &node_cpus = topology.nodes[node];
+        cpus.push_back(node_cpus[(i - node_start) % node_cpus.size()]);
+    }
+    return cpus;
+}
+
+static bool pin_thread(unsigned int cpu) {
+
+    // PRE:  none
+    //
+    // POST: see the prototype
+
+    if (cpu >= CPU_SETSIZE) {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+
+
+column_writer::column_writer()
+    : fd(-1), type(COLUMN_NONE), written(0), length(0), null_count(0),
+      failed(false) {
+
+    // PRE:  none
+    //
+    // POST: the writer is not yet open
+}
+
+column_writer::~column_writer() {
+
+    // PRE:  none
+    //
+    // POST: the file has been closed, if it was still open; it is left
+    //       without a header unless close() was called
+
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+bool column_writer::open(const char *path, column_type type) {
+
+    // PRE:  the writer is not yet open, and type is not COLUMN_NONE
+    //
+    // POST: see the class declaration
+
+    fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        return false;
+    }
+    this->type = type;
+
+    // leave room for the header, which is only written once the
+    // lengths of the buffers are known
+    column_header header = {};
+    return write_all(reinterpret_cast<const char *>(&header),
+                     sizeof(header));
+}
+
+void column_writer::append(const chunk_result &result) {
+
+    // PRE:  see the class declaration
+    //
+    // POST: see the class declaration
+
+    if constexpr (endian::native == endian::little) {
+        write_all(result.column.data(), result.column.size());
+    } else {
+        string swapped = result.column;
+        make_little_endian(swapped.data(), swapped.data() + swapped.size(),
+                           width());
+        write_all(swapped.data(), swapped.size());
+    }
+    written += result.column.size();
+    append_bits(validity, length, result.validity.data(), result.slots);
+    null_count += result.slots;
+    for (size_t i = 0; i < result.validity.size(); ++i) {
+        null_count -= __builtin_popcountll(result.validity[i]);
+    }
+}
+
+bool column_writer::close() {
+
+    // PRE:  see the class declaration
+    //
+    // POST: see the class declaration
+
+    static const char PADDING[64] = {};
+
+    // pad the values out to a 64-byte boundary, and then write the
+    // bitmap, padded the same way
+    uint64_t values_end = sizeof(column_header) + written;
+    uint64_t validity_offset = (values_end + 63) / 64 * 64;
+    uint64_t validity_size = (length + 7) / 8;
+
+    // the bitmap is kept in 64-bit words, with value i in bit (i % 64)
+    // of word (i / 64), which is bit (i % 8) of byte (i / 8) once the
+    // words are little-endian
+    for (uint64_t &word : validity) {
+        word = little_endian(word);
+    }
+    write_all(PADDING, validity_offset - values_end);
+    write_all(reinterpret_cast<const char *>(validity.data()), validity_size);
+    write_all(PADDING, (validity_size + 63) / 64 * 64 - validity_size);
+
+    // fill in the header now that everything after it is known
+    column_header header = {};
+    memcpy(header.magic, "CDVCOL1", 8);
+    header.type = little_endian(uint32_t(type));
+    header.width = little_endian(width());
+    header.length = little_endian(length);
+    header.null_count = little_endian(null_count);
+    header.values_offset = little_endian(uint64_t(sizeof(column_header)));
+    header.validity_offset = little_endian(validity_offset);
+    if (pwrite(fd, &header, sizeof(header), 0) != ssize_t(sizeof(header))) {
+        failed = true;
+    }
+
+    if (::close(fd) != 0) {
+        failed = true;
+    }
+    fd = -1;
+    return ! failed;
+}
+
+bool column_writer::write_all(const char *data, size_t size) {
+
+    // PRE:  the file is open
+    //
+    // POST: data has been written to the file and true returned, or a
+    //       write has failed and false returned
+
+    while (size != 0) {
+        ssize_t count = write(fd, data, size);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            failed = true;
+            return false;
+        }
+        data += count;
+        size -= count;
+    }
+    return true;
+}
+
+template <typename T>
+static T little_endian(T value) {
+
+    // PRE:  T is a 32-bit or a 64-bit unsigned whole number type
+    //
+    // POST: see the prototype
+
+    if constexpr (endian::native == endian::little) {
+        return value;
+    } else if constexpr (sizeof(T) == 4) {
+        return __builtin_bswap32(value);
+    } else {
+        return __builtin_bswap64(value);
+    }
+}
+
+static void make_little_endian(char *first, char *last, uint32_t width) {
+
+    // PRE:  last - first is a multiple of width
+    //
+    // POST: see the prototype
+
+    if constexpr (endian::native != endian::little) {
+        for (; first != last; first += width) {
+            reverse(first, first + width);
+        }
+    }
+}
+
+template <typename T>
+static constexpr column_type column_type_of() {
+
+    // PRE:  none
+    //
+    // POST: the column_type that holds T values has been returned, or
+    //       COLUMN_NONE if columns cannot hold them
+
+    if constexpr (is_same_v<T, int> || is_same_v<T, long int>) {
+        return (sizeof(T) == 8) ? COLUMN_INT64 : COLUMN_INT32;
+    } else if constexpr (is_same_v<T, float>) {
+        return COLUMN_FLOAT32;
+    } else if constexpr (is_same_v<T, double>) {
+        return COLUMN_FLOAT64;
+    } else {
+        return COLUMN_NONE;
+    }
+}
+
+column_type column_type_named(const string &type) {
+
+    // PRE:  none
+    //
+    // POST: the column_type that holds values of the batch data type
+    //       named by type has been returned, or COLUMN_NONE if there
+    //       is none
+
+    if (type == "int") {
+        return column_type_of<int>();
+    } else if (type == "long") {
+        return column_type_of<long int>();
+    } else if (type == "float") {
+        return column_type_of<float>();
+    } else if (type == "double") {
+        return column_type_of<double>();
+    } else if (type == "element") {
+        return column_type_of<element>();
+    }
+    return COLUMN_NONE;
+}
+
+static void append_bits(vector<uint64_t> &bits, uint64_t &size,
+                        const uint64_t *source, size_t count) {
+
+    // PRE:  bits holds a bitmap of size bits, with any bits after
+    //       those clear, and source holds a bitmap of count bits
+    //
+    // POST: the count bits of source have been appended to bits, and
+    //       size has been updated
+
+    size_t shift = size % 64;
+    size_t words = (count + 63) / 64;
+
+    bits.resize((size + count + 63) / 64, 0);
+    uint64_t *destination = bits.data() + size / 64;
+
+    for (size_t i = 0; i < words; ++i) {
+
+        // leave out any bits of source after the last one
+        uint64_t word = source[i];
+        if ((i == words - 1) && (count % 64 != 0)) {
+            word &= (uint64_t(1) << (count % 64)) - 1;
+        }
+
+        destination[i] |= word << shift;
+        if ((shift != 0) && ((word >> (64 - shift)) != 0)) {
+            destination[i + 1] |= word >> (64 - shift);
+        }
+    }
+    size += count;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+
+
+validation_cache::validation_cache()
+    : mapping(nullptr), length(0), slots(nullptr), mask(0), hit_count(0),
+      miss_count(0) {
+
+    // PRE:  none
+    //
+    // POST: the cache is not yet open
+}
+
+validation_cache::~validation_cache() {
+
+    // PRE:  none
+    //
+    // POST: the file has been unmapped, which leaves the entries written
+    //       to it for the next run
+
+    if (mapping != nullptr) {
+        munmap(mapping, length);
+    }
+}
+
+bool validation_cache::open(const char *path, uint64_t expected_records) {
+
+    // PRE:  the cache is not yet open
+    //
+    // POST: see the class declaration
+
+    int fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        return false;
+    }
+
+    // room for every expected record with the slots no more than half
+    // full, within reason
+    uint64_t slot_count = uint64_t(1) << 16;
+    while ((slot_count < 2 * expected_records)
+           && (slot_count < (uint64_t(1) << 28))) {
+        slot_count *= 2;
+    }
+
+    // use the file as it is if it is a cache of this version that is
+    // large enough, or else make it again
+    cache_header header = {};
+    struct stat status;
+    bool usable =
+        (fstat(fd, &status) == 0)
+        && (pread(fd, &header, sizeof(header), 0) == ssize_t(sizeof(header)))
+        && (memcmp(header.magic, "CDVCACH", 8) == 0)
+        && (header.version == VALIDATION_CACHE_VERSION)
+        && (header.slot_count != 0)
+        && ((header.slot_count & (header.slot_count - 1)) == 0)
+        && (header.slot_count >= slot_count / 2)
+        && (uint64_t(status.st_size)
+            == sizeof(header) + header.slot_count * sizeof(slot));
+
+    if (! usable) {
+        header = {};
+        memcpy(header.magic, "CDVCACH", 8);
+        header.version = VALIDATION_CACHE_VERSION;
+        header.slot_count = slot_count;
+        if ((ftruncate(fd, 0) != 0)
+            || (ftruncate(fd, sizeof(header) + slot_count * sizeof(slot))
+                != 0)
+            || (pwrite(fd, &header, sizeof(header), 0)
+                != ssize_t(sizeof(header)))) {
+            int error = errno;
+            ::close(fd);
+            errno = error;
+            return false;
+        }
+    }
+
+    length = sizeof(header) + header.slot_count * sizeof(slot);
+    mapping = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, 0);
+    int error = errno;
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        mapping = nullptr;
+        errno = error;
+        return false;
+    }
+    slots = reinterpret_cast<slot *>(static_cast<char *>(mapping)
+                                     + sizeof(header));
+    mask = header.slot_count - 1;
+    return true;
+}
+
+bool validation_cache::find(uint64_t key, validation_outcome &outcome,
+                            uint64_t &payload) const {
+
+    // PRE:  see the class declaration
+    //
+    // POST: see the class declaration
+    //
+    // the low two bits of a tag hold the outcome; the bit above them is
+    // always set in a key, so that an empty slot never matches one
+
+    uint64_t wanted = (key & ~uint64_t(3)) | 4;
+
+    for (size_t probe = 0; probe < PROBES; ++probe) {
+        slot &entry = slots[((key >> 2) + probe) & mask];
+        uint64_t tag = atomic_ref<uint64_t>(entry.tag).load(
+            memory_order_relaxed);
+        uint64_t value = atomic_ref<uint64_t>(entry.payload).load(
+            memory_order_relaxed);
+        uint64_t unmixed = tag ^ mix_hash(value);
+
+        if ((unmixed & ~uint64_t(3)) == wanted) {
+            outcome = validation_outcome(unmixed & 3);
+            payload = value;
+            return true;
+        }
+        if ((tag == 0) && (value == 0)) {
+            return false;
+        }
+    }
+    return false;
+}
+
+void validation_cache::insert(uint64_t key, validation_outcome outcome,
+                              uint64_t payload) {
+
+    // PRE:  see the class declaration
+    //
+    // POST: see the class declaration
+    //
+    // the entry goes in the first empty slot it may be found in, or if
+    // there is none, in place of the entry in the first of them
+
+    uint64_t wanted = (key & ~uint64_t(3)) | 4;
+    slot *chosen = &slots[(key >> 2) & mask];
+
+    for (size_t probe = 0; probe < PROBES; ++probe) {
+        slot &entry = slots[((key >> 2) + probe) & mask];
+        if ((atomic_ref<uint64_t>(entry.tag).load(memory_order_relaxed) == 0)
+            && (atomic_ref<uint64_t>(entry.payload).load(
+                    memory_order_relaxed) == 0)) {
+            chosen = &entry;
+            break;
+        }
+    }
+
+    atomic_ref<uint64_t>(chosen->payload).store(payload,
+                                                memory_order_relaxed);
+    atomic_ref<uint64_t>(chosen->tag).store(
+        (wanted | outcome) ^ mix_hash(payload), memory_order_relaxed);
+}
+
+void validation_cache::count(uint64_t hits, uint64_t misses) {
+
+    // PRE:  none
+    //
+    // POST: see the class declaration
+
+    hit_count += hits;
+    miss_count += misses;
+}
+
+static uint64_t hash_record(const char *first, const char *last,
+                            uint64_t seed) {
+
+    // PRE:  first and last delimit a range of characters
+    //
+    // POST: a 64-bit hash of the characters and of seed has been
+    //       returned
+    //
+    // the characters are taken eight at a time, so that hashing a
+    // record costs less than parsing it
+
+    const uint64_t MULTIPLIER = 0x9e3779b97f4a7c15ULL;
+    uint64_t h = mix_hash(seed ^ uint64_t(last - first));
+
+    while (last - first >= 8) {
+        uint64_t word;
+        memcpy(&word, first, 8);
+        h = (h ^ word) * MULTIPLIER;
+        h ^= h >> 29;
+        first += 8;
+    }
+    if (first != last) {
+        uint64_t word = 0;
+        memcpy(&word, first, last - first);
+        h = (h ^ word) * MULTIPLIER;
+        h ^= h >> 29;
+    }
+    return mix_hash(h);
+}
+
+template <typename T>
+static uint64_t check_fingerprint(T low, T high, const char *parser) {
+
+    // PRE:  parser names the parser used, such as "parse_value";
+    //       whether strict mode is on is taken into account as well
+    //
+    // the name, rather than anything the compiler makes up for the
+    // parser, such as its typeid, is hashed, so that a cache keeps its
+    // entries from one build of the program to the next; it is
+    // VALIDATION_CACHE_VERSION that tells when they can no longer be
+    // used
+    //
+    // POST: a hash of everything that the outcome of type-checking a
+    //       record with the check depends on, other than the record
+    //       itself, has been returned
+
+    const char *name = element_traits<T>::NAME;
+    uint64_t h = hash_record(name, name + strlen(name),
+                             VALIDATION_CACHE_VERSION);
+    h = hash_record(parser, parser + strlen(parser), h);
+
+    if constexpr (is_same_v<T, string_view>) {
+        h = hash_record(low.data(), low.data() + low.size(), h);
+        h = hash_record(high.data(), high.data() + high.size(), h);
+    } else {
+        h = hash_record(reinterpret_cast<const char *>(&low),
+                        reinterpret_cast<const char *>(&low + 1), h);
+        h = hash_record(reinterpret_cast<const char *>(&high),
+                        reinterpret_cast<const char *>(&high + 1), h);
+    }
+    return mix_hash(h ^ (strict_tokens ? 1 : 2));
+}
+
+template <typename T>
+static uint64_t encode_cached(const T &value, const char *record) {
+
+    // PRE:  value was parsed from the record starting at record
+    //
+    // POST: value has been returned as the payload of a cache entry; a
+    //       string_view, which refers to characters of the record, is
+    //       kept as their offset and length in it
+
+    if constexpr (is_same_v<T, string_view>) {
+        return (uint64_t(value.data() - record) << 32) | value.size();
+    } else {
+        static_assert(is_trivially_copyable_v<T> && (sizeof(T) <= 8),
+                      "only values of up to 8 bytes can be cached");
+        uint64_t payload = 0;
+        memcpy(&payload, &value, sizeof(T));
+        return payload;
+    }
+}
+
+template <typename T>
+static bool decode_cached(uint64_t payload, const char *first,
+                          const char *last, T &value) {
+
+    // PRE:  first and last delimit a record, and payload is the payload
+    //       of a cache entry found for it
+    //
+    // POST: if the payload could have been returned by encode_cached()
+    //       for the record, the value that was encoded has been stored
+    //       in value and true returned; otherwise false has been
+    //       returned
+    //
+    // the cache file is read back from disk, so its entries are not
+    // trusted: a string_view whose offset and length would reach past
+    // the end of the record is refused rather than used
+
+    if constexpr (is_same_v<T, string_view>) {
+        uint64_t offset = payload >> 32;
+        uint64_t length = uint32_t(payload);
+        if (offset + length > uint64_t(last - first)) {
+            return false;
+        }
+        value = string_view(first + offset, length);
+    } else {
+        memcpy(&value, &payload, sizeof(T));
+    }
+    return true;
+}
+
+template <typename T, typename Parse>
+static validation_outcome parse_with_cache(validation_cache &cache,
+                                           const char *first, const char *last,
+                                           uint64_t key, Parse parse, T &value,
+                                           uint64_t &hits, uint64_t &misses) {
+
+    // PRE:  cache is open, first and last delimit a record,
+    //       parse is a parser like that of validate_column(), and key
+    //       is the hash of the record seeded with the fingerprint
+    //       given by check_fingerprint() for parse
+    //
+    // POST: the outcome of parse for the record has been returned, and
+    //       if it is VALID, the value stored in value, taken from the
+    //       cache if it has an entry for the record, or otherwise
+    //       parsed and added to it; hits or misses has been counted
+
+    validation_outcome outcome;
+    uint64_t payload;
+
+    // an entry whose value cannot be decoded is treated as a miss, and
+    // replaced with the outcome of parsing the record again
+    if (cache.find(key, outcome, payload)
+        && ((outcome != VALID)
+            || decode_cached(payload, first, last, value))) {
+        ++hits;
+        return outcome;
+    }
+
+    ++misses;
+    const char *end;
+    outcome = parse(first, last, value, end);
+    cache.insert(key, outcome,
+                 (outcome == VALID) ? encode_cached(value, first) : 0);
+    return outcome;
+}
+
+
+template <typename T>
+static void append_whole_number(string &out, T value) {
+
+    // PRE:  none
+    //
+    // POST: value has been appended to out just as cout << would
+    //       display it
+
+    char digits[24];
+    to_chars_result result = to_chars(digits, digits + sizeof(digits), value);
+    out.append(digits, result.ptr);
+}
+
+template <typename T>
+static void append_fractional_number(string &out, T value) {
+
+    // PRE:  none
+    //
+    // POST: value has been appended to out just as cout << would
+    //       display it, with six significant digits
+
+    char digits[32];
+    to_chars_result result = to_chars(digits, digits + sizeof(digits), value,
+                                      chars_format::general, 6);
+    out.append(digits, result.ptr);
+}
+
+void append_value(string &out, int value) {
+    append_whole_number(out, value);
+}
+
+void append_value(string &out, long int value) {
+    append_whole_number(out, value);
+}
+
+void append_value(string &out, float value) {
+    append_fractional_number(out, value);
+}
+
+void append_value(string &out, double value) {
+    append_fractional_number(out, value);
+}
+
+void append_value(string &out, char value) {
+    out += value;
+}
+
+void append_value(string &out, bool value) {
+    out += value ? "true" : "false";
+}
+
+void append_value(string &out, const string &value) {
+    out += value;
+}
+
+void append_value(string &out, string_view value) {
+    out += value;
+}
+
+template <typename T, typename Parse, typename Allow>
+static void validate_column(const char *first, const char *last, T low, T high,
+                            const char *parser, Parse parse, Allow allow,
+                            const batch_options &options,
+                            chunk_result &result) {
+
+    // PRE:  first and last delimit a run of whole records, which
+    //       starts at result.first_offset in the input, and on line
+    //       result.first_line if options.rejections logs them;
+    //       parse(first, last, value) type-checks a record like
+    //       validate_by_rule(), returning VALID, INVALID_TYPE, or
+    //       INVALID_RANGE, and parser names it, for the outcome
+    //       cache; and allow(value) tells whether a value within the
+    //       range of low to high is to be accepted
+    //
+    // POST: every record that parse accepts, is within the range of
+    //       low to high, and is allowed, has been appended to
+    //       result.accepted, one per line, or to result.column if the
+    //       output is columnar, the accepted and rejected counts of
+    //       result have been updated, and every rejected record has
+    //       been logged to options.rejections, if it is set
+
+    // the records are validated in batches: each batch is first
+    // type-checked into a column of values, which is then
+    // range-checked as a whole by the range-check kernel
+    //
+    // where each value came from is kept alongside the column, so that
+    // a value rejected by the kernel can still be logged
+    struct record_span {
+        const char *first;
+        const char *last;
+        uint64_t line;
+        bool typed;         // whether the record held a T value
+    };
+
+    unique_ptr<T[]> values(new T[BATCH_SIZE]);
+    unique_ptr<record_span[]> spans(new record_span[BATCH_SIZE]);
+    uint64_t bitmap[BATCH_SIZE / 64];
+    uint64_t accepted[BATCH_SIZE / 64];
+    const char *start = first;
+    uint64_t line = result.first_line;
+
+    // columns can only hold numbers, and if the output is columnar, a
+    // record that is not a T still takes up a place in the column, so
+    // that every value keeps the position of its record
+    bool columnar = false;
+    if constexpr (column_type_of<T>() != COLUMN_NONE) {
+        columnar = (options.columns != nullptr);
+    }
+
+    // what is counted here is only added to the counters of the thread
+    // once the whole run has been validated
+    parse_timer timer;
+    uint64_t type_rejected = 0;
+    uint64_t range_rejected = 0;
+    uint64_t skipped = 0;
+    long accepted_before = result.accepted_count;
+
+    // if there is an outcome cache, the records are looked up in it
+    // under the fingerprint of this check; the keys of the next few
+    // records are worked out ahead of time, and their slots fetched
+    // while the records before them are being validated, so that a
+    // lookup seldom has to wait for memory
+    const size_t KEYS_AHEAD = 16;       // a power of two
+    uint64_t keys[KEYS_AHEAD];
+    size_t keys_made = 0;
+    size_t keys_used = 0;
+    const char *ahead = first;          // the next record to make a key
+                                        // for
+    uint64_t fingerprint = 0;
+    uint64_t cache_hits = 0;
+    uint64_t cache_misses = 0;
+    validation_cache *cache = options.cache;
+    rejection_log *rejections = options.rejections;
+    if (cache != nullptr) {
+        fingerprint = check_fingerprint(low, high, parser);
+    }
+
+    // runs of records that hold nothing but a char or bool value are
+    // validated by the flag kernels instead, and copied to the output
+    // just as they are; each record that breaks a run is left to the
+    // code below, in a batch of its own, before the next run is looked
+    // for (unless there is an outcome cache, which the kernels would
+    // only slow down)
+    constexpr bool FLAGS = is_same_v<T, char> || is_same_v<T, bool>;
+    bool flags = FLAGS && (cache == nullptr);
+    flag_table table;
+    if constexpr (FLAGS) {
+        table = make_flag_table(low, high, allow);
+    }
+
+    // log a rejected record with its position in the input
+    auto reject = [&](validation_outcome reason, const record_span &span) {
+        ++result.rejected_count;
+        ++((reason == INVALID_RANGE) ? range_rejected : type_rejected);
+        skipped += span.last - span.first;
+        if (rejections != nullptr) {
+            rejections->record(result.first_offset + (span.first - start),
+                               span.line, reason, span.first, span.last);
+        }
+    };
+
+    while (first != last) {
+        size_t count = 0;
+
+        if (flags) {
+            const char *run = first;
+            size_t records = 0;
+            if constexpr (is_same_v<T, char>) {
+                first = accept_char_run(first, last, table, records);
+            } else if constexpr (is_same_v<T, bool>) {
+                first = accept_bool_run(first, last, table, records);
+            }
+            result.accepted.append(run, first - run);
+            result.accepted_count += records;
+            line += records;
+            if (first == last) {
+                break;
+            }
+        }
+
+        // type-check up to a batch of records into the column,
+        // rejecting those that are not T values
+        while ((count < BATCH_SIZE) && (first != last)) {
+            const char *newline = find_delimiter(first, last, '\n');
+            record_span span = { first, newline, line++, true };
+            const char *end;
+            uint64_t key = 0;
+
+            first = (newline == last) ? last : newline + 1;
+
+            if (cache != nullptr) {
+                while ((keys_made - keys_used < KEYS_AHEAD)
+                       && (ahead != last)) {
+                    const char *next = find_delimiter(ahead, last, '\n');
+                    keys[keys_made++ % KEYS_AHEAD] = cache->prefetch(
+                        hash_record(ahead, next, fingerprint));
+                    ahead = (next == last) ? last : next + 1;
+                }
+                key = keys[keys_used++ % KEYS_AHEAD];
+            }
+
+            // skip blank lines, just as cin >> skips over them in the
+            // interactive readers
+            if (skip_whitespace(span.first, newline) == newline) {
+                continue;
+            }
+
+            // attempt to get a value whose data type is a T from the
+            // record, using the same parsing engine as the
+            // interactive readers
+            validation_outcome outcome =
+                (cache != nullptr)
+                    ? parse_with_cache(*cache, span.first, newline, key,
+                                       parse, values[count], cache_hits,
+                                       cache_misses)
+                    : parse(span.first, newline, values[count], end);
+            if (outcome == VALID) {
+                spans[count++] = span;
+            } else {
+                reject(outcome, span);
+                if (columnar) {
+                    span.typed = false;
+                    values[count] = T();
+                    spans[count++] = span;
+                }
+            }
+            if (flags) {
+                break;
+            }
+        }
+
+        // range-check the whole column at once
+        range_check(values.get(), count, low, high, bitmap);
+
+        // collect each accepted value, in the order it was read
+        fill(accepted, accepted + (count + 63) / 64, 0);
+        for (size_t i = 0; i < count; ++i) {
+            if (! spans[i].typed) {
+                continue;
+            }
+            if (((bitmap[i / 64] >> (i % 64)) & 1) && allow(values[i])) {
+                accepted[i / 64] |= uint64_t(1) << (i % 64);
+                if (! columnar) {
+                    append_value(result.accepted, values[i]);
+                    result.accepted += '\n';
+                }
+                ++result.accepted_count;
+            } else {
+                reject(INVALID_RANGE, spans[i]);
+            }
+        }
+
+        // add the whole column to the columnar output in one piece
+        if (columnar) {
+            result.column.append(reinterpret_cast<const char *>(values.get()),
+                                 count * sizeof(T));
+            append_bits(result.validity, result.slots, accepted, count);
+        }
+    }
+
+    validation_counters &counters = thread_counters();
+    add_count(counters.accepted, result.accepted_count - accepted_before);
+    add_count(counters.type_rejections, type_rejected);
+    add_count(counters.range_rejections, range_rejected);
+    add_count(counters.bytes_skipped, skipped);
+    if (cache != nullptr) {
+        cache->count(cache_hits, cache_misses);
+    }
+}
+
+template <typename T>
+static void validate_records(const char *first, const char *last, T low,
+                             T high, const batch_options &options,
+                             chunk_result &result) {
+
+    // PRE:  first and last delimit a run of whole records
+    //
+    // POST: every record that is both a T and within the range of low
+    //       to high has been appended to result.accepted, one per
+    //       line, and the accepted and rejected counts of result have
+    //       been updated
+
+    validate_column(first, last, low, high, "parse_value",
+                    [](const char *record, const char *last, T &value,
+                       const char *&end) {
+                        end = parse_value(record, last, value);
+                        return (end == nullptr) ? INVALID_TYPE : VALID;
+                    },
+                    [](const T &) { return true; }, options, result);
+}
+
+template <auto Rule>
+static void validate_records_by_rule(const char *first, const char *last,
+                                     const batch_options &options,
+                                     chunk_result &result) {
+
+    // PRE:  first and last delimit a run of whole records
+    //
+    // POST: every record that Rule accepts has been appended to
+    //       result.accepted, one per line, the accepted and rejected
+    //       counts of result have been updated, and every rejected
+    //       record has been logged to options.rejections, if it is set
+
+    typedef typename decltype(Rule)::value_type T;
+
+    validate_column(first, last, closed_low<Rule>(), closed_high<Rule>(),
+                    "validate_by_rule",
+                    [](const char *record, const char *last, T &value,
+                       const char *&end) {
+                        return validate_by_rule<Rule>(record, last, value,
+                                                      end);
+                    },
+                    [](const T &value) { return Rule.in_set(value); },
+                    options, result);
+}
+
+template <typename Validate>
+static void batch_records(input_source &source, const batch_options &options,
+                          Validate validate) {
+
+    // PRE:  source holds zero or more records, and
+    //       validate(first, last, options, result) validates the run
+    //       of whole records from first up to last into result
+    //
+    // POST: every accepted record has been written to standard
+    //       output, one per line, or to the columnar output if there
+    //       is one, and a count of accepted and rejected records has
+    //       been written to standard error; or, if options.deliver is
+    //       set, the result of every chunk has been handed to it
+    //       instead, and nothing has been written
+    //
+    // the work is done in three stages that overlap: a reading thread
+    // takes blocks from the source, this thread and the pool validate
+    // them, and a writing thread writes out their results; a block is
+    // handed from stage to stage through a queue, and goes back to the
+    // reading thread once written, so that at most PIPELINE_DEPTH
+    // blocks are in flight and the slowest stage sets the pace
+    //
+    // if a stage throws, the others are told to stop, and the blocks
+    // already in flight are still passed along to the writing thread,
+    // which only hands them back, so that every stage can finish and
+    // both threads be joined before the first exception is passed on
+
+    const size_t END = PIPELINE_DEPTH;  // marks the end of the blocks
+    uint64_t block_offset = 0;  // the input offset of the block
+    uint64_t block_line = 1;    // the line number of its first record
+    long accepted_count = 0;
+    long rejected_count = 0;
+
+    // the pool is made first, so that if its threads cannot be started
+    // nothing else has been; it only pins this thread to the first of
+    // options.cpus, if they are given, once it runs the first block,
+    // so the reading and writing threads started below do not inherit
+    // that one processor to share with the first validating thread
+    thread_pool pool(options.threads, options.cpus);
+    vector<pipeline_batch> batches(PIPELINE_DEPTH);
+    spsc_queue<size_t> free_batches(PIPELINE_DEPTH + 1);
+    spsc_queue<size_t> read_batches(PIPELINE_DEPTH + 1);
+    spsc_queue<size_t> validated_batches(PIPELINE_DEPTH + 1);
+    for (size_t i = 0; i < PIPELINE_DEPTH; ++i) {
+        free_batches.push(i);
+    }
+    exception_ptr failure;      // the first exception a stage threw
+    mutex failure_lock;
+    atomic<bool> failed(false);
+    auto fail = [&](exception_ptr thrown) {
+        lock_guard<mutex> guard(failure_lock);
+        if (failure == nullptr) {
+            failure = thrown;
+        }
+        failed = true;
+    };
+
+    // there is no user to interact with, so stop cout from
+    // synchronising with C stdio, which would otherwise cost one
+    // system call per record; a program using this as a library gets
+    // the results without cout, and keeps its own stream settings
+    if (! options.deliver) {
+        ios::sync_with_stdio(false);
+    }
+
+    // read every block of records in the input source into a free
+    // batch, copying it unless the source keeps its blocks until they
+    // are released
+    thread reader([&] {
+        const char *first;
+        const char *last;
+        try {
+            while (! failed && source.next_block(first, last, BLOCK_SIZE)) {
+                size_t index = free_batches.pop();
+                pipeline_batch &batch = batches[index];
+                if (source.keeps_blocks()) {
+                    batch.first = first;
+                    batch.last = last;
+                } else {
+                    batch.input.assign(first, last);
+                    batch.first = batch.input.data();
+                    batch.last = batch.first + batch.input.size();
+                }
+                read_batches.push(index);
+            }
+        } catch (...) {
+            fail(current_exception());
+        }
+        read_batches.push(END);
+    });
+
+    // if the writing thread cannot be started, the blocks already read
+    // are handed straight back instead, until the reading thread stops
+    auto stop_reading = [&] {
+        fail(current_exception());
+        for (size_t index = read_batches.pop(); index != END;
+             index = read_batches.pop()) {
+            if (source.keeps_blocks()) {
+                source.release_block();
+            }
+            free_batches.push(index);
+        }
+        reader.join();
+    };
+
+    // write the accepted values of each chunk in their original
+    // order, without any flushes other than those needed when cout's
+    // buffer fills up, and hand the batch back to be read into again
+    thread writer;
+    try {
+        writer = thread([&] {
+            for (size_t index = validated_batches.pop(); index != END;
+                 index = validated_batches.pop()) {
+                try {
+                    for (const chunk_result &result :
+                         batches[index].results) {
+                        if (failed) {
+                            break;
+                        }
+                        if (options.deliver) {
+                            options.deliver(result);
+                        } else if (options.columns != nullptr) {
+                            options.columns->append(result);
+                        } else {
+                            cout.write(result.accepted.data(),
+                                       result.accepted.size());
+                        }
+                        accepted_count += result.accepted_count;
+                        rejected_count += result.rejected_count;
+                    }
+                } catch (...) {
+                    fail(current_exception());
+                }
+                if (source.keeps_blocks()) {
+                    source.release_block();
+                }
+                free_batches.push(index);
+            }
+        });
+    } catch (...) {
+        stop_reading();
+        throw;
+    }
+
+    // validate every block as it is read
+    auto validate_batch = [&](pipeline_batch &batch) {
+        const char *first = batch.first;
+        const char *last = batch.last;
+        vector<chunk_result> &results = batch.results;
+        vector<const char *> &bounds = batch.bounds;
+
+        // split the block into one chunk per thread, or into many
+        // small chunks if idle threads may steal them from busy ones,
+        // moving each boundary forward to the start of a record
+        size_t chunks = pool.size();
+        if (options.steal) {
+            chunks = max(chunks, (last - first) / STEAL_CHUNK_SIZE);
+        }
+
+        // the results of the batch's last block are emptied and used
+        // again, so that each thread goes on filling buffers it has
+        // already placed on its own node, rather than new ones
+        results.resize(chunks);
+        for (chunk_result &result : results) {
+            result.clear();
+        }
+        bounds.resize(chunks + 1);
+        bounds.front() = first;
+        bounds.back() = last;
+        for (size_t i = 1; i < chunks; ++i) {
+            const char *bound = first + (last - first) * i / chunks;
+            bound = max(bound, bounds[i - 1]);
+            bound = find_delimiter(bound, last, '\n');
+            bounds[i] = (bound == last) ? last : bound + 1;
+        }
+        for (size_t i = 0; i < chunks; ++i) {
+            results[i].first_offset = block_offset + (bounds[i] - first);
+        }
+        block_offset += last - first;
+
+        // if rejections are being logged, count the lines of the chunks
+        // on the threads of the pool, so that each chunk knows the line
+        // number of its first record
+        if (options.rejections != nullptr) {
+            pool.run(chunks, [&](size_t i) {
+                results[i].first_line =
+                    count_delimiters(bounds[i], bounds[i + 1], '\n');
+            });
+            for (chunk_result &result : results) {
+                uint64_t lines = result.first_line;
+                result.first_line = block_line;
+                block_line += lines;
+            }
+        }
+
+        // validate the chunks on the threads of the pool, each thread
+        // parsing in the strict mode of this call, for as long as it is
+        // validating for it
+        function<void(size_t)> task = [&](size_t i) {
+            bool strict = strict_tokens;
+            strict_tokens = options.strict;
+            try {
+                validate(bounds[i], bounds[i + 1], options, results[i]);
+            } catch (...) {
+                strict_tokens = strict;
+                throw;
+            }
+            strict_tokens = strict;
+        };
+        if (options.steal) {
+            pool.run_stealing(chunks, task);
+        } else {
+            pool.run(chunks, task);
+        }
+    };
+    for (size_t index = read_batches.pop(); index != END;
+         index = read_batches.pop()) {
+        if (! failed) {
+            try {
+                validate_batch(batches[index]);
+            } catch (...) {
+                fail(current_exception());
+            }
+        }
+        validated_batches.push(index);
+    }
+    validated_batches.push(END);
+    reader.join();
+    writer.join();
+    if (failure != nullptr) {
+        rethrow_exception(failure);
+    }
+
+    // write the summary
+    if (! options.deliver) {
+        cout << flush;
+        cerr << "Accepted " << accepted_count
+             << ", rejected " << rejected_count << endl;
+    }
+}
+
+template <typename T>
+static void batch_type_and_range_checking(input_source &source,
+                                          const batch_options &options,
+                                          T low, T high) {
+
+    // PRE:  source holds zero or more records
+    //
+    // POST: every record that is both a T and within the range of low
+    //       to high has been written to standard output, one per
+    //       line, and a count of accepted and rejected records has
+    //       been written to standard error
+
+    batch_records(source, options,
+                  [=](const char *first, const char *last,
+                      const batch_options &options, chunk_result &result) {
+                      validate_records(first, last, low, high, options,
+                                       result);
+                  });
+}
+
+template <typename T, typename Member>
+static void validate_records_in_set(const char *first, const char *last, T low,
+                                    T high, const allowed_set<Member> &allowed,
+                                    const batch_options &options,
+                                    chunk_result &result) {
+
+    // PRE:  first and last delimit a run of whole records
+    //
+    // POST: every record that is a T, within the range of low to high,
+    //       and a member of allowed has been appended to
+    //       result.accepted, one per line, and the accepted and
+    //       rejected counts of result have been updated; a value that
+    //       is not a member is rejected as out of range
+
+    validate_column(first, last, low, high, "parse_value",
+                    [](const char *record, const char *last, T &value,
+                       const char *&end) {
+                        end = parse_value(record, last, value);
+                        return (end == nullptr) ? INVALID_TYPE : VALID;
+                    },
+                    [&](const T &value) { return allowed.contains(value); },
+                    options, result);
+}
+
+template <typename T, typename Member>
+static void batch_in_set(input_source &source, const batch_options &options,
+                         T low, T high, const allowed_set<Member> &allowed) {
+
+    // PRE:  source holds zero or more records, and allowed outlives
+    //       the call
+    //
+    // POST: every record that is a T, within the range of low to high,
+    //       and a member of allowed has been written to standard
+    //       output, one per line, and a count of accepted and rejected
+    //       records has been written to standard error
+
+    batch_records(source, options,
+                  [=, &allowed](const char *first, const char *last,
+                                const batch_options &options,
+                                chunk_result &result) {
+                      validate_records_in_set(first, last, low, high,
+                                              allowed, options, result);
+                  });
+}
+
+template <auto Rule>
+static void batch_by_rule(input_source &source, const batch_options &options) {
+
+    // PRE:  source holds zero or more records
+    //
+    // POST: every record that Rule accepts has been written to
+    //       standard output, one per line, and a count of accepted
+    //       and rejected records has been written to standard error
+
+    batch_records(source, options,
+                  [](const char *first, const char *last,
+                     const batch_options &options, chunk_result &result) {
+                      validate_records_by_rule<Rule>(first, last, options,
+                                                     result);
+                  });
+}
+
+template <typename T>
+static void batch_elements(input_source &source,
+                           const batch_options &options) {
+
+    // PRE:  source holds zero or more records
+    //
+    // POST: every record that is both a T and within the range given
+    //       by its element_traits has been written to standard output,
+    //       one per line, and a count of accepted and rejected records
+    //       has been written to standard error
+    //
+    // this is a template, rather than part of batch_validate(), so
+    // that only the branch for the data type of T is compiled
+
+    if constexpr (is_arithmetic_v<T>) {
+        batch_by_rule<TRAITS_RULE<T>>(source, options);
+    } else {
+
+        // validate strings in place, without copying them
+        batch_type_and_range_checking<string_view>(source, options);
+    }
+}
+
+bool batch_validate(const string &type, input_source &source,
+                    const batch_options &options) {
+
+    // PRE:  source holds zero or more records
+    //
+    // POST: if type names one of the supported data types, every
+    //       record that is both of that data type and within its
+    //       range has been written to standard output, the accepted
+    //       and rejected counts to standard error, and true has been
+    //       returned; otherwise false has been returned
+    //
+    // int and float use the ranges of the int and float
+    // demonstrations (6 to 37, and 5.5 to 42.8), element uses the
+    // range of the element demonstrations, and every other data type
+    // uses the range given by its element_traits, unless a loaded rule
+    // of the same name gives another
+
+    const loaded_rule *loaded = find_loaded_rule(type);
+
+    if (loaded != nullptr) {
+        loaded->batch(source, options);
+    } else if (type == "int") {
+        batch_by_rule<INT_DEMO_RULE>(source, options);
+    } else if (type == "long") {
+        batch_by_rule<TRAITS_RULE<long int>>(source, options);
+    } else if (type == "float") {
+        batch_by_rule<FLOAT_DEMO_RULE>(source, options);
+    } else if (type == "double") {
+        batch_by_rule<TRAITS_RULE<double>>(source, options);
+    } else if (type == "char") {
+        batch_by_rule<TRAITS_RULE<char>>(source, options);
+    } else if (type == "bool") {
+        batch_by_rule<TRAITS_RULE<bool>>(source, options);
+    } else if (type == "string") {
+        batch_type_and_range_checking<string_view>(source, options);
+    } else if (type == "element") {
+        batch_elements<element>(source, options);
+    } else if ((type == "record") && ! options.fields.empty()) {
+        batch_fields(source, options);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static uint64_t mix_hash(uint64_t h) {
+
+    // PRE:  none
+    //
+    // POST: the bits of h have been mixed, so that each one of them
+    //       affects every bit of the value returned (this is the
+    //       finalizer of MurmurHash3)
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+uint64_t hash_key(string_view key, uint64_t seed) {
+
+    // PRE:  none
+    //
+    // POST: see the prototype; the characters are combined as by
+    //       FNV-1a, starting from the mixed seed
+
+    uint64_t h = 0xcbf29ce484222325ULL ^ mix_hash(seed);
+    for (char c : key) {
+        h ^= (unsigned char) c;
+        h *= 0x100000001b3ULL;
+    }
+    return mix_hash(h);
+}
+
+uint64_t hash_key(long long int key, uint64_t seed) {
+
+    // PRE:  none
+    //
+    // POST: see the prototype
+
+    return mix_hash(uint64_t(key) ^ mix_hash(seed + 0x9e3779b97f4a7c15ULL));
+}
+
+
+template <typename T>
+static bool parse_members(const vector<string> &texts,
+                          allowed_set<T> &allowed) {
+
+    // PRE:  has_allowed_sets<T>
+    //
+    // POST: if every one of texts is a T value, allowed holds those
+    //       values and true has been returned; otherwise false has
+    //       been returned
+
+    vector<T> values(texts.size());
+
+    for (size_t i = 0; i < texts.size(); ++i) {
+        const char *first = texts[i].data();
+        const char *last = first + texts[i].size();
+        const char *end = parse_value(first, last, values[i]);
+        if ((end == nullptr) || (skip_whitespace(end, last) != last)) {
+            return false;
+        }
+    }
+    allowed.assign(move(values));
+    return true;
+}
+
+
+template <typename T>
+static bool parse_bounds(const vector<string> &bounds, T &low, T &high) {
+
+    // PRE:  bounds is empty, or holds the text of a low and a high
+    //       bound
+    //
+    // POST: if bounds is empty, true has been returned; if both of its
+    //       bounds are T values, they have been stored in low and high
+    //       and true has been returned; otherwise false has been
+    //       returned
+
+    if (bounds.empty()) {
+        return true;
+    }
+    if (bounds.size() != 2) {
+        return false;
+    }
+    for (int i = 0; i < 2; ++i) {
+        const char *first = bounds[i].data();
+        const char *last = first + bounds[i].size();
+        const char *end = parse_value(first, last, (i == 0) ? low : high);
+        if ((end == nullptr) || (skip_whitespace(end, last) != last)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename T>
+static void make_field_rule(const string &type, T low, T high,
+                            field_rule &rule,
+                            shared_ptr<const allowed_set<T>> allowed) {
+
+    // PRE:  none
+    //
+    // POST: rule checks for T values within the range of low to high,
+    //       which must also be members of allowed if it is given
+
+    rule.type = type;
+    rule.check = [low, high, allowed](const char *first, const char *last,
+                                      string &out) {
+        const char *end;
+
+        // a string is checked in place, so that no memory is
+        // allocated for it
+        if constexpr (is_same_v<T, string>) {
+            string_view value;
+            validation_outcome outcome =
+                validate_value(first, last, string_view(low),
+                               string_view(high), value, end);
+            if ((outcome == VALID) && allowed
+                && ! allowed->contains(value)) {
+                outcome = INVALID_RANGE;
+            }
+            if (outcome == VALID) {
+                append_value(out, value);
+            }
+            return outcome;
+        } else {
+            T value;
+            validation_outcome outcome =
+                validate_value(first, last, low, high, value, end);
+            if constexpr (has_allowed_sets<T>) {
+                if ((outcome == VALID) && allowed
+                    && ! allowed->contains(value)) {
+                    outcome = INVALID_RANGE;
+                }
+            }
+            if (outcome == VALID) {
+                append_value(out, value);
+            }
+            return outcome;
+        }
+    };
+}
+
+template <typename T>
+static bool make_loaded_rule(const string &name, const string &type, T low,
+                             T high, const vector<string> &bounds,
+                             const vector<string> &members,
+                             loaded_rule &rule) {
+
+    // PRE:  bounds is empty, or holds the text of a low and a high
+    //       bound
+    //
+    // POST: if bounds is empty, or both of its bounds are T values,
+    //       and members is empty, or T values can be given a set of
+    //       allowed values and every one of members is a T value,
+    //       rule is named name and checks for T values within the
+    //       range of low to high, or from the given low bound to the
+    //       given high bound, that are also among the members if any
+    //       are given, calling rule.demonstrate gives any
+    //       demonstration named name that uses T values the same
+    //       range and members, and true has been returned; otherwise
+    //       false has been returned
+
+    // strings are validated in place in batch mode
+    typedef conditional_t<is_same_v<T, string>, string_view, T> batch_type;
+    shared_ptr<allowed_set<T>> allowed;
+
+    if (! parse_bounds(bounds, low, high)) {
+        return false;
+    }
+    if (! members.empty()) {
+        if constexpr (has_allowed_sets<T>) {
+            allowed = make_shared<allowed_set<T>>();
+            if (! parse_members(members, *allowed)) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+
+    rule.name = name;
+    make_field_rule<T>(type, low, high, rule.field, allowed);
+    rule.batch = [low, high, allowed](input_source &source,
+                                      const batch_options &options) {
+        if constexpr (has_allowed_sets<T>) {
+            if (allowed != nullptr) {
+                batch_in_set<batch_type>(source, options, low, high,
+                                         *allowed);
+                return;
+            }
+        }
+        batch_type_and_range_checking<batch_type>(source, options, low,
+                                                  high);
+    };
+    rule.demonstrate = [name, low, high, allowed] {
+        set_demo_range(name, low, high, allowed.get());
+    };
+    return true;
+}
+
+template <auto Rule>
+static bool make_rule_by(const string &name, const string &type,
+                         const vector<string> &bounds,
+                         const vector<string> &members, loaded_rule &rule) {
+
+    // PRE:  see make_loaded_rule()
+    //
+    // POST: see make_loaded_rule(), where the range defaults to that
+    //       of Rule
+
+    return make_loaded_rule(name, type, closed_low<Rule>(),
+                            closed_high<Rule>(), bounds, members, rule);
+}
+
+static bool make_string_rule(const string &name, const string &type,
+                             const vector<string> &bounds,
+                             const vector<string> &members,
+                             loaded_rule &rule) {
+
+    // PRE:  see make_loaded_rule()
+    //
+    // POST: see make_loaded_rule(), where the range defaults to that
+    //       of the element_traits of string
+
+    return make_loaded_rule(name, type, string(element_traits<string>::LOW),
+                            string(element_traits<string>::HIGH), bounds,
+                            members, rule);
+}
+
+static bool make_element_rule(const string &name, const string &type,
+                              const vector<string> &bounds,
+                              const vector<string> &members,
+                              loaded_rule &rule) {
+
+    // PRE:  see make_loaded_rule()
+    //
+    // POST: see make_loaded_rule(), where the range defaults to
+    //       ELEMENT_LOW to ELEMENT_HIGH
+
+    return make_loaded_rule(name, type, ELEMENT_LOW, ELEMENT_HIGH, bounds,
+                            members, rule);
+}
+
+static const rule_maker RULE_MAKERS[] = {
+    { "int", make_rule_by<INT_DEMO_RULE> },
+    { "long", make_rule_by<TRAITS_RULE<long int>> },
+    { "float", make_rule_by<FLOAT_DEMO_RULE> },
+    { "double", make_rule_by<TRAITS_RULE<double>> },
+    { "char", make_rule_by<TRAITS_RULE<char>> },
+    { "bool", make_rule_by<TRAITS_RULE<bool>> },
+    { "string", make_string_rule },
+    { "element", make_element_rule },
+    { nullptr, nullptr }
+};
+
+// the rules loaded from the rules file, if any
+static vector<loaded_rule> loaded_rules;
+
+int int_demo_low = INT_DEMO_RULE.low;
+int int_demo_high = INT_DEMO_RULE.high;
+float float_demo_low = FLOAT_DEMO_RULE.low;
+float float_demo_high = FLOAT_DEMO_RULE.high;
+element element_demo_low = ELEMENT_LOW;
+element element_demo_high = ELEMENT_HIGH;
+allowed_set<int> int_demo_set;
+allowed_set<element> element_demo_set;
+
+template <typename T>
+static void set_demo_range(const string &name, T low, T high,
+                           const allowed_set<T> *allowed) {
+
+    // PRE:  none
+    //
+    // POST: if name is int, float, or element, and T is the data type
+    //       of that demonstration, the demonstration uses the range of
+    //       low to high, and for int and element, the members of
+    //       allowed if it is given, or any value in the range if not;
+    //       otherwise nothing has changed
+    //
+    // the data type of each demonstration is fixed when the program is
+    // compiled, so a rule for a different data type cannot change it
+
+    if constexpr (is_same_v<T, int>) {
+        if (name == "int") {
+            int_demo_low = low;
+            int_demo_high = high;
+            int_demo_set = allowed ? *allowed : allowed_set<int>();
+        }
+    }
+    if constexpr (is_same_v<T, float>) {
+        if (name == "float") {
+            float_demo_low = low;
+            float_demo_high = high;
+        }
+    }
+    if constexpr (is_same_v<T, element>) {
+        if (name == "element") {
+            element_demo_low = low;
+            element_demo_high = high;
+            element_demo_set = allowed ? *allowed : allowed_set<element>();
+        }
+    }
+}
+
+static bool make_rule(const string &name, const string &spec,
+                      loaded_rule &rule) {
+
+    // PRE:  none
+    //
+    // POST: if spec has the form TYPE or TYPE:LOW:HIGH, where TYPE is
+    //       one of the batch data types and LOW and HIGH are values of
+    //       that data type, rule is named name and checks for values
+    //       of that data type within the range of LOW to HIGH, or if
+    //       they are not given, within the range the batch mode uses
+    //       for that data type, and true has been returned; otherwise
+    //       false has been returned
+    //
+    // either form may be followed by the word in and a list of allowed
+    // values separated by whitespace, as in "int:1:100 in 2 3 5 7", in
+    // which case a value must also be one of them to be accepted
+
+    vector<string> members;
+    size_t in = 0;
+
+    // look for the word in, which does not count where it is part of
+    // another word, such as string
+    while ((in = spec.find("in", in)) != string::npos) {
+        if ((in > 0) && is_whitespace(spec[in - 1])
+            && ((in + 2 == spec.size()) || is_whitespace(spec[in + 2]))) {
+            break;
+        }
+        ++in;
+    }
+    if (in != string::npos) {
+        const char *first = spec.data() + in + 2;
+        const char *last = spec.data() + spec.size();
+        while ((first = skip_whitespace(first, last)) != last) {
+            const char *end = first;
+            while ((end != last) && ! is_whitespace(*end)) {
+                ++end;
+            }
+            members.emplace_back(first, end);
+            first = end;
+        }
+        if (members.empty()) {
+            return false;
+        }
+    }
+
+    string head = spec.substr(0, in);
+    while (! head.empty() && is_whitespace(head.back())) {
+        head.pop_back();
+    }
+
+    vector<string> bounds;
+    size_t colon = head.find(':');
+    string type = head.substr(0, colon);
+
+    if (colon != string::npos) {
+        size_t second = head.find(':', colon + 1);
+        if ((second == string::npos)
+            || (head.find(':', second + 1) != string::npos)) {
+            return false;
+        }
+        bounds.push_back(head.substr(colon + 1, second - colon - 1));
+        bounds.push_back(head.substr(second + 1));
+    }
+
+    for (const rule_maker *maker = RULE_MAKERS; maker->type != nullptr;
+         ++maker) {
+        if (type == maker->type) {
+            return maker->make(name, type, bounds, members, rule);
+        }
+    }
+    return false;
+}
+
+const loaded_rule *find_loaded_rule(const string &name) {
+
+    // PRE:  none
+    //
+    // POST: the loaded rule named name has been returned, or a null
+    //       pointer if there is none
+
+    for (const loaded_rule &rule : loaded_rules) {
+        if (rule.name == name) {
+            return &rule;
+        }
+    }
+    return nullptr;
+}
+
+bool load_rules(const char *path, string &error) {
+
+    // PRE:  none
+    //
+    // POST: if path names a rules file, every rule in it has been
+    //       added to loaded_rules, the demonstrations have been given
+    //       the ranges of the rules named after them, and true has
+    //       been returned; otherwise error says what was wrong, false
+    //       has been returned, and nothing has changed
+    //
+    // each line of a rules file is blank, a comment starting with #,
+    // or a rule of the form
+    //
+    //     NAME = TYPE[:LOW:HIGH] [in VALUE...]
+    //
+    // where NAME is made up of letters, digits, and underscores; a
+    // later rule with the same name replaces an earlier one
+    //
+    // the whole file is checked before any of it is used, so that a
+    // mistake on one line leaves the rules and the demonstrations just
+    // as they were, rather than with the lines above it in force
+
+    mapped_file_source file;
+    const char *first;
+    const char *last;
+    unsigned long line = 0;
+    vector<loaded_rule> rules;
+
+    if (! file.open(path)) {
+        error = string(path) + ": " + strerror(errno);
+        return false;
+    }
+
+    while (file.next_record(first, last)) {
+        ++line;
+
+        // leave out the whitespace at either end, and any comment
+        first = skip_whitespace(first, last);
+        last = find_delimiter(first, last, '#');
+        while ((last != first) && is_whitespace(last[-1])) {
+            --last;
+        }
+        if (first == last) {
+            continue;
+        }
+
+        string text(first, last);
+        size_t equals = text.find('=');
+        string name = text.substr(0, min(equals, text.size()));
+        while (! name.empty() && is_whitespace(name.back())) {
+            name.pop_back();
+        }
+        string spec;
+        if (equals != string::npos) {
+            const char *value = text.data() + equals + 1;
+            const char *end = text.data() + text.size();
+            spec.assign(skip_whitespace(value, end), end);
+        }
+
+        bool named = ! name.empty();
+        for (char c : name) {
+            named = named && (isalnum((unsigned char) c) || (c == '_'));
+        }
+
+        loaded_rule rule;
+        if ((equals == string::npos) || ! named
+            || ! make_rule(name, spec, rule)) {
+            error = string(path) + ":" + to_string(line)
+                    + ": invalid rule, should be "
+                    + "NAME = TYPE[:LOW:HIGH] [in VALUE...]";
+            return false;
+        }
+        rules.push_back(rule);
+    }
+
+    for (const loaded_rule &rule : rules) {
+
+        // replace any earlier rule of the same name
+        const loaded_rule *earlier = find_loaded_rule(rule.name);
+        if (earlier != nullptr) {
+            loaded_rules[earlier - loaded_rules.data()] = rule;
+        } else {
+            loaded_rules.push_back(rule);
+        }
+        rule.demonstrate();
+    }
+    return true;
+}
+
+static bool parse_field_rule(const string &spec, field_rule &rule) {
+
+    // PRE:  none
+    //
+    // POST: if spec is the name of a loaded rule, rule is the field
+    //       rule of that loaded rule; otherwise, if spec is of a form
+    //       that make_rule() accepts, rule checks for what it gives;
+    //       in either case true has been returned; otherwise false has
+    //       been returned
+
+    const loaded_rule *loaded = find_loaded_rule(spec);
+    if (loaded != nullptr) {
+        rule = loaded->field;
+        return true;
+    }
+
+    loaded_rule made;
+    if (! make_rule("", spec, made)) {
+        return false;
+    }
+    rule = made.field;
+    return true;
+}
+
+bool parse_schema(const string &spec, vector<field_rule> &schema) {
+
+    // PRE:  none
+    //
+    // POST: if spec is a comma-separated list of one or more field
+    //       rules, each of the form parse_field_rule() accepts, schema
+    //       holds their rules in order and true has been returned;
+    //       otherwise false has been returned
+
+    schema.clear();
+    size_t start = 0;
+
+    while (true) {
+        size_t comma = spec.find(',', start);
+        field_rule rule;
+
+        if (! parse_field_rule(spec.substr(start, comma - start), rule)) {
+            return false;
+        }
+        schema.push_back(rule);
+        if (comma == string::npos) {
+            return true;
+        }
+        start = comma + 1;
+    }
+}
+
+static void validate_fields(const char *first, const char *last,
+                            const batch_options &options,
+                            chunk_result &result) {
+
+    // PRE:  first and last delimit a run of whole records, which
+    //       starts at result.first_offset in the input, and on line
+    //       result.first_line if rejections are being logged, and
+    //       options.fields holds the schema of a record
+    //
+    // POST: every record that has exactly as many fields as the
+    //       schema, each separated from the next by options.delimiter
+    //       and each accepted by the rule for it, has had its values
+    //       appended to result.accepted, separated the same way, one
+    //       record per line, the accepted and rejected counts of
+    //       result have been updated, and, if rejections are being
+    //       logged, every rejected record has been logged along with
+    //       the number of the field that failed
+
+    const vector<field_rule> &schema = options.fields;
+    const char delimiter = options.delimiter;
+    const char *start = first;
+    uint64_t line = result.first_line;
+
+    // what is counted here is only added to the counters of the thread
+    // once the whole run has been validated
+    parse_timer timer;
+    uint64_t type_rejected = 0;
+    uint64_t range_rejected = 0;
+    uint64_t skipped = 0;
+    long accepted_before = result.accepted_count;
+
+    while (first != last) {
+        const char *record = first;
+        const char *end = first;
+        uint64_t record_line = line++;
+        size_t mark = result.accepted.size();
+        validation_outcome outcome = VALID;
+        size_t field = 0;
+
+        // validate the fields of the record in a single scan of it,
+        // finding the end of each field and of the record itself with
+        // the same search
+        for (size_t i = 0; i < schema.size(); ++i) {
+            end = find_either_delimiter(first, last, delimiter, '\n');
+
+            // a record that ends before its last field, or goes on
+            // after it, does not have the data type of the schema
+            bool at_end = (end == last) || (*end == '\n');
+            if (at_end != (i + 1 == schema.size())) {
+                outcome = INVALID_TYPE;
+                field = i + 1;
+                break;
+            }
+
+            if (i != 0) {
+                result.accepted += delimiter;
+            }
+            outcome = schema[i].check(first, end, result.accepted);
+            if (outcome != VALID) {
+                field = i + 1;
+                break;
+            }
+            if (! at_end) {
+                first = end + 1;
+            }
+        }
+
+        // find the end of the record, if the fields stopped short of it
+        const char *newline = end;
+        if ((newline != last) && (*newline != '\n')) {
+            newline = find_delimiter(newline, last, '\n');
+        }
+        first = (newline == last) ? last : newline + 1;
+
+        if (outcome == VALID) {
+            result.accepted += '\n';
+            ++result.accepted_count;
+            continue;
+        }
+        result.accepted.resize(mark);
+
+        // skip blank lines, just as the single-value batch mode does
+        if (skip_whitespace(record, newline) == newline) {
+            continue;
+        }
+
+        ++result.rejected_count;
+        ++((outcome == INVALID_RANGE) ? range_rejected : type_rejected);
+        skipped += newline - record;
+        if (options.rejections != nullptr) {
+            options.rejections->record(result.first_offset
+                                           + (record - start),
+                                       record_line, outcome, record,
+                                       newline, field);
+        }
+    }
+
+    validation_counters &counters = thread_counters();
+    add_count(counters.accepted, result.accepted_count - accepted_before);
+    add_count(counters.type_rejections, type_rejected);
+    add_count(counters.range_rejections, range_rejected);
+    add_count(counters.bytes_skipped, skipped);
+}
+
+static void batch_fields(input_source &source, const batch_options &options) {
+
+    // PRE:  source holds zero or more records, and options.fields holds
+    //       the schema of a record
+    //
+    // POST: every record that the schema accepts has been written to
+    //       standard output, one per line, and a count of accepted and
+    //       rejected records has been written to standard error
+
+    batch_records(source, options,
+                  [](const char *first, const char *last,
+                     const batch_options &options, chunk_result &result) {
+                      validate_fields(first, last, options, result);
+                  });
+}
+
+
+//////////////////////////////////////////////////////////////////////
+
+
+// the library interface declared in validation.h, which runs the
+// batch validators on a buffer in memory and collects their results,
+// rather than writing them out
+//
+// every setting of a call travels in its own batch_options, and each
+// call starts threads of its own, so calls run at once; only the loaded
+// rules are shared, and a call holds them, through rules_lock, for as
+// long as it may be using one of them
+
+static shared_mutex rules_lock;
+
+bool load_validation_rules(const string &path, string &error) {
+
+    // PRE:  none
+    //
+    // POST: see validation.h
+
+    unique_lock<shared_mutex> guard(rules_lock);
+    return load_rules(path.c_str(), error);
+}
+
+bool validate_buffer(const validation_request &request, const char *first,
+                     const char *last, validation_result &result) {
+
+    // PRE:  see validation.h
+    //
+    // POST: see validation.h
+
+    shared_lock<shared_mutex> guard(rules_lock);
+    batch_options options;
+    rejection_log reject_log;
+    validation_cache cache;
+
+    result = validation_result();
+    if (! parse_thread_count(to_string(request.threads).c_str(),
+                             options.threads)) {
+        result.error = "Invalid thread count " +
+                       to_string(request.threads) + ", should be 0 to " +
+                       to_string(MAX_THREADS);
+        return false;
+    }
+    options.steal = request.steal;
+    options.delimiter = request.delimiter;
+    options.strict = request.strict;
+    if (! request.fields.empty() &&
+        ! parse_schema(request.fields, options.fields)) {
+        result.error = "Invalid fields " + request.fields;
+        return false;
+    }
+    if (! request.reject_log.empty()) {
+        if (! reject_log.open(request.reject_log.c_str())) {
+            result.error = "Cannot write " + request.reject_log + ": " +
+                           strerror(errno);
+            return false;
+        }
+        options.rejections = &reject_log;
+    }
+
+    // a new cache is made with room for every record of the buffer
+    if (! request.cache.empty()) {
+        if (! cache.open(request.cache.c_str(),
+                         count_delimiters(first, last, '\n') + 1)) {
+            result.error = "Cannot use cache " + request.cache + ": " +
+                           strerror(errno);
+            return false;
+        }
+        options.cache = &cache;
+    }
+
+    // collect the results of the chunks as they are delivered, one at
+    // a time and in their original order, by the writing stage
+    options.deliver = [&](const chunk_result &chunk) {
+        result.accepted.append(chunk.accepted);
+        result.accepted_count += chunk.accepted_count;
+        result.rejected_count += chunk.rejected_count;
+    };
+
+    memory_source source(first, last);
+    bool known = false;
+    try {
+        known = batch_validate(request.type, source, options);
+        if (! known) {
+            result.error = "Unknown type " + request.type;
+        }
+    } catch (const system_error &error) {
+        result.error = "Cannot start " + to_string(options.threads) +
+                       " threads: " + error.what();
+    }
+    result.cache_hits = cache.hits();
+    result.cache_misses = cache.misses();
+    return known;
+}
+
+}   // namespace validation
@@ -0,0 +1,76 @@
+/*
+
+validation.h
+
+The interface of the validators of main.cpp, for programs that link
+them in as a library instead of running the program once per batch.
+
+The library is validation.cpp, which holds the parsing engine and the
+batch validators that the program is built on (see the README);
+everything it defines is in the namespace validation. A buffer handed
+to validate_buffer() is treated just like a file given to batch mode:
+it holds zero or more newline-delimited records, and the accepted
+values come back one per line, in their original order.
+
+*/
+
+#ifndef VALIDATION_H
+#define VALIDATION_H
+
+#include <string>
+
+namespace validation {
+
+// what to validate a buffer as, with the same meanings as the batch
+// mode options of the same names
+struct validation_request {
+    std::string type = "int";   // a data type, or a loaded rule
+    std::string fields;         // the schema, if type is "record"
+    char delimiter = ',';       // what separates the fields
+    unsigned int threads = 1;   // the number of validating threads,
+                                // or 0 for one per processor
+    bool steal = false;         // whether idle threads steal chunks
+    bool strict = false;        // whether a record must be one token
+    std::string reject_log;     // where to log the rejected records
+                                // as JSON, if anywhere
+    std::string cache;          // the outcome cache file to use, if any
+};
+
+// what validating a buffer found
+struct validation_result {
+    std::string accepted;       // the accepted values, one per line
+    long accepted_count = 0;    // the number of accepted records
+    long rejected_count = 0;    // the number of rejected records
+    unsigned long cache_hits = 0;       // the records found in the
+    unsigned long cache_misses = 0;     // cache, and those parsed
+    std::string error;          // what was wrong with the request, if
+                                // it could not be carried out
+};
+
+// POST: if path names a rules file, its rules have been loaded, so
+//       that a request may name them, and true has been returned;
+//       otherwise error says what was wrong and false has been
+//       returned
+//
+// a call waits for the calls of validate_buffer() under way to finish,
+// and they wait for it
+bool load_validation_rules(const std::string &path, std::string &error);
+
+// PRE:  first and last delimit the characters of zero or more
+//       newline-delimited records, which are not changed during the
+//       call
+//
+// POST: if request could be carried out, result holds the accepted
+//       values of the records and the counts of accepted and rejected
+//       records, and true has been returned; otherwise result.error
+//       says why, and false has been returned
+//
+// calls from several threads run at once, each one on request.threads
+// threads of its own, except that calls naming the same cache must not,
+// since a call may make its file again
+bool validate_buffer(const validation_request &request, const char *first,
+                     const char *last, validation_result &result);
+
+}   // namespace validation
+
+#endif
@@ -0,0 +1,1390 @@
+/*
+
+validation_engine.h
+
+The parsing engine and the batch validators, which main.cpp and the
+library share. validation.cpp defines them; main.cpp builds the
+interactive readers, the demonstrations, and the benchmark, regression,
+and serve modes on top of them. Programs that link in the library
+include validation.h instead of this file.
+
+Everything here is in the namespace validation, so that linking the
+library into another program adds no names of its own to the global
+namespace, and the helpers that only validation.cpp uses are kept out
+of this file altogether, with internal linkage.
+
+*/
+
+#ifndef VALIDATION_ENGINE_H
+#define VALIDATION_ENGINE_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <sched.h>
+#include <unistd.h>
+
+#include "validation.h"
+
+namespace validation {
+
+// the following specializations of element_traits give, for each of
+// the standard primitive data types (int, long int, float, double,
+// char, bool, and string) it supports, the name shown to the user and
+// the range used for repetition range-checking data validation
+//
+// they are all fixed at compile time, so that a single program can
+// validate values of every one of these data types
+
+template <typename T>
+struct element_traits;
+
+template <>
+struct element_traits<int> {
+    static constexpr const char *NAME = "whole number";
+    static constexpr int LOW = 17;
+    static constexpr int HIGH = 52;
+};
+
+template <>
+struct element_traits<long int> {
+    static constexpr const char *NAME = "big whole number";
+    static constexpr long int LOW = 17;
+    static constexpr long int HIGH = 52;
+};
+
+template <>
+struct element_traits<float> {
+    static constexpr const char *NAME = "fractional number";
+    static constexpr float LOW = 28.6f;
+    static constexpr float HIGH = 73.2f;
+};
+
+template <>
+struct element_traits<double> {
+    static constexpr const char *NAME = "big fractional number";
+    static constexpr double LOW = 28.6;
+    static constexpr double HIGH = 73.2;
+};
+
+template <>
+struct element_traits<char> {
+    static constexpr const char *NAME = "character";
+    static constexpr char LOW = 'a';
+    static constexpr char HIGH = 'z';
+};
+
+template <>
+struct element_traits<bool> {
+    static constexpr const char *NAME = "boolean";
+    static constexpr bool LOW = false;
+    static constexpr bool HIGH = true;
+};
+
+template <>
+struct element_traits<std::string> {
+    static constexpr const char *NAME = "string";
+    static constexpr std::string_view LOW = "Alpha";
+    static constexpr std::string_view HIGH = "Omega";
+};
+
+// a string_view is a string that refers to the characters of the input
+// in place, instead of holding a copy of them, which lets the batch
+// mode validate strings without allocating memory for any of them
+template <>
+struct element_traits<std::string_view> : element_traits<std::string> {
+};
+
+
+// the following typedef statement and global constant declarations
+// are used by the demonstrations of repetition type-checking data
+// validation and repetition range-checking data validation for the
+// element data type
+//
+// change the typedef to any of the data types above to demonstrate
+// that data type instead
+
+typedef int element;
+const std::string ELEMENT_NAME = element_traits<element>::NAME;
+const element ELEMENT_LOW = element(element_traits<element>::LOW);
+const element ELEMENT_HIGH = element(element_traits<element>::HIGH);
+
+
+// a validation rule is a data type together with a range of values,
+// either end of which may be closed (including the bound itself) or
+// open (excluding it), and an optional set of allowed values; if the
+// set is given, a value must be both within the range and a member of
+// the set to be accepted
+//
+// validation rules are fixed at compile time and passed as template
+// arguments, so that the compiler can fold their bounds into the code
+// that checks them
+
+template <typename T, size_t N = 0>
+struct validation_rule {
+    typedef T value_type;
+
+    T low;
+    T high;
+    bool low_open = false;
+    bool high_open = false;
+    std::array<T, N> allowed = {};
+
+    constexpr bool in_range(T value) const {
+        return (low_open ? (value > low) : ! (value < low))
+               && (high_open ? (value < high) : ! (value > high));
+    }
+
+    constexpr bool in_set(T value) const {
+        if (N == 0) {
+            return true;
+        }
+        for (const T &member : allowed) {
+            if (member == value) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    constexpr bool accepts(T value) const {
+        return in_range(value) && in_set(value);
+    }
+};
+
+// the validation rules of the int and float demonstrations
+constexpr validation_rule<int> INT_DEMO_RULE{6, 37};
+constexpr validation_rule<float> FLOAT_DEMO_RULE{5.5f, 42.8f};
+
+// the validation rule given by the element_traits of a data type
+template <typename T>
+constexpr validation_rule<T> TRAITS_RULE{T(element_traits<T>::LOW),
+                                         T(element_traits<T>::HIGH)};
+
+// whether a set of allowed values can be given for values of T at run
+// time: whole numbers, characters, and strings can; fractional
+// numbers, whose equality is too fragile to list values for, and
+// bools, which have only two values, cannot
+template <typename T>
+constexpr bool has_allowed_sets =
+    (std::is_integral_v<T> && ! std::is_same_v<T, bool>)
+    || std::is_same_v<T, std::string>;
+
+// a set of allowed values given at run time, such as by a rules file,
+// which tells whether a value is one of its members in constant time
+// however many members it has, instead of comparing the value with
+// each member in turn
+//
+// a set of whole numbers or characters that lie close enough together
+// is kept as a bitset, one bit for each value from the smallest member
+// to the largest; any other set, including every set of strings, is
+// kept as a table indexed by a perfect hash of its members, which is
+// found when the set is assigned, so that a value is only ever
+// compared with the one member in the slot it hashes to
+template <typename T>
+class allowed_set {
+public:
+    // PRE:  has_allowed_sets<T>
+    //
+    // POST: the set holds exactly the members, less any duplicates
+    void assign(std::vector<T> values);
+
+    // PRE:  has_allowed_sets<T>, and value is a T, or a string_view if
+    //       T is a string
+    //
+    // POST: whether value is a member of the set has been returned
+    template <typename Key>
+    bool contains(const Key &value) const;
+
+    bool empty() const { return members.empty(); }
+    size_t size() const { return members.size(); }
+
+private:
+    bool place(size_t bucket_count, size_t slot_count);
+
+    std::vector<T> members;         // in ascending order
+    T smallest = T();               // the value of the first bit of bits
+    std::vector<uint64_t> bits;     // the bitset, if the set is one
+    std::vector<uint32_t> seeds;    // the seed of the hash of each bucket
+    std::vector<uint32_t> slots;    // one more than the index of the
+                                    // member in each slot, or 0 if it
+                                    // is empty
+};
+
+// the hash functions of the perfect hash tables, which give different
+// hashes of the same key for different seeds
+
+uint64_t hash_key(std::string_view key, uint64_t seed);
+
+uint64_t hash_key(long long int key, uint64_t seed);
+
+
+// the ranges used by the range-checking demonstrations, which are
+// those of the rules above unless a rules file loaded at run time (see
+// load_rules() below) gives the int, float, or element rule a range of
+// its own; the rule for int or element may also give a set of allowed
+// values, which is otherwise empty
+extern int int_demo_low;
+extern int int_demo_high;
+extern float float_demo_low;
+extern float float_demo_high;
+extern element element_demo_low;
+extern element element_demo_high;
+extern allowed_set<int> int_demo_set;
+extern allowed_set<element> element_demo_set;
+
+// why a reader of main.cpp, or an input source, stopped before it got
+// a value: its input ended, or it reached one of the limits of its
+// read budget (see the readers in main.cpp)
+
+enum read_status {
+    READ_OK = 0,            // the last reader got a value
+    READ_END_OF_INPUT,      // the input ended first
+    READ_RETRY_LIMIT,       // too many invalid inputs were rejected
+    READ_BYTE_LIMIT,        // too many characters were read
+    READ_TIME_LIMIT         // too much time went by
+};
+
+//////////////////////////////////////////////////////////////////////
+
+
+// prototypes for the buffer-based parsing engine used by the readers
+//
+// each parse_value() function skips any leading whitespace in the
+// characters from first up to (but not including) last, and then
+// attempts to get a value of its data type from the characters that
+// follow, just as cin >> would.  On success the value is stored and a
+// pointer just past the characters used is returned; on failure, a
+// null pointer is returned and the value is left unchanged
+
+const char *parse_value(const char *first, const char *last, int &value);
+
+const char *parse_value(const char *first, const char *last,
+                        long int &value);
+
+const char *parse_value(const char *first, const char *last,
+                        float &value);
+
+const char *parse_value(const char *first, const char *last,
+                        double &value);
+
+const char *parse_value(const char *first, const char *last, char &value);
+
+const char *parse_value(const char *first, const char *last, bool &value);
+
+const char *parse_value(const char *first, const char *last,
+                        std::string &value);
+
+const char *parse_value(const char *first, const char *last,
+                        std::string_view &value);
+
+
+// the functions that find the characters cin >> treats as whitespace
+// in the "C" locale: is_whitespace() tells whether c is one of them,
+// and skip_whitespace() returns a pointer to the first character from
+// first up to (but not including) last that is not, or last if there
+// is none
+
+bool is_whitespace(char c);
+
+const char *skip_whitespace(const char *first, const char *last);
+
+
+// whether the parsing engine is in strict mode, in which a record must
+// hold exactly one value, with nothing but whitespace around it; "42"
+// and " 42 " are then whole numbers, but "42abc" and "42 43" are not,
+// instead of being taken as 42 with the rest left for the next input
+//
+// the parse_value() functions, and the validators built on them, check
+// this as part of the same scan that gets the value, so that strict
+// mode costs no more than looking at the characters after the value
+//
+// each thread has a mode of its own, so that the threads of library
+// calls with different settings can parse at once; the batch mode sets
+// it on each of its threads from batch_options::strict
+
+extern thread_local bool strict_tokens;
+
+// it returns true if the value whose characters end at end makes up a
+// whole record ending at last, as strict mode requires, or if strict
+// mode is off
+
+bool ends_token(const char *end, const char *last);
+
+
+// prototype for the delimiter scanner, which uses AVX2, SSE2, or NEON
+// instructions, whichever the program is compiled for, to compare many
+// characters at a time
+//
+// it returns a pointer to the first character in the range from first
+// up to (but not including) last that matches delim, or last if there
+// is none
+
+const char *find_delimiter(const char *first, const char *last, char delim);
+
+
+
+
+
+// the input sources that the readers and the batch mode get their
+// records from
+//
+// a record is one line of input, not including its newline; the
+// characters of a record delimited by next_record() stay valid until
+// the next call to next_record()
+
+class input_source {
+public:
+    virtual ~input_source() {}
+
+    // POST: if another record is available, first and last delimit
+    //       it and true has been returned; at the end of the input,
+    //       false has been returned
+    virtual bool next_record(const char *&first, const char *&last) = 0;
+
+    // POST: if more input is available, first and last delimit a
+    //       block of whole records, each ended by its newline (except
+    //       perhaps the last record of the input), of roughly size
+    //       characters or more, and true has been returned; at the end
+    //       of the input, false has been returned
+    //
+    // a source should be read with next_record() or with
+    // next_block(), but not both
+    virtual bool next_block(const char *&first, const char *&last,
+                            size_t size) = 0;
+
+    // POST: from now on, while waiting for the rest of a record, the
+    //       source gives up on the input once it holds more than
+    //       max_bytes characters of the record (unless max_bytes is 0),
+    //       or once deadline has passed, so that next_record() returns
+    //       false as if the input had ended
+    //
+    // a source whose records are already in memory never waits, so by
+    // default the limits are ignored
+    virtual void set_limits(uint64_t,
+                            std::chrono::steady_clock::time_point) {}
+
+    // POST: once next_record() has returned false, the reason has been
+    //       returned: READ_END_OF_INPUT, or the limit that was reached
+    virtual read_status end_reason() const { return READ_END_OF_INPUT; }
+
+    // POST: whether the blocks handed out stay where they are until
+    //       they are given back with release_block() has been
+    //       returned; if not, each is only valid until the next call
+    //       of next_block()
+    virtual bool keeps_blocks() const { return false; }
+
+    // PRE:  a block handed out by next_block() has not been released
+    //
+    // POST: the oldest such block has been given back, so that a
+    //       source that keeps its blocks may use its memory again
+    virtual void release_block() {}
+};
+
+// an input source that reads a file descriptor, standard input by
+// default, in large blocks and finds the records in place
+class stdin_source : public input_source {
+public:
+    explicit stdin_source(int fd = STDIN_FILENO);
+
+    bool next_record(const char *&first, const char *&last);
+    bool next_block(const char *&first, const char *&last, size_t size);
+    void set_limits(uint64_t max_bytes,
+                    std::chrono::steady_clock::time_point deadline);
+    read_status end_reason() const { return reason; }
+
+private:
+    void read_more();
+
+    int fd;                     // the file descriptor being read
+    std::vector<char> buffer;   // the characters read but not yet used
+    size_t begin;               // the position of the first unused one
+    size_t scanned;             // the position up to which no newline
+                                // has been found
+    size_t end;                 // the position just past the last one
+    bool at_end;                // whether the end of input has been seen
+    uint64_t max_bytes;         // the limits given to set_limits()
+    std::chrono::steady_clock::time_point deadline;
+    read_status reason;         // why the input ended, or READ_OK
+};
+
+// an input source that finds the records in a range of characters
+// that is already in memory, without copying them
+class memory_source : public input_source {
+public:
+    memory_source(const char *first = nullptr, const char *last = nullptr);
+
+    // POST: the source holds the records from first up to last
+    void reset(const char *first, const char *last);
+
+    bool next_record(const char *&first, const char *&last);
+    bool next_block(const char *&first, const char *&last, size_t size);
+
+    // POST: the number of records left in the source has been returned
+    size_t records() const;
+
+    bool keeps_blocks() const { return true; }
+
+protected:
+    const char *position;   // the start of the next record
+    const char *finish;     // the end of the characters
+};
+
+// an input source that maps a whole file into memory and finds the
+// records in the mapped bytes, without copying them
+class mapped_file_source : public memory_source {
+public:
+    mapped_file_source();
+    ~mapped_file_source();
+
+    // POST: if the file could be mapped, true has been returned;
+    //       otherwise errno describes the problem and false has been
+    //       returned
+    bool open(const char *path);
+
+private:
+    void *mapping;          // the start of the mapping, if any
+    size_t length;          // the length of the mapped file
+};
+
+// what kind of compression, if any, a file or stream starts with
+enum compression_kind {
+    COMPRESSION_NONE,
+    COMPRESSION_GZIP,           // gzip or zlib, which zlib can inflate
+    COMPRESSION_ZSTD            // zstd, which this build cannot read
+};
+
+// an input source that decompresses a gzip or zlib stream as it is
+// read, on a thread of its own, so that decompressing the next part of
+// the input overlaps with validating the part before it
+//
+// the decompressing thread inflates the stream into a few reusable
+// buffers of a fixed size, and the records are handed out in place
+// from those buffers; a record that is cut in two by the end of a
+// buffer is put back together by copying its start into the room left
+// in front of the next buffer, and only a record longer than that room
+// is gathered into a buffer of its own
+class gzip_source : public input_source {
+public:
+    gzip_source();
+    ~gzip_source();
+
+    // PRE:  fd is open for reading, and no stream has been opened yet
+    //
+    // POST: the decompressing thread has been started, reading from
+    //       fd, which it closes when it is done (0 is left open)
+    void open(int fd);
+
+    bool next_record(const char *&first, const char *&last);
+    bool next_block(const char *&first, const char *&last, size_t size);
+
+    // POST: whether the stream turned out to be corrupt or cut short
+    //       has been returned, once the records have all been read
+    bool failed() const { return corrupt; }
+
+    // POST: whether bytes that are not another gzip member, such as
+    //       zero padding, were found after the last member and ignored
+    //       has been returned, once the records have all been read
+    bool ignored_trailing() const { return trailing; }
+
+    // a block is handed out in place from the buffer it was inflated
+    // into, which is not inflated into again until every block handed
+    // out from it has been released
+    bool keeps_blocks() const { return true; }
+    void release_block();
+
+private:
+    // the size of each buffer, the room in front of it for the start
+    // of a record cut in two, and the number of buffers, which is one
+    // for each of the blocks the batch mode can have in flight at once
+    // (see PIPELINE_DEPTH), and one more to inflate into meanwhile
+    static const size_t CHUNK_SIZE = 16 << 20;
+    static const size_t CARRY_ROOM = 64 << 10;
+    static const size_t CHUNKS = 5;
+
+    // a block that has been handed out and not yet released, with the
+    // buffer it is in, or CHUNKS and the gathered buffer that holds it
+    // if it came from one
+    struct held_block {
+        size_t chunk;
+        std::vector<char> gathered;
+    };
+
+    struct chunk {
+        std::unique_ptr<char[]> data;   // CARRY_ROOM characters of
+                                        // room, followed by the
+                                        // inflated ones
+        size_t size = 0;                // the number of inflated ones
+    };
+
+    void decompress();
+    void take_chunk();
+    void release(size_t index);
+    void replace_current(size_t index);
+    bool is_held(size_t index) const;
+    void hand_out(const char *&first, const char *&last, const char *stop);
+
+    int fd;
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable changed;
+    std::vector<chunk> chunks;
+    std::deque<size_t> ready;       // the inflated buffers, in order
+    std::deque<size_t> available;   // the buffers free to inflate into
+    std::deque<held_block> held;    // the blocks handed out, in order
+    bool finished;                  // whether the worker is done
+    bool stopping;                  // whether the worker should stop
+    std::atomic<bool> corrupt;
+    std::atomic<bool> trailing;
+
+    // the buffer the records are being handed out from, which is
+    // either one of the chunks or, for an overlong record, carry
+    size_t current;                 // the chunk, or CHUNKS if none
+    std::vector<char> carry;
+    const char *begin;              // the first unused character
+    const char *scanned;            // how far no newline has been found
+    const char *end;                // just past the last one
+    bool at_end;                    // whether everything has been read
+};
+
+compression_kind compression_of(const unsigned char *first, size_t size);
+
+
+// the possible outcomes of validating a value in a single pass over
+// its characters, which tell which of the two checks, if any, failed
+
+enum validation_outcome {
+    VALID,              // the value is of the right data type and is
+                        // within the range
+    INVALID_TYPE,       // the value is not of the right data type
+    INVALID_RANGE       // the value is of the right data type, but is
+                        // not within the range
+};
+
+
+// prototypes for the fused validators, which type-check and
+// range-check a value in a single pass over its characters, just as
+// parse_value() followed by a range check would
+//
+// on VALID or INVALID_RANGE, the value is stored and end is set to
+// point just past the characters used; on INVALID_TYPE, neither is
+// changed; a string, though, is only stored on VALID, so that one that
+// is rejected is never copied
+//
+// for whole numbers, the digits are read and checked to fit in a T in
+// the same pass; a value with too many digits to fit in a T is always
+// INVALID_TYPE, however far outside the range it is, so that the
+// outcome of a record never depends on how it is being observed
+
+template <typename T>
+validation_outcome validate_whole_number(const char *first,
+                                         const char *last, T low, T high,
+                                         T &value, const char *&end);
+
+template <typename T>
+validation_outcome validate_value(const char *first, const char *last,
+                                  T low, T high, T &value,
+                                  const char *&end);
+
+
+// prototypes for the functions that apply a validation rule while
+// parsing
+//
+// validate_by_rule() type-checks a value like parse_value(), storing
+// it and setting end just past the characters used, and returns VALID
+// or INVALID_TYPE; for whole numbers, it also range-checks the value
+// in the same pass over its digits, as validate_whole_number() does,
+// so INVALID_RANGE may be returned as well; other values are only
+// type-checked
+//
+// closed_low() and closed_high() give the closed range that holds the
+// same values as the range of the rule
+
+template <auto Rule>
+validation_outcome validate_by_rule(const char *first, const char *last,
+                                    typename decltype(Rule)::value_type &value,
+                                    const char *&end);
+
+template <auto Rule>
+constexpr typename decltype(Rule)::value_type closed_low();
+
+template <auto Rule>
+constexpr typename decltype(Rule)::value_type closed_high();
+
+
+// a log of rejected records, written as newline-delimited JSON to a
+// side channel instead of as retry messages to the user
+//
+// each entry gives the byte offset of the record (or of the rejected
+// value within it) in the input, its line number, which check failed
+// ("type" or "range"), and its raw bytes, for example
+//
+//     {"offset":12,"line":3,"rule":"range","bytes":"40"}
+//
+// an entry for a record with several fields also gives the number of
+// the field that failed, counting from 1, as in "field":2
+//
+// record() only copies the entry into a fixed ring of slots, without
+// taking any lock; a writer thread of its own empties the ring into
+// the log file in large pieces; no entry is ever dropped, so if the
+// ring is full, because the records are rejected faster than the log
+// file can take them, record() waits for the writer to free a slot
+// (with a C++20 atomic wait, which sleeps rather than spins), which
+// slows the validating threads down to the pace of the log; the log is
+// an audit trail, so losing entries is worse than waiting for it
+//
+// the writer itself sleeps the same way while the ring is empty, and
+// is woken by the next entry recorded, rather than polling for one
+
+// the most raw bytes kept in one entry; longer records are cut short,
+// and their entries marked "truncated":true
+const size_t REJECTION_BYTES = 216;
+
+class rejection_log {
+public:
+    rejection_log();
+    ~rejection_log();
+
+    // POST: if path could be opened for writing, the writer thread has
+    //       been started and true has been returned; otherwise errno
+    //       says why not and false has been returned
+    bool open(const char *path);
+
+    // PRE:  open() has succeeded, first and last delimit the raw bytes
+    //       of the rejected record or value, and field is the number
+    //       of the field that failed, or 0 if the record has only one
+    //
+    // POST: the entry has been queued for the writer thread, once
+    //       there was room for it in the ring
+    void record(uint64_t offset, uint64_t line, validation_outcome reason,
+                const char *first, const char *last, uint32_t field = 0);
+
+private:
+    // one entry of the ring, which is free for a producer to fill when
+    // its sequence equals the position it is claimed for, and ready
+    // for the writer to empty when it equals that position plus one
+    struct alignas(64) slot {
+        std::atomic<size_t> sequence;
+        uint64_t offset;
+        uint64_t line;
+        validation_outcome reason;
+        uint32_t length;            // the length of the whole record
+        uint32_t field;
+        char bytes[REJECTION_BYTES];
+    };
+
+    static const size_t CAPACITY = 1 << 14;     // a power of two
+
+    void write_entries();
+    bool drain(std::string &out);
+    void flush(std::string &out);
+
+    std::unique_ptr<slot[]> ring;
+    alignas(64) std::atomic<size_t> enqueue_position;
+    alignas(64) size_t dequeue_position;    // used only by the writer
+    alignas(64) std::atomic<uint32_t> published;    // counts the
+                                                    // entries recorded,
+                                                    // to wake the writer
+    std::atomic<bool> sleeping; // whether the writer may be asleep
+    std::atomic<bool> stopping;
+    int fd;
+    std::thread writer;
+};
+
+
+void append_json_string(std::string &out, const char *first, const char *last);
+
+
+// the instrumentation counters, which count what the readers and the
+// batch mode have done, one set of counters per thread
+//
+// each thread only ever adds to its own counters, so counting takes no
+// lock and the counters of different threads never share a cache line;
+// the counters of every thread that has counted anything are only
+// added up when they are asked for, by snapshot_counters()
+struct alignas(64) validation_counters {
+    std::atomic<uint64_t> accepted{0};          // values accepted
+    std::atomic<uint64_t> type_rejections{0};   // values of the wrong
+                                                // type
+    std::atomic<uint64_t> range_rejections{0};  // values out of range
+    std::atomic<uint64_t> bytes_skipped{0};     // characters discarded
+                                                // to get back to the
+                                                // start of a record
+    std::atomic<uint64_t> parse_nanoseconds{0}; // time spent validating
+};
+
+// the values of one thread's counters at one moment
+struct counter_snapshot {
+    uint64_t accepted = 0;
+    uint64_t type_rejections = 0;
+    uint64_t range_rejections = 0;
+    uint64_t bytes_skipped = 0;
+    uint64_t parse_nanoseconds = 0;
+};
+
+// measures the time from its construction to its destruction, and adds
+// it to the parse time of the thread, if parse times are being measured
+class parse_timer {
+public:
+    parse_timer();
+    ~parse_timer();
+
+private:
+    std::chrono::steady_clock::time_point start;
+};
+
+// whether parse times are being measured, which costs two clock reads
+// per value read interactively, and per chunk in batch mode
+extern bool timing_parses;
+
+validation_counters &thread_counters();
+
+void add_count(std::atomic<uint64_t> &counter, uint64_t amount);
+
+std::vector<counter_snapshot> snapshot_counters();
+
+std::string format_counters(bool json);
+
+bool export_counters(const char *path, bool json);
+
+//////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////
+
+
+// prototypes for the functions that perform non-interactive batch
+// type-checking and range-checking data validation over a whole input
+// stream, one record per line, using the same rules as the
+// demonstrations above
+
+
+// the most validating threads the batch mode will start, which is far
+// more than any machine it runs on has processors
+const unsigned int MAX_THREADS = 1024;
+
+// a rule for one field of a record with several fields, which unlike
+// a validation_rule is chosen at run time
+//
+// check(first, last, out) validates the characters of the field, from
+// first up to last, as one value, just as validate_value() does, and
+// if the outcome is VALID, appends the value to out
+struct field_rule {
+    std::string type;           // the name of the data type
+    std::function<validation_outcome(const char *, const char *,
+                                     std::string &)>
+        check;
+};
+
+struct chunk_result;
+class rejection_log;
+class column_writer;
+class validation_cache;
+
+// the settings of the batch mode, given on the command line, or by a
+// program using it as a library (see validation.h)
+//
+// they are all kept here, rather than in globals, so that library
+// calls with different settings can run at once
+struct batch_options {
+    unsigned int threads = 1;   // the number of validating threads
+    std::vector<unsigned int> cpus;     // the processor to pin each
+                                        // thread to, if they are pinned
+    bool steal = false;         // whether idle threads steal chunks
+    std::vector<field_rule> fields;     // the schema of a record, if it
+                                        // has several fields
+    char delimiter = ',';       // what separates the fields
+    bool strict = false;        // whether records must be one token
+                                // each (see strict_tokens)
+    rejection_log *rejections = nullptr;    // where to log the rejected
+                                            // records, if anywhere
+    validation_cache *cache = nullptr;      // the outcome cache, if any
+    column_writer *columns = nullptr;       // the columnar output, if
+                                            // any
+
+    // where the results of the chunks go, in their original order, if
+    // not to the columnar output or standard output (with the counts
+    // to standard error)
+    std::function<void(const chunk_result &)> deliver;
+};
+
+// a validation rule loaded at run time from a rules file, which can
+// be used either for whole records in batch mode or for one field of a
+// record
+//
+// batch validates the records of a source just as the built-in rule
+// for its data type would, but with its own range, and demonstrate
+// gives the demonstration of the same name, if there is one for its
+// data type, the same range; it is kept apart, so that the rules of a
+// file can all be checked before any of them takes effect
+struct loaded_rule {
+    std::string name;
+    field_rule field;
+    std::function<void(input_source &, const batch_options &)> batch;
+    std::function<void()> demonstrate;
+};
+
+
+// the outcome of validating a run of records in batch mode
+struct chunk_result {
+    std::string accepted;       // the accepted values, one per line
+    long accepted_count = 0;    // the number of accepted records
+    long rejected_count = 0;    // the number of rejected records
+    uint64_t first_offset = 0;  // the input offset of the chunk
+    uint64_t first_line = 0;    // the line number of its first record,
+                                // if rejections are being logged
+
+    // the values of every non-blank record, valid or not, in their
+    // binary form, and a bitmap telling which of them were accepted,
+    // if the output is columnar
+    std::string column;
+    std::vector<uint64_t> validity;
+    uint64_t slots = 0;         // the number of values in the column
+
+    // POST: the result is empty again, but keeps the memory its
+    //       buffers already have, wherever it was placed
+    void clear() {
+        accepted.clear();
+        accepted_count = 0;
+        rejected_count = 0;
+        first_offset = 0;
+        first_line = 0;
+        column.clear();
+        validity.clear();
+        slots = 0;
+    }
+};
+
+// the data types of the values in a columnar output file
+enum column_type : uint32_t {
+    COLUMN_NONE = 0,            // not a data type columns can hold
+    COLUMN_INT32 = 1,
+    COLUMN_INT64 = 2,
+    COLUMN_FLOAT32 = 3,
+    COLUMN_FLOAT64 = 4
+};
+
+
+// a columnar output file that is written one chunk_result at a time
+class column_writer {
+public:
+    column_writer();
+    ~column_writer();
+
+    // POST: if path could be opened for writing, room has been left
+    //       for the header and true has been returned; otherwise errno
+    //       says why not and false has been returned
+    bool open(const char *path, column_type type);
+
+    // PRE:  open() has succeeded
+    //
+    // POST: the column of result has been written to the file, and its
+    //       validity bitmap added to the one held in memory
+    void append(const chunk_result &result);
+
+    // PRE:  open() has succeeded
+    //
+    // POST: the padding, the validity bitmap, and the header have
+    //       been written and the file closed, and whether all of it
+    //       could be written has been returned
+    bool close();
+
+private:
+    bool write_all(const char *data, size_t size);
+
+    // the size of each value of the column, in bytes
+    uint32_t width() const {
+        return ((type == COLUMN_INT64) || (type == COLUMN_FLOAT64)) ? 8 : 4;
+    }
+
+    int fd;
+    column_type type;
+    uint64_t written;           // the bytes of values written so far
+    uint64_t length;            // the number of values written so far
+    uint64_t null_count;
+    std::vector<uint64_t> validity;
+    bool failed;                // whether any write has failed
+};
+
+column_type column_type_named(const std::string &type);
+
+// a cache of the outcomes of type-checking the records of batch mode,
+// kept in a file between runs, so that a run over input that has
+// mostly not changed since the last one only parses the records that
+// have
+//
+// each entry is keyed by a hash of the bytes of a record, seeded with
+// a fingerprint of the check that was made of it (its data type, its
+// range, and the parser used), and holds the outcome of type-checking
+// the record and, if it held a value, the value itself; the range
+// check, which is done on a whole column of values at once, and any
+// set of allowed values, are checked again on every run
+//
+// the file is a header followed by a power-of-two number of 16-byte
+// slots, which is mapped into memory and shared by all the threads;
+// the key of an entry is stored mixed with its value, so that an
+// entry torn by two threads writing the same slot at once fails to
+// match either of them, and that record is simply parsed again
+
+
+class validation_cache {
+public:
+    validation_cache();
+    ~validation_cache();
+
+    // POST: if path names a cache file of this version with room for
+    //       at least about half of expected_records entries, it has
+    //       been mapped into memory; otherwise it has been made again,
+    //       empty, with room for all of them; in either case true has
+    //       been returned, unless the file could not be opened or
+    //       mapped, in which case errno says why not and false has
+    //       been returned
+    bool open(const char *path, uint64_t expected_records);
+
+    // PRE:  open() has succeeded
+    //
+    // POST: if there is an entry for key, its outcome and value have
+    //       been stored in outcome and payload and true has been
+    //       returned; otherwise false has been returned
+    bool find(uint64_t key, validation_outcome &outcome,
+              uint64_t &payload) const;
+
+    // PRE:  open() has succeeded
+    //
+    // POST: there is an entry for key holding outcome and payload,
+    //       which may have taken the place of an older entry
+    void insert(uint64_t key, validation_outcome outcome,
+                uint64_t payload);
+
+    // POST: hits and misses have been added to the counts of lookups
+    //       that found an entry and that did not
+    void count(uint64_t hits, uint64_t misses);
+
+    // PRE:  open() has succeeded
+    //
+    // POST: the processor has been asked to start fetching the slots
+    //       that key may be found in, and key has been returned
+    uint64_t prefetch(uint64_t key) const {
+        __builtin_prefetch(&slots[(key >> 2) & mask]);
+        return key;
+    }
+
+    uint64_t hits() const { return hit_count.load(); }
+    uint64_t misses() const { return miss_count.load(); }
+
+private:
+    struct slot {
+        uint64_t tag;           // the key and outcome, mixed with the
+                                // payload
+        uint64_t payload;
+    };
+
+    // the slots in which an entry may be found, starting from the one
+    // its key gives
+    static const size_t PROBES = 8;
+
+    void *mapping;
+    size_t length;              // the length of the mapped file
+    slot *slots;
+    uint64_t mask;              // the number of slots, less one
+    std::atomic<uint64_t> hit_count;
+    std::atomic<uint64_t> miss_count;
+};
+
+
+// the processors of the machine, grouped by the NUMA node (the
+// socket, with its own memory) that they belong to
+//
+// memory is faster to reach from the processors of its own node, and
+// Linux places each page of memory on the node of the thread that
+// first touches it; so a thread that stays on one processor, and
+// allocates and fills its own buffers, keeps its memory traffic on its
+// own node instead of sending it across to another socket
+struct numa_topology {
+    std::vector<std::vector<unsigned int>> nodes;   // the processors of
+                                                    // each
+};
+
+// prototypes for the functions that find out the topology and pin
+// threads to it
+//
+// parse_cpu_list() reads a list of processors such as "0-3,8,10-11",
+// and parse_topology() reads one list per node, separated by slashes,
+// such as "0-3,8-11/4-7,12-15"; each returns false if the text is not
+// such a list
+//
+// read_system_topology() reads the topology of the machine from
+// /sys/devices/system/node, or treats the machine as a single node if
+// it cannot
+//
+// place_threads() returns the processor for each of threads threads,
+// giving each node an equal share of consecutively numbered threads,
+// which validate neighbouring chunks of the input
+//
+// pin_thread() pins the calling thread to the processor cpu, returning
+// false if it cannot
+
+bool parse_topology(const std::string &spec, numa_topology &topology);
+
+void read_system_topology(numa_topology &topology);
+
+std::vector<unsigned int> place_threads(const numa_topology &topology,
+                                   unsigned int threads);
+
+
+// it reads a number of validating threads from text, which must be a
+// whole number from 0 to MAX_THREADS, where 0 means one thread per
+// processor; if text is not such a number, false is returned
+
+bool parse_thread_count(const char *text, unsigned int &threads);
+
+
+void append_value(std::string &out, int value);
+
+void append_value(std::string &out, long int value);
+
+void append_value(std::string &out, float value);
+
+void append_value(std::string &out, double value);
+
+void append_value(std::string &out, char value);
+
+void append_value(std::string &out, bool value);
+
+void append_value(std::string &out, const std::string &value);
+
+void append_value(std::string &out, std::string_view value);
+
+
+bool batch_validate(const std::string &type, input_source &source,
+                    const batch_options &options);
+
+
+const loaded_rule *find_loaded_rule(const std::string &name);
+
+bool load_rules(const char *path, std::string &error);
+
+bool parse_schema(const std::string &spec, std::vector<field_rule> &schema);
+
+
+
+//////////////////////////////////////////////////////////////////////
+
+
+template <auto Rule>
+constexpr typename decltype(Rule)::value_type closed_low() {
+
+    // PRE:  none
+    //
+    // POST: see the prototype; for a fractional number, the value
+    //       just above an open bound is the next representable one
+
+    typedef typename decltype(Rule)::value_type T;
+
+    if (! Rule.low_open) {
+        return Rule.low;
+    } else if constexpr (std::is_integral_v<T>) {
+        return T(Rule.low + 1);
+    } else {
+        return std::nextafter(Rule.low, std::numeric_limits<T>::infinity());
+    }
+}
+
+template <auto Rule>
+constexpr typename decltype(Rule)::value_type closed_high() {
+
+    // PRE:  none
+    //
+    // POST: see the prototype; for a fractional number, the value
+    //       just below an open bound is the next representable one
+
+    typedef typename decltype(Rule)::value_type T;
+
+    if (! Rule.high_open) {
+        return Rule.high;
+    } else if constexpr (std::is_integral_v<T>) {
+        return T(Rule.high - 1);
+    } else {
+        return std::nextafter(Rule.high, -std::numeric_limits<T>::infinity());
+    }
+}
+
+template <typename T>
+validation_outcome validate_whole_number(const char *first,
+                                         const char *last, T low, T high,
+                                         T &value, const char *&end) {
+
+    // PRE:  first and last delimit a range of characters, and T is a
+    //       signed whole number data type
+    //
+    // POST: see the prototype
+
+    const char *digit = skip_whitespace(first, last);
+    bool negative = false;
+
+    // cin >> accepts a single leading plus or minus sign
+    if ((digit != last) && ((*digit == '+') || (*digit == '-'))) {
+        negative = (*digit == '-');
+        ++digit;
+    }
+
+    // the largest magnitude that the value may have and still fit in
+    // a T
+    const unsigned long long type_limit = negative
+        ? 0ull - static_cast<unsigned long long>(std::numeric_limits<T>::min())
+        : static_cast<unsigned long long>(std::numeric_limits<T>::max());
+
+    // accumulate the digits
+    const char *digits = digit;
+    unsigned long long magnitude = 0;
+
+    while ((digit != last) && (*digit >= '0') && (*digit <= '9')) {
+        unsigned int next = *digit - '0';
+
+        // a value that does not fit in a T is not a T, just as it is
+        // not for cin >>
+        if ((magnitude > type_limit / 10)
+            || ((magnitude == type_limit / 10)
+                && (next > type_limit % 10))) {
+            return INVALID_TYPE;
+        }
+        magnitude = magnitude * 10 + next;
+        ++digit;
+    }
+    if ((digit == digits) || ! ends_token(digit, last)) {
+        return INVALID_TYPE;
+    }
+
+    value = negative ? T(0ull - magnitude) : T(magnitude);
+    end = digit;
+    return ((value < low) || (value > high)) ? INVALID_RANGE : VALID;
+}
+
+template <typename T>
+validation_outcome validate_value(const char *first, const char *last,
+                                  T low, T high, T &value,
+                                  const char *&end) {
+
+    // PRE:  first and last delimit a range of characters
+    //
+    // POST: see the prototype
+
+    if constexpr (std::is_same_v<T, int> || std::is_same_v<T, long int>) {
+        return validate_whole_number(first, last, low, high, value, end);
+    } else if constexpr (std::is_same_v<T, std::string>) {
+
+        // check the string in place, and only copy it into value once
+        // it is known to be valid, so that a rejected string costs no
+        // memory allocation at all
+        std::string_view candidate;
+        const char *next = parse_value(first, last, candidate);
+
+        if (next == nullptr) {
+            return INVALID_TYPE;
+        }
+        end = next;
+        if ((candidate < std::string_view(low))
+            || (candidate > std::string_view(high))) {
+            return INVALID_RANGE;
+        }
+        value.assign(candidate);
+        return VALID;
+    } else {
+        T candidate;
+        const char *next = parse_value(first, last, candidate);
+
+        if (next == nullptr) {
+            return INVALID_TYPE;
+        }
+        value = candidate;
+        end = next;
+        return ((value < low) || (value > high)) ? INVALID_RANGE : VALID;
+    }
+}
+
+template <auto Rule>
+validation_outcome validate_by_rule(const char *first, const char *last,
+                                    typename decltype(Rule)::value_type &value,
+                                    const char *&end) {
+
+    // PRE:  first and last delimit a range of characters
+    //
+    // POST: see the prototype
+
+    typedef typename decltype(Rule)::value_type T;
+
+    if constexpr (std::is_same_v<T, int> || std::is_same_v<T, long int>) {
+
+        // the bounds are constants here, so the compiler can fold the
+        // limits of the digit loop
+        return validate_whole_number(first, last, closed_low<Rule>(),
+                                     closed_high<Rule>(), value, end);
+    } else {
+        const char *next = parse_value(first, last, value);
+        if (next == nullptr) {
+            return INVALID_TYPE;
+        }
+        end = next;
+        return VALID;
+    }
+}
+
+
+template <typename T>
+void allowed_set<T>::assign(std::vector<T> values) {
+
+    // PRE:  see the prototype
+    //
+    // POST: see the prototype
+
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+    members = std::move(values);
+    bits.clear();
+    seeds.clear();
+    slots.clear();
+    if (members.empty()) {
+        return;
+    }
+
+    // whole numbers and characters are kept as a bitset, as long as
+    // it takes no more than about 64 bits for each member
+    if constexpr (std::is_integral_v<T>) {
+        uint64_t span = uint64_t(int64_t(members.back()))
+                        - uint64_t(int64_t(members.front())) + 1;
+        if ((span != 0) && (span <= 64 * members.size() + 4096)) {
+            smallest = members.front();
+            bits.assign((span + 63) / 64, 0);
+            for (const T &member : members) {
+                uint64_t offset = uint64_t(int64_t(member))
+                                  - uint64_t(int64_t(smallest));
+                bits[offset / 64] |= uint64_t(1) << (offset % 64);
+            }
+            return;
+        }
+    }
+
+    // otherwise find a perfect hash, with at least twice as many slots
+    // as members and about four members to a bucket, making the table
+    // larger in the unlikely case that no seed can be found for some
+    // bucket
+    size_t slot_count = 1;
+    while (slot_count < 2 * members.size()) {
+        slot_count *= 2;
+    }
+    while (! place((members.size() + 3) / 4, slot_count)) {
+        slot_count *= 2;
+    }
+}
+
+template <typename T>
+bool allowed_set<T>::place(size_t bucket_count, size_t slot_count) {
+
+    // PRE:  members is not empty, and slot_count is a power of two at
+    //       least as large as the number of members
+    //
+    // POST: if a seed could be found for each of bucket_count buckets,
+    //       such that the members of every bucket hash with its seed
+    //       to slots that no other member hashes to, seeds and slots
+    //       hold the table and true has been returned; otherwise false
+    //       has been returned
+    //
+    // this is the hash and displace method: the members are split
+    // into buckets by a first hash, and the largest buckets, which are
+    // the hardest to place, are given their seeds first, while most of
+    // the slots are still empty
+
+    const uint32_t MAX_SEED = 1 << 16;
+    std::vector<std::vector<uint32_t>> buckets(bucket_count);
+    std::vector<size_t> order(bucket_count);
+    std::vector<size_t> taken;
+
+    for (size_t i = 0; i < members.size(); ++i) {
+        buckets[hash_key(members[i], 0) % bucket_count].push_back(i);
+    }
+    for (size_t i = 0; i < bucket_count; ++i) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return buckets[a].size() > buckets[b].size();
+    });
+
+    seeds.assign(bucket_count, 0);
+    slots.assign(slot_count, 0);
+    for (size_t index : order) {
+        const std::vector<uint32_t> &bucket = buckets[index];
+        uint32_t seed = 1;
+
+        for (; seed < MAX_SEED; ++seed) {
+            taken.clear();
+            for (uint32_t member : bucket) {
+                size_t slot = hash_key(members[member], seed)
+                              & (slot_count - 1);
+                if ((slots[slot] != 0)
+                    || (find(taken.begin(), taken.end(), slot)
+                        != taken.end())) {
+                    break;
+                }
+                taken.push_back(slot);
+            }
+            if (taken.size() == bucket.size()) {
+                break;
+            }
+        }
+        if (seed == MAX_SEED) {
+            return false;
+        }
+
+        seeds[index] = seed;
+        for (size_t i = 0; i < bucket.size(); ++i) {
+            slots[taken[i]] = bucket[i] + 1;
+        }
+    }
+    return true;
+}
+
+template <typename T>
+template <typename Key>
+bool allowed_set<T>::contains(const Key &value) const {
+
+    // PRE:  see the prototype
+    //
+    // POST: see the prototype
+
+    if (members.empty()) {
+        return false;
+    }
+    if constexpr (std::is_integral_v<T>) {
+        if (! bits.empty()) {
+            uint64_t offset = uint64_t(int64_t(value))
+                              - uint64_t(int64_t(smallest));
+            return (value >= smallest) && (offset / 64 < bits.size())
+                   && ((bits[offset / 64] >> (offset % 64)) & 1);
+        }
+    }
+
+    uint32_t seed = seeds[hash_key(value, 0) % seeds.size()];
+    uint32_t slot = slots[hash_key(value, seed) & (slots.size() - 1)];
+    return (slot != 0) && (members[slot - 1] == value);
+}
+
+}   // namespace validation
+
+#endif